@@ -188,7 +188,6 @@ protected:
     byte mu8_DebugLevel; // 0, 1, or 2
     byte mu8_PacketBuffer[PN532_PACKBUFFSIZE];
 
-private:
     byte mu8_ClkPin;
     byte mu8_MisoPin;
     byte mu8_MosiPin;
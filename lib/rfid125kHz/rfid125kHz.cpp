@@ -96,6 +96,19 @@ String RFID_Reader::GetHexID()
   return "None";
 }
 
+/*
+Returns the ID as a number, and resets the Available flag.
+*/
+bool RFID_Reader::GetID(unsigned long long &id)
+{
+  if (!data_available)
+    return false;
+  id = new_ID;
+  lasttagtype = tagtype;
+  data_available = false;
+  return true;
+}
+
 /*
 Returns Tag type.
 */
@@ -139,11 +152,17 @@ void RFID_Reader::rfidSerial(char x)
     parse();
     ix = 0;
   }
-  else
+  else if (ix < sizeof(msg) - 1)
   {
     msg[ix] = x;
     ix++;
   }
+  else
+  {
+    // no end byte: drop the frame instead of writing past msg
+    errors++;
+    ix = 0;
+  }
 }
 
 uint8_t RFID_Reader::get_checksum(unsigned long long data)
@@ -188,6 +207,11 @@ void RFID_Reader::parse()
     recChecksum = (uint8_t)msg[i];
     tagtype = (uint8_t)msg[1];
   }
+  else if (msgLen != 11 && msgLen != 12)
+  {
+    errors++;
+    return;
+  }
   else
   {
     for (i = 0; i < 10; i++)
@@ -210,13 +234,23 @@ void RFID_Reader::parse()
     tagtype = 2;
   }
   if (checksum != recChecksum)
+  {
+    errors++;
     return;
+  }
+  frames++;
+  // The reader repeats the frame while the tag stays in the field, so the
+  // time counts from the last frame of the tag, not the last report.
   unsigned long _now = millis();
-  if ((_now - LastRFID > 3000) || (tagIdValue != last_ID))
+  if ((_now - LastRFID > repeatTime) || (tagIdValue != last_ID))
   {
     new_ID = tagIdValue;
     last_ID = tagIdValue;
     data_available = true;
-    LastRFID = _now;
   }
+  else
+  {
+    repeats++;
+  }
+  LastRFID = _now;
 }
@@ -44,6 +44,13 @@ public:
     String GetHexID();
     String GetDecID();
     String GetTagType();
+    // Takes the ID without building a String. Returns false if none is available.
+    bool GetID(unsigned long long &id);
+    // Time (ms) the same tag must be away before it is reported again.
+    void SetRepeatTime(unsigned long ms) { repeatTime = ms; }
+    unsigned long frames = 0;    // frames with a valid checksum
+    unsigned long errors = 0;    // bad checksums, lengths and overruns
+    unsigned long repeats = 0;   // valid frames of a tag that is still in the field
 
 private:
     char *ulltostr(unsigned long long value, char *ptr, int base);
@@ -58,6 +65,7 @@ private:
     uint8_t tagtype;
     uint8_t lasttagtype;
     unsigned long LastRFID = 0UL;
+    unsigned long repeatTime = 3000UL;
     char msg[15];
     uint8_t msgLen;
     byte ix = 0;
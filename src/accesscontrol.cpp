@@ -1,19 +1,34 @@
 #include "accesscontrol.h"
+#include "credentialindex.h"
+#include "eventbus.h"
 
 #define DEBUG_SERIAL if(DEBUG)Serial
 
-TCMWiegandClass TCMWiegand;
+TCMWiegandClass TCMWiegand[WIEGAND_MAX_READERS];
 AccessControlClass AccessControl;
 
-bool TCMWiegandClass::idle = true;
-unsigned long TCMWiegandClass::lastEdge_u = 0;
-unsigned long TCMWiegandClass::lastLoop_m = 0;
-ProxReaderInfo* TCMWiegandClass::reader;
+/**
+ * @brief Handles falling-edge interrupts on the D0 pin of a reader. Each
+ * reader gets its own instance so the ring is found without a lookup.
+ * Filtering is left to loop(); an edge that does not fit in the ring is
+ * counted as dropped.
+ */
+template <uint8_t Reader>
+ICACHE_RAM_ATTR void TCMWiegandClass::handleD0() {
+	TCMWiegand[Reader].edges.push(micros() & ~1UL);
+}
 
 /**
- * @brief Handles falling-edge interrupts on the D0 pin and filters out
- * false interrupts based on WIEGAND_MIN_TIME in microseconds.
- * 
+ * @brief Handles falling-edge interrupts on the D1 pin. See handleD0().
+ */
+template <uint8_t Reader>
+ICACHE_RAM_ATTR void TCMWiegandClass::handleD1() {
+	TCMWiegand[Reader].edges.push(micros() | 1UL);
+}
+
+/**
+ * @brief Filters out false edges based on config.wiegandMinTime in
+ * microseconds and passes the rest to the reader as bits.
  * 
  * False edges are detected when the Weigand signal passes through 
  * an optocoupler with slow edges.
@@ -22,102 +37,305 @@ ProxReaderInfo* TCMWiegandClass::reader;
  * overflow of the micros() counter.
  * 
  * idle is set by the loop() function.
+ *
+ * Edges are timestamped by the interrupt handlers, so a frame is ended here
+ * by the gap before the next edge even when loop() was late to drain them.
  */
-ICACHE_RAM_ATTR void TCMWiegandClass::handleD0() {
-	unsigned long nowMicros = micros();
-	unsigned long nowMillis = millis();
-	if (idle || nowMicros - lastEdge_u > WIEGAND_MIN_TIME) {
-		if (reader != NULL) {
-			reader->ISR_Data0();
+void TCMWiegandClass::processEdge(uint32_t edge) {
+	unsigned long at = edge & ~1UL;
+	uint8_t line = edge & 1;
+	unsigned long interval = at - lastEdge_u;
+	++stats.edges;
+	if (!idle && interval <= config.wiegandMinTime) {
+		++stats.glitches;
+		if (diagnostics.enabled) {
+			diagnostics.addGlitch(line, interval);
+		}
+		return;
+	}
+	if (diagnostics.enabled) {
+		if (!idle && frame.size() > 0 && interval <= frameGap()) {
+			diagnostics.addInterval(line, interval);
+		} else {
+			diagnostics.addEdge(line);
+		}
+	}
+
+	if (!idle && endedEarly && frame.size() == 0 && interval <= frameGap()) {
+		// the frame that ended early was longer than the learned length
+		++stats.earlyMistakes;
+		_learnedBits = 0;
+		candidateFrames = 0;
+	}
+	endedEarly = false;
+
+	if (frame.size() > 0) {
+		if (interval > frameGap()) {
+			completeFrame(false);
+		} else {
+			_bitPeriod = _bitPeriod ? _bitPeriod - _bitPeriod / 8 + interval / 8 : interval;
+		}
+	}
+
+	lastEdge_u = at;
+	lastEdge_m = millis();
+	idle = false;
+
+	if (!frame.push(line)) {
+		++stats.overflows;
+		return;
+	}
+
+	if (config.wiegandAdaptive && frame.size() == _learnedBits) {
+		completeFrame(true);
+	}
+}
+
+unsigned long TCMWiegandClass::frameGap() const {
+	if (!config.wiegandAdaptive || _bitPeriod == 0) {
+		return WIEGAND_FRAME_GAP;
+	}
+	unsigned long gap = _bitPeriod * WIEGAND_GAP_PERIODS;
+	return constrain(gap, config.wiegandMinTime * 2, (unsigned long)WIEGAND_FRAME_GAP);
+}
+
+void TCMWiegandClass::configure(const JsonDocument& json) {
+	if (json.containsKey("mintime")) {
+		unsigned long minTime = json["mintime"];
+		config.wiegandMinTime = constrain(minTime, 0UL, (unsigned long)WIEGAND_MAX_MIN_TIME);
+	}
+	if (json.containsKey("diagnostics")) {
+		bool enabled = json["diagnostics"];
+		if (enabled && !diagnostics.enabled) {
+			diagnostics.clear();
+		}
+		diagnostics.enabled = enabled;
+	}
+	if (json["clear"] | false) {
+		diagnostics.clear();
+	}
+}
+
+void TCMWiegandClass::report(JsonDocument& root) {
+	root["reader"] = _id;
+	root["mintime"] = config.wiegandMinTime;
+	root["diagnostics"] = diagnostics.enabled;
+	root["bucket_us"] = WIEGAND_DIAG_BUCKET_WIDTH;
+	root["seconds"] = (millis() - diagnostics.since) / 1000;
+	root["edges"] = stats.edges;
+	root["glitches"] = stats.glitches;
+	root["bit_period_us"] = bitPeriod();
+	root["min_interval_us"] = diagnostics.minInterval;
+	root["max_glitch_us"] = diagnostics.maxGlitch;
+
+	JsonArray lineEdges = root.createNestedArray("line_edges");
+	JsonArray lineGlitches = root.createNestedArray("line_glitches");
+	for (uint8_t line = 0; line < 2; line++) {
+		lineEdges.add(diagnostics.lineEdges[line]);
+		lineGlitches.add(diagnostics.lineGlitches[line]);
+	}
+
+	JsonArray intervals = root.createNestedArray("intervals");
+	JsonArray glitches = root.createNestedArray("glitch_intervals");
+	for (uint8_t i = 0; i < WIEGAND_DIAG_BUCKETS; i++) {
+		intervals.add(diagnostics.intervals[i]);
+		glitches.add(diagnostics.glitches[i]);
+	}
+}
+
+void WiegandDiagnostics::clear() {
+	since = millis();
+	memset(intervals, 0, sizeof(intervals));
+	memset(glitches, 0, sizeof(glitches));
+	lineEdges[0] = lineEdges[1] = 0;
+	lineGlitches[0] = lineGlitches[1] = 0;
+	minInterval = 0;
+	maxGlitch = 0;
+}
+
+void WiegandDiagnostics::addInterval(uint8_t line, unsigned long interval) {
+	uint16_t& count = intervals[bucket(interval)];
+	if (count < UINT16_MAX) {
+		++count;
+	}
+	if (minInterval == 0 || interval < minInterval) {
+		minInterval = interval;
+	}
+	addEdge(line);
+}
+
+void WiegandDiagnostics::addGlitch(uint8_t line, unsigned long interval) {
+	uint16_t& count = glitches[bucket(interval)];
+	if (count < UINT16_MAX) {
+		++count;
+	}
+	if (interval > maxGlitch) {
+		maxGlitch = interval;
+	}
+	++lineGlitches[line];
+}
+
+typedef WiegandResult (*WiegandDecodeFunction)(const WiegandFrame& frame, WiegandRead& read);
+
+struct WiegandRegistryEntry {
+	uint8_t bits;
+	WiegandDecodeFunction decode;
+};
+
+/**
+ * @brief Supported formats, one per frame length.
+ */
+static const WiegandRegistryEntry wiegandFormats[] = {
+	{ WiegandKeypad4::bits, WiegandDecoder<WiegandKeypad4>::decode },
+	{ WiegandKeypad8::bits, WiegandDecoder<WiegandKeypad8>::decode },
+	{ WiegandH10301::bits, WiegandDecoder<WiegandH10301>::decode },
+	{ WiegandH10306::bits, WiegandDecoder<WiegandH10306>::decode },
+	{ WiegandCorporate35::bits, WiegandDecoder<WiegandCorporate35>::decode },
+	{ WiegandH10304::bits, WiegandDecoder<WiegandH10304>::decode },
+	{ WiegandCorporate48::bits, WiegandDecoder<WiegandCorporate48>::decode }
+};
+
+WiegandResult TCMWiegandClass::decode(const WiegandFrame& frame, WiegandRead& read) {
+	for (const WiegandRegistryEntry& format : wiegandFormats) {
+		if (format.bits == frame.size()) {
+			return format.decode(frame, read);
 		}
-		lastEdge_u =  nowMicros;
-		lastLoop_m = nowMillis;
-		idle = false;
 	}
+	return frame_unknown;
 }
 
 /**
- * @brief Handles falling-edge interrupts on the D0 pin and filters out
- * false interrupts based on WIEGAND_MIN_TIME in microseconds. See handleD0()
- * for more information.
+ * @brief Decodes and dispatches the current frame. An early frame (one
+ * that reached the learned length) is only ended if it decodes, otherwise
+ * it is left to end by the gap.
+ *
+ * @return true if the frame was ended
  */
-ICACHE_RAM_ATTR void TCMWiegandClass::handleD1() {
-	unsigned long nowMicros = micros();
-	unsigned long nowMillis = millis();
-	if (idle || nowMicros - lastEdge_u > WIEGAND_MIN_TIME) {
-		if (reader != NULL) {
-			// ISR_Data1 does not do bounds checking
-			if (reader->bitCount >= MAX_READ_BITS) {
-				DEBUG_SERIAL.println("[ WARN ] Read max bit count exceeded.");
-				reader->bitCount = MAX_READ_BITS - 1;
-			}
-			reader->ISR_Data1();
+bool TCMWiegandClass::completeFrame(bool early) {
+	WiegandRead read = WiegandRead();
+
+	unsigned long start = micros();
+	WiegandResult result = decode(frame, read);
+	unsigned long elapsed = micros() - start;
+
+	if (early && result != frame_decoded) {
+		return false;
+	}
+	frameLatency.add(start + elapsed - lastEdge_u);
+	if (early) {
+		++stats.earlyFrames;
+		endedEarly = true;
+	} else {
+		++stats.gapFrames;
+		if (result == frame_decoded) {
+			learn(read);
+		}
+	}
+
+	++stats.frames;
+	stats.lastDecodeMicros = elapsed;
+	stats.totalDecodeMicros += elapsed;
+	if (elapsed > stats.maxDecodeMicros) {
+		stats.maxDecodeMicros = elapsed;
+	}
+
+	switch (result) {
+	case frame_decoded:
+		if (read.keypress) {
+			++stats.keypresses;
 		}
-		lastEdge_u = nowMicros;
-		lastLoop_m = nowMillis;
-		idle = false;
+		handleRead(read);
+		break;
+	case frame_parity_error:
+		++stats.parityErrors;
+		DEBUG_SERIAL.printf("[ WARN ] Parity error in %u bit Wiegand frame\n", frame.size());
+		break;
+	default:
+		++stats.undecoded;
+		DEBUG_SERIAL.printf("[ WARN ] Unable to decode %u bit Wiegand frame\n", frame.size());
+		break;
+	}
+	frame.clear();
+	return true;
+}
+
+/**
+ * @brief Counts decoded gap-ended frames of the same length; key presses
+ * are skipped so that a keypad does not disturb the card length.
+ */
+void TCMWiegandClass::learn(const WiegandRead& read) {
+	if (read.keypress) {
+		return;
+	}
+	if (frame.size() != candidateBits) {
+		candidateBits = frame.size();
+		candidateFrames = 0;
+		_learnedBits = 0;
+	}
+	if (candidateFrames < WIEGAND_LEARN_FRAMES) {
+		++candidateFrames;
+	}
+	if (candidateFrames >= WIEGAND_LEARN_FRAMES) {
+		_learnedBits = candidateBits;
 	}
 }
 
 
 /**
- * @brief Call-back used by HidProxWiegand in its loop().
- * This is used to update the state of AccessControl to handle
- * lookups and responses.
+ * @brief Called by completeFrame() for every decoded frame. Cards are
+ * queued for AccessControlClass::loop(), which decides them once any
+ * earlier reads from the same reader are decided.
  * 
- * @param reader 
+ * @param read a frame that passed its format's parity checks
  */
-void readHandler(ProxReaderInfo* reader) {
-	DEBUG_SERIAL.printf("[ INFO ] %lu - ", micros());
+void TCMWiegandClass::handleRead(const WiegandRead& read) {
+	if (read.keypress) {
+		// PIN entry is not implemented yet (see ControlState::check_pin)
+		DEBUG_SERIAL.printf("[ INFO ] Key pressed: %u\n", (unsigned int)read.cardCode);
+		return;
+	}
+
+	DEBUG_SERIAL.printf("[ INFO ] %lu - reader %u - ", micros(), _id);
 	DEBUG_SERIAL.print(F("Fob read: "));
-	DEBUG_SERIAL.print(reader->facilityCode);
+	DEBUG_SERIAL.print(read.facilityCode);
 	DEBUG_SERIAL.print(F(":"));
-	DEBUG_SERIAL.print(reader->cardCode);
+	DEBUG_SERIAL.print(read.cardCode);
 	DEBUG_SERIAL.print(F(" ("));
-	DEBUG_SERIAL.print(reader->bitCount);
+	DEBUG_SERIAL.print(read.bits);
 	DEBUG_SERIAL.println(F(")"));
 
-	// AccessControl state machine must be in wait_read state to avoid race conditions
-	if (AccessControl.state == ControlState::wait_read) {
-		if (reader->facilityCode == 0) {
-			DEBUG_SERIAL.println(F("[ INFO ] Bad read: facility code was zero"));
-			return;
-		}
-		unsigned long code = reader->facilityCode << 16 | reader->cardCode;
-		
-		String uid = String(code, DEC);
-		// String type = String(reader->bitCount, DEC);
-
-		DEBUG_SERIAL.print(F("[ INFO ] UID: "));
-		DEBUG_SERIAL.println(uid);
-
-		// Setup AccessControl to handle authorization.
-		// The actual authorization is done in AccessControlClass::loop()
-		// via the main loop() thread.
-		AccessControl.uid = uid;
-		AccessControl.state = ControlState::lookup_local;
-	} else {
-		// any other state results in the read being thrown away
-		DEBUG_SERIAL.println(F("[ WARN ] AccessControl received read while still handling last read"));
-	return;
-	}
+	CredentialEvent event = CredentialEvent();
+	event.code = read.code;
+	event.facility = read.facilityCode;
+	event.bits = read.bits;
+	event.micros = lastEdge_u;
+	submit(event);
 }
 
-void TCMWiegandClass::begin(int pinD0, int pinD1) {
+void TCMWiegandClass::begin(uint8_t id, int pinD0, int pinD1) {
+	static_assert(WIEGAND_MAX_READERS == 2, "add the handlers of the new readers below");
+	static void (* const handlersD0[WIEGAND_MAX_READERS])() = { handleD0<0>, handleD0<1> };
+	static void (* const handlersD1[WIEGAND_MAX_READERS])() = { handleD1<0>, handleD1<1> };
+
+	if (id >= WIEGAND_MAX_READERS) {
+		return;
+	}
+	_id = id;
+	_active = true;
 	lastEdge_u = micros();
-	lastLoop_m = millis();
+	lastEdge_m = millis();
 	idle = true;
 	// coolDownTimer = 0;
-	reader = HidProxWiegand.addReader(pinD0, pinD1, readHandler);
-	reader->bitCount = 0;
-	reader->facilityCode = 0;
-	reader->cardCode = 0;
-	for (auto i = 0; i < MAX_READ_BITS; i++) {
-		reader->databits[i] = 0;
-	}
-
-	// memset(reader->databits, 0, MAX_READ_BITS);
-	HidProxWiegand_AttachReaderInterrupts(pinD0, pinD1, this->handleD0, this->handleD1);
+	frame.clear();
+	endedEarly = false;
+	_bitPeriod = 0;
+	_learnedBits = 0;
+	candidateFrames = 0;
+
+	pinMode(pinD0, INPUT);
+	pinMode(pinD1, INPUT);
+	attachInterrupt(digitalPinToInterrupt(pinD0), handlersD0[id], FALLING);
+	attachInterrupt(digitalPinToInterrupt(pinD1), handlersD1[id], FALLING);
 }
 
 // ProxReaderInfo* TCMWiegandClass::addReader(short pinD0, short pinD1) {
@@ -131,32 +349,241 @@ void TCMWiegandClass::begin(int pinD0, int pinD1) {
 // }
 
 void TCMWiegandClass::loop() {
-	/* lastEdge_u is reset in the D0/D1 interrupt handlers -- if we sit
+	uint16_t depth = edges.size();
+	if (depth > stats.maxDepth) {
+		stats.maxDepth = depth;
+	}
+	uint32_t edge;
+	while (edges.pop(edge)) {
+		processEdge(edge);
+	}
+
+	/* lastEdge_u is set from the last accepted edge -- if we sit
 		idle for a long time, then we might overflow and miss the first bit
 		of a read.
 	*/
-	if (!idle && ((micros() - lastEdge_u > WIEGAND_MIN_TIME * 10) || (millis() - lastLoop_m > WIEGAND_WAIT_TIME))) {
+	if (!idle && ((micros() - lastEdge_u > frameGap()) || (millis() - lastEdge_m > WIEGAND_IDLE_TIME))) {
 		idle = true;
-		// wiegandCount counts loops
-		// HidProxWiegand->getCurrentReader()->wiegandCounter = 1;
 	}
-	HidProxWiegand.loop();
+
+	if (frame.size() > 0 && micros() - lastEdge_u > frameGap()) {
+		completeFrame(false);
+	}
 }
 
 // #define WIEGAND_ENT 0xD
 // #define WIEGAND_ESC 0x1B
 
-// StaticJsonDocument<512> AccessControlClass::jsonRecord;
+static_assert(LOOKUP_PENDING >= ACCESS_SESSIONS, "every session needs its own remote lookup");
 
 AccessControlClass::AccessControlClass()
 : lookupLocal(nullptr)
 , lookupRemote(nullptr)
-, accessDenied(nullptr)
-, accessGranted(nullptr)
 {
-	coolDownStart = 0;
-	lastMilli = millis();
-	state = wait_read;
+}
+
+bool AccessControlClass::enqueue(const CredentialEvent& event) {
+	if (coolDowns.holding(event.code, millis(), holdTime())) {
+		++queueStats.duplicates;
+		return false;
+	}
+	for (uint8_t i = 0; i < pendingCount; i++) {
+		if (pending[i].code == event.code) {
+			++queueStats.duplicates;
+			return false;
+		}
+	}
+
+	if (pendingCount >= READ_QUEUE_SIZE) {
+		++queueStats.dropped;
+		return false;
+	}
+	CredentialEvent& item = pending[pendingCount++];
+	item = event;
+	item.queuedMicros = micros();
+	++queueStats.queued;
+	if (pendingCount > queueStats.maxDepth) {
+		queueStats.maxDepth = pendingCount;
+	}
+	return true;
+}
+
+unsigned long AccessControlClass::holdTime() {
+	return max(config.coolDownTime, config.duplicateReadTime);
+}
+
+/**
+ * @brief Each person badges until let in, waiting retryMillis between
+ * tries, badges once more repeatMillis after being let in, and is through
+ * the door walkMillis after it opened. Only then does the next person
+ * badge, so the door itself allows one person per walkMillis.
+ */
+void AccessControlClass::simulateQueue(const QueueSimulation& sim, QueueSimulationResult& result) {
+	CoolDownTable<COOL_DOWN_SLOTS> table;
+	const unsigned long hold = holdTime();
+
+	for (uint8_t perCredential = 0; perCredential < 2; perCredential++) {
+		table.clear();
+		unsigned long t = 0;
+		unsigned long lastDecision = 0;
+		bool decided = false;
+		unsigned long blocked = 0;
+
+		for (uint16_t person = 0; person < sim.people; person++) {
+			const uint64_t fob = 1000 + person;
+			unsigned long repeat = 0;
+			for (uint8_t badge = 0; badge < 2; badge++) {
+				unsigned long at = badge ? repeat : t;
+				bool accepted;
+				for (;;) {
+					if (perCredential) {
+						accepted = !table.holding(fob, at, hold);
+					} else {
+						accepted = !decided || at - lastDecision >= config.coolDownTime;
+					}
+					// the repeated badge is not tried again
+					if (accepted || badge) {
+						break;
+					}
+					++blocked;
+					at += sim.retryMillis;
+				}
+				if (!accepted) {
+					++blocked;
+					continue;
+				}
+				if (perCredential) {
+					table.add(fob, at, hold);
+				}
+				lastDecision = at + sim.decideMillis;
+				decided = true;
+				if (!badge) {
+					t = lastDecision;
+					repeat = t + sim.repeatMillis;
+				}
+			}
+			t += sim.walkMillis;
+		}
+
+		if (perCredential) {
+			result.perCredentialMillis = t;
+			result.perCredentialBlocked = blocked;
+		} else {
+			result.globalMillis = t;
+			result.globalBlocked = blocked;
+		}
+	}
+}
+
+/**
+ * @brief Starts the decision of the oldest queued read whose reader has no
+ * busy session, on a free session.
+ *
+ * @return false if no read could be started
+ */
+bool AccessControlClass::dequeue() {
+	AccessSession* free = nullptr;
+	for (uint8_t i = 0; i < ACCESS_SESSIONS && !free; i++) {
+		if (sessions[i].idle()) {
+			free = &sessions[i];
+		}
+	}
+	if (!free) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < pendingCount; i++) {
+		bool readerBusy = false;
+		for (uint8_t j = 0; j < ACCESS_SESSIONS; j++) {
+			if (!sessions[j].idle() && sessions[j].scan.reader == pending[i].reader) {
+				readerBusy = true;
+			}
+		}
+		if (readerBusy) {
+			continue;
+		}
+
+		CredentialEvent item = pending[i];
+		memmove(&pending[i], &pending[i + 1], (pendingCount - i - 1) * sizeof(CredentialEvent));
+		--pendingCount;
+		if (i > 0) {
+			// the reads before it are waiting for their readers
+			++queueStats.overtakes;
+		}
+		start(*free, item);
+		return true;
+	}
+	return false;
+}
+
+void AccessControlClass::start(AccessSession& session, const CredentialEvent& item) {
+	session.dequeuedMicros = micros();
+	queueWait.add(session.dequeuedMicros - item.queuedMicros);
+	session.scan = item;
+	session.scanMicros = item.micros;
+	session.request = 0;
+
+	coolDowns.add(item.code, millis(), holdTime());
+
+	session.state = ControlState::lookup_local;
+
+	DEBUG_SERIAL.printf("[ INFO ] Credential key: %llu\n", (unsigned long long) item.code);
+}
+
+void AccessControlClass::reportButton(const CredentialEvent& event) {
+	// a session of its own, so no scan being decided is disturbed
+	AccessSession session;
+	session.scan = event;
+	session.dequeuedMicros = micros();
+	session.state = ControlState::cool_down;
+	memset(&session.currentUser, 0, sizeof(session.currentUser));
+	session.currentUser.username[0] = ' ';
+	handleResult(session, AccessResult::granted);
+}
+
+void AccessControlClass::invalidate(const char* credential) {
+	CredentialKey key;
+	if (credentialFromText(credential, key)) {
+		cache.invalidate(key);
+	}
+}
+
+uint8_t AccessControlClass::busySessions() const {
+	uint8_t busy = 0;
+	for (uint8_t i = 0; i < ACCESS_SESSIONS; i++) {
+		if (!sessions[i].idle()) {
+			++busy;
+		}
+	}
+	return busy;
+}
+
+bool AccessControlClass::completeRemote(uint32_t request, CredentialKey key, const JsonDocument* record) {
+	for (uint8_t i = 0; i < ACCESS_SESSIONS; i++) {
+		AccessSession& session = sessions[i];
+		if (session.state != ControlState::wait_remote || session.scan.code != key
+		    || (request != 0 && request != session.request)) {
+			continue;
+		}
+
+		if (record) {
+			CredentialIndexClass::entryFromJson(key, *record, session.currentUser);
+			session.result = checkUserRecord(session.currentUser);
+		} else {
+			// the server answered that it does not know the credential
+			memset(&session.currentUser, 0, sizeof(session.currentUser));
+			session.currentUser.key = key;
+			session.result = AccessResult::unrecognized;
+		}
+		if (request == 0) {
+			// a pushed record answered the scan before the lookup reply
+			RemoteLookup.release(session.request);
+		}
+		// set next state asynchronously to stop the timeout
+		session.state = ControlState::process_record_remote;
+		return true;
+	}
+	return false;
 }
 
 /* loop() should be called by the main thread loop
@@ -164,94 +591,109 @@ AccessControlClass::AccessControlClass()
  * in the local file system and making choice whether to fire the granted
  * or denied call back.
  * If the record does not exist or if the record results in a denial other than
- * banned, then the state machine will delay for a short period (LOOKUP_DELAY) 
- * to see if a MQTT message arrives that changes the decision.
+ * banned, then the state machine will delay for a short period (RemoteLookup.timeout(),
+ * at most config.lookupMaxTime) to see if a MQTT message arrives that changes the decision.
  * The process is broken up across multiple states in case any of these
  * steps (flash access, JSON deserialization, remote lookup, etc.) take a long time and
  * would cause other threads to block.
+ * Each scan is decided in its own AccessSession, so while one waits for the
+ * server the scans of other readers are decided as usual.
  * */
 void AccessControlClass::loop()  {
+	for (uint8_t i = 0; i < ACCESS_SESSIONS; i++) {
+		if (!sessions[i].idle()) {
+			step(sessions[i]);
+		}
+	}
+
+	// A scan is queued by a CredentialSource and taken off the queue
+	// here, which sets the state of a free session to lookup_local
+	while (dequeue()) {
+	}
+
+	uint8_t busy = busySessions();
+	if (busy > queueStats.maxBusy) {
+		queueStats.maxBusy = busy;
+	}
+}
+
+void AccessControlClass::step(AccessSession& session) {
 	ControlState nextState = wait_read;
-	static AccessResult result = AccessResult::unrecognized;
-	// Default state is wait_read.
-	// A Wiegand scan will result in the `state` being updated to
-	// lookup_local by readHandler()
 
-	switch (state) {
+	switch (session.state) {
 	case ControlState::lookup_local:
-		if (uid.isEmpty()) {
-			DEBUG_SERIAL.println(F("[ WARN ] state(lookup_local): uid was empty"));
-			state = ControlState::wait_read;
+		if (CredentialIndexEntry* cached = cache.get(session.scan.code)) {
+			// warm scan: no flash access or JSON parsing
+			session.currentUser = *cached;
+			session.state = ControlState::process_record_local;
 			return;
-		} 
-		jsonRecord.clear();
+		}
 
-		if (lookupUID_local()) {
+		if (lookupUID_local(session)) {
 			// local record does not exist
-			lastMilli = millis();
-			result = AccessResult::unrecognized;
+			session.lastMilli = millis();
+			session.result = AccessResult::unrecognized;
+			memset(&session.currentUser, 0, sizeof(session.currentUser));
+			session.currentUser.key = session.scan.code;
 
 			if (this->lookupRemote) {
 				// setup remote lookup, if available
-				state = ControlState::wait_remote;
-				this->lookupRemote(uid);
-				// handleResult(result);
+				session.state = ControlState::wait_remote;
+				session.request = this->lookupRemote(session.scan.code);
 			} else {
 				// if remote lookup is not setup, then handle the denial now
-				state = ControlState::cool_down;
-				// handleResult(result);
+				session.state = ControlState::cool_down;
 			}
 		} else {
-			state = ControlState::process_record_local;
+			cache.put(session.scan.code, session.currentUser);
+			session.state = ControlState::process_record_local;
 			// do not call handleResult() in this case
 			return;
 		}
-		// state = nextState;
-		handleResult(result);
+		handleResult(session, session.result);
 		break;
 	case ControlState::wait_remote:
-		// remote lookup should set state to process_record_remote
-		if (millis() - lastMilli > LOOKUP_DELAY) {
+		// completeRemote() sets the state to process_record_remote
+		if (millis() - session.lastMilli > RemoteLookup.timeout()) {
 			// if record is received asynchronously at this point then
-			// timeout will still occur
-			state = ControlState::timeout_remote;
+			// timeout will still occur; the reply no longer holds a slot
+			RemoteLookup.release(session.request);
+			session.request = 0;
+			session.state = ControlState::timeout_remote;
 		}
 		break;
 	case ControlState::timeout_remote:
-		handleResult(result);
-		state = ControlState::cool_down;
+		handleResult(session, session.result);
+		session.state = ControlState::cool_down;
 		break;
 	case ControlState::process_record_local:
-		result = this->checkUserRecord();
-		lastMilli = millis();
+		session.result = checkUserRecord(session.currentUser);
+		session.lastMilli = millis();
 
-		if (result != granted && result != banned) {
+		if (session.result != granted && session.result != banned) {
 			// local look up did not result in granted or banned
 			if (this->lookupRemote) {
 				nextState = ControlState::wait_remote;
-				this->lookupRemote(uid);
+				session.request = this->lookupRemote(session.scan.code);
 			} else {
 				nextState = ControlState::cool_down;
 			}
 		} else {
 			nextState = ControlState::cool_down;
 		}
-		state = nextState;
-		handleResult(result);
+		session.state = nextState;
+		handleResult(session, session.result);
 		break;
 	case ControlState::process_record_remote:
-		// we get here if the remote lookup successfully retrieved a JSON record
-		lastMilli = millis();
-		// result is static
-		result = this->checkUserRecord();
-		handleResult(result);
-		state = ControlState::cool_down;
-		DEBUG_SERIAL.printf("json size before cool down: %u\n", jsonRecord.memoryUsage());
+		// we get here once completeRemote() has decided on the server's record
+		session.lastMilli = millis();
+		handleResult(session, session.result);
+		session.state = ControlState::cool_down;
 		break;
 	case ControlState::cool_down:
-		if (millis() - lastMilli > 1500) {
-			state = ControlState::wait_read;
-		}
+		// the decided credential cools down in coolDowns; the session
+		// may take the next scan right away
+		session.state = ControlState::wait_read;
 		break;
 	case ControlState::wait_read:
 	default:
@@ -259,24 +701,35 @@ void AccessControlClass::loop()  {
 	}
 }
 
-int AccessControlClass::lookupUID_local() {
-	File f = SPIFFS.open("/P/" + uid, "r");
+int AccessControlClass::lookupUID_local(AccessSession& session) {
+	char credential[CREDENTIAL_TEXT_LEN];
+	credentialToText(session.scan.code, credential);
+
+	// a definite miss in the enrolled filter goes straight to remote lookup
+	if (!EnrolledFilter.mayContain(credential)) {
+		return 1;
+	}
 
-	if (f) {		// user exists
-		// size_t size = f.size();
-		// std::unique_ptr<char[]> buf(new char[size]);
-		f.readBytes(buf, 384);
-		f.close();
-		auto error = deserializeJson(jsonRecord, buf);
-		DEBUG_SERIAL.printf("json size: %u\n", jsonRecord.memoryUsage());
-		if (error) {
-			// state = ControlState::wait_read;
-			jsonRecord.clear();
-			DEBUG_SERIAL.println(F("[ WARN ] Failed to parse User Data"));
-			// file error, then try remote lookup
-			return 2;
+	if (this->lookupLocal) {
+		int found = this->lookupLocal(session.scan.code, session.currentUser);
+		if (found >= 0) {
+			if (found == 1 && EnrolledFilter.ready()) {
+				++EnrolledFilter.stats.falsePositives;
+			}
+			return found;
 		}
+	}
+
+	// only credentials the index cannot answer for get here
+	UserRecord user;
+	int found = Credentials.get(String(credential), user);
+	String legacy;
+	if (found == 1 && credentialLegacyName(credential, legacy)) {
+		found = Credentials.get(legacy, user);
+	}
 
+	if (found == 0) {		// user exists
+		CredentialIndexClass::entryFromUser(session.scan.code, user, session.currentUser);
 		// Original code has pincode support--may want to re-add that here...
 		// if (config.pinCodeRequested) {
 		// 	if(this->setupReadPinCode) {
@@ -285,25 +738,33 @@ int AccessControlClass::lookupUID_local() {
 		// 	}
 		// }
 
-		// record found and deserialized
+		// record found and decoded
 		return 0;
+	} else if (found == 2) {
+		// state = ControlState::wait_read;
+		DEBUG_SERIAL.println(F("[ WARN ] Failed to parse User Data"));
+		// record error, then try remote lookup
+		return 2;
 	} else {
-		// No file found, then try remote lookup.
+		// No record found, then try remote lookup.
+		if (EnrolledFilter.ready()) {
+			++EnrolledFilter.stats.falsePositives;
+		}
 		return 1;
 	}
 }
 
-/* checkUserRecord() looks at the current jsonRecord and implements
+/* checkUserRecord() looks at the user record and implements
 *  the decision logic.
 */
-AccessResult AccessControlClass::checkUserRecord() {
-	if (jsonRecord.containsKey("is_banned") && (jsonRecord["is_banned"].as<int>() > 0)) {
+AccessResult AccessControlClass::checkUserRecord(const CredentialIndexEntry& user) {
+	if (user.flags & CREDENTIAL_FLAG_BANNED) {
 		return AccessResult::banned;
 	} 
 	
-	if (jsonRecord["validuntil"] < now()) { // missing value => 0 => expired
+	if (user.validuntil < (unsigned long) now()) { // missing value => 0 => expired
 		return AccessResult::expired;
-	} else if (jsonRecord["validsince"] > now()) { // missing value => 0 => granted
+	} else if (user.validsince > (unsigned long) now()) { // missing value => 0 => granted
 		// this would only be used for "future effectivity" -- not sure if useful
 		// if NTP has not set time, then fail granted
 		if (now() < 1600000000) { // Sep 13 2020
@@ -316,76 +777,116 @@ AccessResult AccessControlClass::checkUserRecord() {
 }
 
 /**
- * @brief Uses the result determined from checkUserRecord() and current state
- * to prepare and call the appropriate callback function.
+ * @brief Uses the result determined from checkUserRecord() and the state of
+ * the session to prepare and publish the decision (event_access).
  * 
+ * @param session the session that decided
  * @param result AccessResult
  */
-void AccessControlClass::handleResult(const AccessResult result) {
-	String detail("N/A");
-	String name;
-
-	name = jsonRecord["username"] | "N/A";
+void AccessControlClass::handleResult(AccessSession& session, const AccessResult result) {
+	const CredentialEvent& scan = session.scan;
+	const CredentialIndexEntry& currentUser = session.currentUser;
+	BusEvent bus = BusEvent();
+	bus.type = event_access;
+	ScanEvent& event = bus.scan;
+	event.result = result;
+	event.hasValidity = false;
+	event.validity = 0;
+	event.key = scan.code;
+	event.reader = scan.reader;
+	event.source = scan.source;
+	event.readMicros = scan.micros;
+	event.queuedMicros = scan.queuedMicros;
+	event.dequeuedMicros = session.dequeuedMicros;
+	event.decidedMicros = micros();
+	memcpy(event.name, currentUser.username, CREDENTIAL_INDEX_NAME_LEN);
+	event.name[CREDENTIAL_INDEX_NAME_LEN] = '\0';
+
+	if (session.scanMicros) {
+		decisionLatency.add(event.decidedMicros - session.scanMicros);
+		session.scanMicros = 0;
+	}
 
 	// looks at result and state to indicate why the result occured.
 	switch (result)
 	{
 	case unrecognized:
-		detail = "unrecognized";
+		event.reason = reason_unrecognized;
 		break;
 	case banned:
-		detail = jsonRecord["is_banned"] | "(zero)";
+		event.reason = reason_banned;
 		break;
 	case expired:
-		// DEBUG_SERIAL.println(jsonRecord["validuntil"].as<String>());
-		detail = "validuntil=";
-		if (jsonRecord.containsKey("validuntil")) {
-			detail += jsonRecord["validuntil"].as<String>();
-		} else {
-			detail += "unset";
-		}
+		event.reason = reason_validuntil;
+		event.hasValidity = currentUser.flags & CREDENTIAL_FLAG_HAS_VALIDUNTIL;
+		event.validity = currentUser.validuntil;
 		break;
 	case not_yet_valid:
 		/* FALL THROUGH */
 	case granted:
-		detail = "validsince=";
-		if (jsonRecord.containsKey("validsince")) {
-			detail += jsonRecord["validsince"].as<String>();
-		} else {
-			detail += "unset";
-		}
+		event.reason = reason_validsince;
+		event.hasValidity = currentUser.flags & CREDENTIAL_FLAG_HAS_VALIDSINCE;
+		event.validity = currentUser.validsince;
 		break;
 	default:
-		detail = "unhandled lookup result";
+		event.reason = reason_unhandled;
 		break;
 	}
 
-	if (state == cool_down) {
-		detail += " (local DB)";
-	} else if (state == wait_remote) {
-		detail += " (waiting remote)";
-	} else if (state == timeout_remote) {
-		detail += " (remote DB timeout)";
+	if (scan.source == source_button) {
+		event.reason = reason_button;
+		event.decidedBy = decided_button;
+	} else if (session.state == cool_down) {
+		event.decidedBy = decided_local;
+	} else if (session.state == wait_remote) {
+		event.decidedBy = decided_waiting_remote;
+	} else if (session.state == timeout_remote) {
+		event.decidedBy = decided_remote_timeout;
 	} else {
-		detail += " (remote DB)";
+		event.decidedBy = decided_remote;
 	}
 
-	if (result == granted) {
-		this->accessGranted(result,
-		                    detail,
-						    this->uid,
-						    name);
-		// return ControlState::wait_read;
-	} else {
-		this->accessDenied(result,
-						   detail,
-						   this->uid,
-						   name);
-		// return ControlState::cool_down;
-	}
+	EventBus.publish(bus);
+}
+
+void scanDetail(const ScanEvent& scan, char* buf, size_t size) {
+	static const char* const where[] = {
+		" (local DB)", " (waiting remote)", " (remote DB timeout)", " (remote DB)", ""
+	};
 
+	switch (scan.reason) {
+	case reason_unrecognized:
+		snprintf(buf, size, "unrecognized%s", where[scan.decidedBy]);
+		break;
+	case reason_banned:
+		snprintf(buf, size, "(zero)%s", where[scan.decidedBy]);
+		break;
+	case reason_validuntil:
+	case reason_validsince:
+		if (scan.hasValidity) {
+			snprintf(buf, size, "%s=%lu%s", scan.reason == reason_validuntil ? "validuntil" : "validsince",
+			         (unsigned long) scan.validity, where[scan.decidedBy]);
+		} else {
+			snprintf(buf, size, "%s=unset%s", scan.reason == reason_validuntil ? "validuntil" : "validsince",
+			         where[scan.decidedBy]);
+		}
+		break;
+	case reason_button:
+		snprintf(buf, size, "N/A");
+		break;
+	default:
+		snprintf(buf, size, "unhandled lookup result%s", where[scan.decidedBy]);
+		break;
+	}
 }
 
+void scanCredential(const ScanEvent& scan, char* buf) {
+	if (scan.source == source_button) {
+		strcpy(buf, "Button");
+	} else {
+		credentialToText(scan.key, buf);
+	}
+}
 
 
 #if 0
@@ -6,11 +6,29 @@
 #include <FS.h>
 #include <ArduinoJson.h>
 #include "magicnumbers.h"
-#include <HidProxWiegand.h>
 #include "config.h"
+#include "bloomfilter.h"
+#include "lrucache.h"
+#include "userrecord.h"
+#include "credentialindex.h"
+#include "remotelookup.h"
+#include "spscring.h"
+#include "cooldowntable.h"
+#include "wiegandformat.h"
+#include "credentialsource.h"
 
-#define WIEGAND_MIN_TIME 2100   // minimum time (us) between D0/D1 edges 
-#define LOOKUP_DELAY 950        // maximum time (ms) to wait for UID lookup response from server
+#define WIEGAND_EDGE_BUFFER 128 // edges buffered between the ISRs and loop(), a power of two
+#define WIEGAND_FRAME_GAP 25000 // time (us) without edges that ends a frame while the bit period is unknown
+#define WIEGAND_GAP_PERIODS 4   // bit periods without edges that end a frame once the bit period is known
+#define WIEGAND_LEARN_FRAMES 3  // frames of the same length before a frame of that length ends on its last bit
+#define WIEGAND_IDLE_TIME 3000  // time (ms) without edges after which the edge filter is reset
+#define WIEGAND_DIAG_BUCKETS 32       // buckets of the edge timing histograms
+#define WIEGAND_DIAG_BUCKET_WIDTH 125 // width (us) of each bucket; the last one also holds longer times
+#define USER_CACHE_SIZE 64      // number of decoded user records kept in RAM
+#define READ_QUEUE_SIZE 8       // reads waiting for a decision
+#define ACCESS_SESSIONS 4       // scans decided at once, each from a different reader
+#define COOL_DOWN_SLOTS 32      // recently decided credentials that are held off, a power of two
+#define SCAN_DETAIL_LEN 48      // longest text of scanDetail(), with its terminator
 
 enum AccessResult {
     unrecognized = 1,
@@ -33,34 +51,239 @@ enum ControlState {
     cool_down
 };
 
+/**
+ * @brief Why a decision was made.
+ */
+enum ScanReason : uint8_t {
+    reason_unrecognized,
+    reason_banned,
+    reason_validuntil,      // expired; validity is validuntil
+    reason_validsince,      // granted or not yet valid; validity is validsince
+    reason_button,
+    reason_unhandled
+};
+
+/**
+ * @brief Where the record behind a decision came from.
+ */
+enum DecisionSource : uint8_t {
+    decided_local,          // local DB, final
+    decided_waiting_remote, // local DB, a remote lookup may still change it
+    decided_remote_timeout,
+    decided_remote,
+    decided_button
+};
+
+/**
+ * @brief A decision, as published on the event bus (event_access). It is
+ * fixed size and holds no text but the name, so making
+ * one costs no allocation; scanDetail() and scanCredential() format it
+ * for the sinks that need text.
+ */
+struct ScanEvent {
+    AccessResult result;
+    ScanReason reason;
+    DecisionSource decidedBy;
+    bool hasValidity;               // validity was set in the record
+    uint32_t validity;
+    CredentialKey key;
+    uint8_t reader;
+    CredentialSourceType source;
+    unsigned long readMicros;       // micros() when read, see CredentialEvent
+    unsigned long queuedMicros;
+    unsigned long dequeuedMicros;   // the decision started
+    unsigned long decidedMicros;
+    char name[CREDENTIAL_INDEX_NAME_LEN + 1]; // empty when unknown
+};
+
+/**
+ * @brief The "detail" text of a decision, e.g. "validsince=1700000000
+ * (local DB)". size should be SCAN_DETAIL_LEN.
+ */
+void scanDetail(const ScanEvent& scan, char* buf, size_t size);
 
-void readHandler(ProxReaderInfo* reader);
+/**
+ * @brief The credential as text, or "Button" for the exit button. buf must
+ * hold CREDENTIAL_TEXT_LEN bytes.
+ */
+void scanCredential(const ScanEvent& scan, char* buf);
 
 
+/**
+ * @brief Edge timing recorded while diagnostics are enabled, so that the
+ * glitch filter (config.wiegandMinTime) can be tuned for a door without a
+ * scope. Only falling edges are seen, so pulse widths are not available;
+ * the time between edges is.
+ */
+struct WiegandDiagnostics {
+    bool enabled = false;
+    unsigned long since = 0;                    // millis() when last cleared
+    uint16_t intervals[WIEGAND_DIAG_BUCKETS];   // accepted bits, by time since the previous bit of the frame
+    uint16_t glitches[WIEGAND_DIAG_BUCKETS];    // rejected edges, by time since the last accepted edge
+    unsigned long lineEdges[2];                 // accepted edges on D0 and D1
+    unsigned long lineGlitches[2];              // rejected edges on D0 and D1
+    unsigned long minInterval;                  // shortest time between two accepted bits
+    unsigned long maxGlitch;                    // longest time before a rejected edge
+
+    WiegandDiagnostics() { clear(); }
+
+    void clear();
+    void addInterval(uint8_t line, unsigned long interval);
+    void addEdge(uint8_t line) { ++lineEdges[line]; }
+    void addGlitch(uint8_t line, unsigned long interval);
+
+    static uint8_t bucket(unsigned long interval) {
+        unsigned long b = interval / WIEGAND_DIAG_BUCKET_WIDTH;
+        return b < WIEGAND_DIAG_BUCKETS ? b : WIEGAND_DIAG_BUCKETS - 1;
+    }
+};
+
 /**
  * @brief A manager class to handle false interrupts on the Wiegand inputs and
  * prevent buffer overflows.
  * 
+ * The D0/D1 interrupt handlers only push the time of the edge and the line
+ * it was on into a lock-free ring. loop() drains the ring, filters glitches
+ * and shifts the remaining edges into a WiegandFrame as bits.
+ *
+ * A frame ends once no edge has arrived for WIEGAND_GAP_PERIODS of the
+ * reader's measured bit period (WIEGAND_FRAME_GAP until it is measured).
+ * After WIEGAND_LEARN_FRAMES frames of the same length, a frame of that
+ * length that decodes with valid parity ends on its last bit instead. If
+ * more bits follow such a frame the length is forgotten again. Both can be
+ * turned off with config.wiegandAdaptive to compare latencies.
+ *
+ * There is one instance per reader in TCMWiegand[], each with its own
+ * ring, interrupt handlers, frame and statistics. Decoded cards are
+ * submitted as CredentialEvents; key presses are only counted.
  */
-class TCMWiegandClass {
+class TCMWiegandClass : public CredentialSource {
     public:
     // TCMWiegandClass();
 
     // ProxReaderInfo* addReader(short pinData0, short pinData1);
 
-    void begin(int pinD0, int pinD1);
+    /**
+     * @brief Attaches the interrupts of reader id, which must be this
+     * instance's index in TCMWiegand[].
+     */
+    void begin(uint8_t id, int pinD0, int pinD1);
 
-    void loop();
+    uint8_t id() const { return _id; }
+    bool active() const override { return _active; }
+    uint8_t reader() const override { return _id; }
+    CredentialSourceType type() const override { return source_wiegand; }
 
+    void loop() override;
+
+    unsigned long edgesDropped() const { return edges.dropped(); }
+
+    /**
+     * @brief Time (us) without edges after which the current frame ends.
+     */
+    unsigned long frameGap() const;
+
+    unsigned long bitPeriod() const { return _bitPeriod; }
+    uint8_t learnedBits() const { return _learnedBits; }
+
+    /**
+     * @brief Applies the optional "mintime" (us), "diagnostics" and "clear"
+     * keys of a set/wiegand message or WebSocket command. The minimum time
+     * is shared by all readers.
+     */
+    void configure(const JsonDocument& json);
+
+    /**
+     * @brief Fills root with the filter settings and diagnostics.
+     */
+    void report(JsonDocument& root);
+
+    WiegandDiagnostics diagnostics;
+
+    /**
+     * @brief Decodes a frame with the format registered for its length.
+     */
+    static WiegandResult decode(const WiegandFrame& frame, WiegandRead& read);
+
+    struct Stats {
+        unsigned long edges = 0;
+        unsigned long glitches = 0;
+        unsigned long overflows = 0;   // bits beyond WIEGAND_MAX_BITS
+        uint16_t maxDepth = 0;         // most edges waiting in the ring at once
+        unsigned long frames = 0;
+        unsigned long undecoded = 0;   // frames of an unknown length
+        unsigned long parityErrors = 0;
+        unsigned long keypresses = 0;
+        unsigned long lastDecodeMicros = 0;
+        unsigned long maxDecodeMicros = 0;
+        unsigned long totalDecodeMicros = 0;
+        unsigned long earlyFrames = 0;     // frames ended on their last bit
+        unsigned long gapFrames = 0;       // frames ended by the gap
+        unsigned long earlyMistakes = 0;   // early frames followed by more bits
+    } stats;
+
+    /**
+     * @brief Time from the last edge of a frame until it is decoded.
+     */
+    LatencyHistogram frameLatency;
 
     private:
-    static ProxReaderInfo* reader;
 
-    static bool idle;
-    static unsigned long lastEdge_u;
-    static unsigned long lastLoop_m;
-    static void handleD0();
-    static void handleD1();
+    /**
+     * @brief micros() at the edge with the lowest bit replaced by the line:
+     * 0 for D0, 1 for D1.
+     */
+    SpscRing<uint32_t, WIEGAND_EDGE_BUFFER> edges;
+
+    uint8_t _id = 0;
+    bool _active = false;
+    WiegandFrame frame;
+    bool idle = true;
+    bool endedEarly = false;
+    unsigned long lastEdge_u = 0;
+    unsigned long lastEdge_m = 0;
+    unsigned long _bitPeriod = 0;
+    uint8_t _learnedBits = 0;
+    uint8_t candidateBits = 0;
+    uint8_t candidateFrames = 0;
+    template <uint8_t Reader> static void handleD0();
+    template <uint8_t Reader> static void handleD1();
+    void processEdge(uint32_t edge);
+    bool completeFrame(bool early);
+    void handleRead(const WiegandRead& read);
+    void learn(const WiegandRead& read);
+};
+
+/**
+ * @brief The decision of one scan, from being taken off the queue until it
+ * cools down. Each session has its own state, record, timer and remote
+ * lookup, so a scan waiting for the server only holds up its own reader.
+ */
+struct AccessSession {
+    ControlState state = wait_read;
+
+    /**
+     * @brief The scan being decided: its credential key, reader and source.
+     */
+    CredentialEvent scan = CredentialEvent();
+
+    CredentialIndexEntry currentUser;
+    AccessResult result = unrecognized;
+    uint32_t request = 0;           // remote lookup being waited for, see RemoteLookupClass::request()
+    unsigned long lastMilli = 0;    // millis() at the last decision
+
+    /**
+     * @brief micros() at the last edge of the scan, 0 once the first
+     * decision for it has been made.
+     */
+    unsigned long scanMicros = 0;
+
+    /**
+     * @brief micros() when the scan was taken off the queue.
+     */
+    unsigned long dequeuedMicros = 0;
+
+    bool idle() const { return state == wait_read; }
 };
 
 class AccessControlClass {
@@ -72,49 +295,144 @@ class AccessControlClass {
     AccessControlClass();
 
 
-    int (*lookupLocal)(const String uid, const JsonDocument* user);
-    void (*lookupRemote)(String uid);
-    void (*accessDenied)(AccessResult result, String detail, String credential, String name);
-    void (*accessGranted)(AccessResult result, String detail, String credential, String name);
+    /**
+     * @brief Optional local lookup backend. Returns 0 when found (and fills
+     * entry), 1 when not found, 2 on a record error, or -1 to fall back to
+     * the per-user file lookup.
+     */
+    int (*lookupLocal)(CredentialKey key, CredentialIndexEntry& entry);
+
+    /**
+     * @brief Optional remote lookup backend. Returns the request ID the
+     * reply will carry, see completeRemote().
+     */
+    uint32_t (*lookupRemote)(CredentialKey key);
 
 
     // void begin();
 
+    /**
+     * @brief Steps every busy session once, then starts a session for each
+     * queued read whose reader has none.
+     */
     void loop();
 
     // void reset();
 
-    int lookupUID_local();
-    AccessResult checkUserRecord();
-    void handleResult(const AccessResult result);
+    int lookupUID_local(AccessSession& session);
+    static AccessResult checkUserRecord(const CredentialIndexEntry& user);
+    void handleResult(AccessSession& session, const AccessResult result);
 
-    ControlState state;
+    /**
+     * @brief Hands a record received from the server to the session
+     * waiting for it. record is null when the server does not know the
+     * credential. request 0 matches any session waiting for key, for
+     * records pushed with db/add.
+     *
+     * @return false if no session is waiting for it any more
+     */
+    bool completeRemote(uint32_t request, CredentialKey key, const JsonDocument* record);
+
+    AccessSession sessions[ACCESS_SESSIONS];
+
+    uint8_t busySessions() const;
 
-    String uid;
+    /**
+     * @brief Recently decided local records. Entries must be invalidated
+     * whenever the stored record changes, see invalidate().
+     */
+    LruCache<CredentialIndexEntry, USER_CACHE_SIZE> cache;
 
-    struct UserRecord {
-        String credential;
-        String person;
-        unsigned long validsince;
-        unsigned long last_updated;
-        bool is_banned;
-        unsigned long validuntil;
+    /**
+     * @brief Drops the cached record of a credential given as stored.
+     */
+    void invalidate(const char* credential);
+
+    /**
+     * @brief Time from the last edge of a scan to its first decision.
+     */
+    LatencyHistogram decisionLatency;
+
+    /**
+     * @brief Queues a read from a CredentialSource. A card is dropped if
+     * it is already queued or is cooling down: it was taken off the queue
+     * less than holdTime() ago. Other cards are not held up by it. Any
+     * read is dropped if the queue is full.
+     *
+     * Reads are decided in the order they were queued, except that a read
+     * from a reader whose previous scan is still being decided waits
+     * without holding up the reads of other readers.
+     *
+     * @return true if the event was queued
+     */
+    bool enqueue(const CredentialEvent& event);
+
+    /**
+     * @brief Publishes a press of the exit button as a granted
+     * event_access, for reporting only: the button has already opened the
+     * door, and the press never goes through the queue.
+     */
+    void reportButton(const CredentialEvent& event);
+
+    /**
+     * @brief Time (ms) a credential is held off after it was taken off the
+     * queue: the longer of config.coolDownTime and config.duplicateReadTime.
+     */
+    static unsigned long holdTime();
+
+    uint16_t queueDepth() const { return pendingCount; }
+
+    struct QueueStats {
+        unsigned long queued = 0;
+        unsigned long duplicates = 0;
+        unsigned long dropped = 0;      // the queue was full
+        uint16_t maxDepth = 0;
+        uint8_t maxBusy = 0;            // most sessions busy at once
+        unsigned long overtakes = 0;    // reads started ahead of an earlier read whose reader was busy
+    } queueStats;
+
+    /**
+     * @brief Time reads spent in the queue.
+     */
+    LatencyHistogram queueWait;
+
+    CoolDownTable<COOL_DOWN_SLOTS> coolDowns;
+
+    struct QueueSimulation {
+        uint16_t people = 20;
+        unsigned long walkMillis = 800;     // from the door opening until the next person can badge
+        unsigned long retryMillis = 500;    // a person who is not let in badges again after this long
+        unsigned long repeatMillis = 300;   // a person who is let in badges once more after this long
+        unsigned long decideMillis = 10;
+    };
+
+    struct QueueSimulationResult {
+        unsigned long globalMillis;         // everyone through, with one cool down for all readers
+        unsigned long globalBlocked;        // badges ignored
+        unsigned long perCredentialMillis;  // everyone through, with a cool down per credential
+        unsigned long perCredentialBlocked;
     };
 
-    bool newRecord = false;
-	StaticJsonDocument<512> jsonRecord;
-    char buf[384];
-    UserRecord currentUser;
+    /**
+     * @brief Simulates a queue of people at a door, each with their own
+     * fob, under the old cool down after every decision and under the cool
+     * down per credential. Time is simulated, so this returns at once.
+     */
+    static void simulateQueue(const QueueSimulation& sim, QueueSimulationResult& result);
 
     protected:
-    unsigned long lastMilli;
-    unsigned long coolDownStart;
+    CredentialEvent pending[READ_QUEUE_SIZE];
+    uint8_t pendingCount = 0;
+
+    void step(AccessSession& session);
+    bool dequeue();
+    void start(AccessSession& session, const CredentialEvent& item);
 };
 
 // void cardRead1Handler(ProxReaderInfo* reader);
 
 // extern armRemoteLookup(String uid)
-extern TCMWiegandClass TCMWiegand;
+extern TCMWiegandClass TCMWiegand[WIEGAND_MAX_READERS];
 extern AccessControlClass AccessControl;
 
 #endif
\ No newline at end of file
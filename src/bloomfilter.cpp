@@ -0,0 +1,109 @@
+#include "bloomfilter.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+BloomFilter EnrolledFilter;
+
+BloomFilter::BloomFilter()
+: _ready(false)
+{
+	memset(_bits, 0, sizeof(_bits));
+}
+
+/**
+ * @brief 64-bit FNV-1a split into two 32-bit hashes. The k bit positions are
+ * derived as h1 + i * h2 (Kirsch-Mitzenmacher), so only one pass over the key
+ * is needed. Letters are hashed in lower case, so a hexadecimal credential
+ * stored in upper case by an earlier version still matches its scan.
+ */
+void BloomFilter::hash(const char* key, uint32_t& h1, uint32_t& h2) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (const char* c = key; *c; ++c) {
+		uint8_t b = *c >= 'A' && *c <= 'Z' ? *c + ('a' - 'A') : *c;
+		h ^= b;
+		h *= 0x100000001b3ULL;
+	}
+	h1 = (uint32_t) h;
+	h2 = (uint32_t) (h >> 32) | 1;
+}
+
+void BloomFilter::add(const char* key) {
+	if (key == nullptr) {
+		return;
+	}
+
+	uint32_t h1, h2;
+	bool changed = false;
+	hash(key, h1, h2);
+	for (uint8_t i = 0; i < BLOOM_FILTER_HASHES; i++) {
+		uint32_t bit = (h1 + i * h2) % BLOOM_FILTER_BITS;
+		changed |= !(_bits[bit >> 3] & (1 << (bit & 7)));
+		_bits[bit >> 3] |= 1 << (bit & 7);
+	}
+
+	// re-adding an existing credential (e.g. a record update) sets no new bits
+	if (changed) {
+		++stats.entries;
+	}
+}
+
+bool BloomFilter::mayContain(const char* key) {
+	// an unbuilt filter must never turn away an enrolled credential
+	if (!_ready || key == nullptr) {
+		return true;
+	}
+
+	++stats.checks;
+	uint32_t h1, h2;
+	hash(key, h1, h2);
+	for (uint8_t i = 0; i < BLOOM_FILTER_HASHES; i++) {
+		uint32_t bit = (h1 + i * h2) % BLOOM_FILTER_BITS;
+		if (!(_bits[bit >> 3] & (1 << (bit & 7)))) {
+			++stats.negatives;
+			return false;
+		}
+	}
+	return true;
+}
+
+void BloomFilter::invalidate() {
+	++stats.removed;
+}
+
+void BloomFilter::clear() {
+	memset(_bits, 0, sizeof(_bits));
+	stats.entries = 0;
+	stats.removed = 0;
+	_ready = true;
+}
+
+bool BloomFilter::rebuild(CredentialStore& store) {
+	unsigned long start = millis();
+
+	_ready = false;
+	memset(_bits, 0, sizeof(_bits));
+	stats.entries = 0;
+	stats.removed = 0;
+
+	std::unique_ptr<CredentialCursor> cursor = store.iterate();
+	while (cursor->next()) {
+		add(cursor->credential().c_str());
+		yield();
+	}
+
+	_ready = true;
+	DEBUG_SERIAL.printf("[ INFO ] Enrolled filter built: %lu entries in %lu ms\n", stats.entries, millis() - start);
+	return true;
+}
+
+float BloomFilter::fillRatio() const {
+	uint32_t set = 0;
+	for (size_t i = 0; i < sizeof(_bits); i++) {
+		set += __builtin_popcount(_bits[i]);
+	}
+	return (float) set / BLOOM_FILTER_BITS;
+}
+
+float BloomFilter::falsePositiveRate() const {
+	return powf(fillRatio(), BLOOM_FILTER_HASHES);
+}
@@ -0,0 +1,71 @@
+#ifndef bloomfilter_h
+#define bloomfilter_h
+
+#include <Arduino.h>
+#include "credentialstore.h"
+
+#define BLOOM_FILTER_BITS 32768   // 4 KB of RAM
+#define BLOOM_FILTER_HASHES 4
+
+/**
+ * @brief Fixed-size Bloom filter of credential strings, without regard to
+ * case.
+ *
+ * A negative answer from mayContain() is definite, so it can be used to skip
+ * the flash lookup for credentials that are not enrolled. Bits cannot be
+ * cleared for a single credential, so removals only raise the false-positive
+ * rate until the filter is rebuilt.
+ */
+class BloomFilter {
+    public:
+    BloomFilter();
+
+    void add(const char* key);
+    bool mayContain(const char* key);
+
+    /**
+     * @brief Counts a credential removed since the last rebuild. Its bits
+     * cannot be cleared, so it stays a (false) positive until then.
+     */
+    void invalidate();
+
+    void clear();
+
+    /**
+     * @brief Clears the filter and adds every credential in the store.
+     */
+    bool rebuild(CredentialStore& store);
+
+    bool ready() const { return _ready; }
+    size_t sizeBytes() const { return sizeof(_bits); }
+    size_t sizeBits() const { return BLOOM_FILTER_BITS; }
+    uint8_t hashes() const { return BLOOM_FILTER_HASHES; }
+
+    /**
+     * @brief Fraction of bits that are set.
+     */
+    float fillRatio() const;
+
+    /**
+     * @brief Expected false-positive rate for the current fill ratio.
+     */
+    float falsePositiveRate() const;
+
+    struct Stats {
+        unsigned long entries = 0;
+        unsigned long removed = 0;
+        unsigned long checks = 0;
+        unsigned long negatives = 0;
+        unsigned long falsePositives = 0;
+    } stats;
+
+    private:
+    uint8_t _bits[BLOOM_FILTER_BITS / 8];
+    bool _ready;
+
+    static void hash(const char* key, uint32_t& h1, uint32_t& h2);
+};
+
+extern BloomFilter EnrolledFilter;
+
+#endif
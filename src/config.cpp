@@ -1,12 +1,18 @@
 #include "config.h"
+#include "credentialkey.h"
 
 #define DEBUG_SERIAL if(DEBUG)Serial
 
 Config config;
 
+bool credentialHexKeys()
+{
+	return config.wiegandReadHex;
+}
+
 bool ICACHE_FLASH_ATTR loadConfiguration()
 {
-	File configFile = SPIFFS.open("/config.json", "r");
+	File configFile = FILESYSTEM.open("/config.json", "r");
 	if (!configFile)
 	{
 #ifdef DEBUG
@@ -103,15 +109,28 @@ bool ICACHE_FLASH_ATTR loadConfiguration()
 		config.numRelays = 1;
 
 	config.readertype = hardware["readertype"];
+	config.rdm6300 = config.readertype == READER_RDM6300 || config.readertype >= READER_MFRC522_RDM6300;
 	int rfidss;
 	if (config.readertype == READER_WIEGAND || config.readertype == READER_WIEGAND_RDM6300)
 	{
-		int wgd0pin = hardware["wgd0pin"];
-		int wgd1pin = hardware["wgd1pin"];
+		// further readers are in wiegand2, wiegand3, ... like the relays
+		int readers = hardware["numwiegand"] | 1;
+		config.wiegandReaders = constrain(readers, 1, WIEGAND_MAX_READERS);
+		config.wiegandD0Pin[0] = hardware["wgd0pin"] | WIEGAND_D0_PIN;
+		config.wiegandD1Pin[0] = hardware["wgd1pin"] | WIEGAND_D1_PIN;
+		for (int i = 1; i < config.wiegandReaders; i++)
+		{
+			JsonObject reader = hardware["wiegand" + String(i + 1)];
+			config.wiegandD0Pin[i] = reader["wgd0pin"] | 255;
+			config.wiegandD1Pin[i] = reader["wgd1pin"] | 255;
+		}
 		config.pinCodeRequested = hardware["requirepincodeafterrfid"];
 		config.pinCodeOnly = hardware["allowpincodeonly"];
-		config.wiegandReadHex = hardware["useridstoragemode"] == "hexadecimal";
-		// setupWiegandReader(wgd0pin, wgd1pin); // also some other settings like weather to use keypad or not, LED pin, BUZZER pin, Wiegand 26/34 version
+		config.wiegandReadHex = credentialBaseHex(hardware["credentialbase"]);
+		config.wiegandAdaptive = hardware["wiegandadaptive"] | true;
+		// bounded like a mintime set at run time, see TCMWiegandClass::configure()
+		unsigned long minTime = hardware["wgdmintime"] | WIEGAND_MIN_TIME;
+		config.wiegandMinTime = constrain(minTime, 0UL, (unsigned long)WIEGAND_MAX_MIN_TIME);
 	}
 	else if (config.readertype == READER_MFRC522 || config.readertype == READER_MFRC522_RDM6300)
 	{
@@ -125,11 +144,20 @@ bool ICACHE_FLASH_ATTR loadConfiguration()
 	}
 	else if (config.readertype == READER_PN532 || config.readertype == READER_PN532_RDM6300)
 	{
-		rfidss = hardware["sspin"];
-		// setupPN532Reader(rfidss);
+		config.wiegandReaders = 0;
+		config.pn532SsPin = hardware["sspin"] | 255;
+		config.pn532IrqPin = hardware["pn532irqpin"] | 255;
+		config.pn532ResetPin = hardware["pn532rstpin"] | 255;
+		config.pn532AutoPoll = hardware["pn532autopoll"] | true;
+	}
+	else if (config.readertype == READER_RDM6300)
+	{
+		config.wiegandReaders = 0;
 	}
 	config.fallbackMode = network["fallbackmode"] == 1;
 	config.autoRestartIntervalSeconds = general["restart"];
+	config.coolDownTime = general["cooldown"] | COOL_DOWN_DELAY;
+	config.duplicateReadTime = general["duplicatetime"] | DUPLICATE_READ_DELAY;
 	config.wifiTimeout = network["offtime"];
 	const char *bssidmac = network["bssid"];
 	if (strlen(bssidmac) > 0)
@@ -229,6 +257,12 @@ bool ICACHE_FLASH_ATTR loadConfiguration()
 			config.mqttTopic = newTopic;
 		}
 		config.mqttInterval = mqtt["syncrate"];
+		int percentile = mqtt["lookuppercentile"] | LOOKUP_PERCENTILE;
+		config.lookupPercentile = constrain(percentile, 1, 99);
+		config.lookupMaxTime = mqtt["lookupmax"] | LOOKUP_DELAY;
+		config.lookupMinTime = mqtt["lookupmin"] | LOOKUP_MIN_DELAY;
+		if (config.lookupMinTime > config.lookupMaxTime)
+			config.lookupMinTime = config.lookupMaxTime;
 
 		if (mqtt["mqttlog"] == 1)
 			config.mqttEvents = true;
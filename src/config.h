@@ -47,6 +47,18 @@ struct Config {
     char *mqttTopic = NULL;
     bool mqttAutoTopic = false;
     unsigned long mqttInterval = 180; // Add to GUI & json config
+    /**
+     * @brief The wait for a remote lookup is this percentile of recent round-trip
+     * times, clamped to [lookupMinTime, lookupMaxTime] ms.
+     */
+    uint8_t lookupPercentile = LOOKUP_PERCENTILE;
+    unsigned long lookupMinTime = LOOKUP_MIN_DELAY;
+    unsigned long lookupMaxTime = LOOKUP_DELAY;
+    /**
+     * @brief Time (in ms) after a decision before the next read is accepted.
+     */
+    unsigned long coolDownTime = COOL_DOWN_DELAY;
+    unsigned long duplicateReadTime = DUPLICATE_READ_DELAY;
 
     bool networkHidden = false;
     char *ntpServer = NULL;
@@ -57,6 +69,16 @@ struct Config {
     bool pinCodeRequested = true;
     bool pinCodeOnly = false;
     bool wiegandReadHex = true;
+    bool wiegandAdaptive = true;
+    unsigned long wiegandMinTime = WIEGAND_MIN_TIME;
+    int wiegandReaders = 1;
+    uint8_t wiegandD0Pin[WIEGAND_MAX_READERS] = {WIEGAND_D0_PIN};
+    uint8_t wiegandD1Pin[WIEGAND_MAX_READERS] = {WIEGAND_D1_PIN};
+    uint8_t pn532SsPin = 255;
+    uint8_t pn532IrqPin = 255;
+    uint8_t pn532ResetPin = 255;
+    bool pn532AutoPoll = true;
+    bool rdm6300 = false;
     bool present = false;
     int readertype;
     int relayType[MAX_NUM_RELAYS];
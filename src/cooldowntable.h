@@ -0,0 +1,98 @@
+#ifndef cooldowntable_h
+#define cooldowntable_h
+
+#include <Arduino.h>
+
+#define COOL_DOWN_PROBES 4      // slots searched for a credential, from its hash on
+
+/**
+ * @brief Fixed-size table of credentials that were decided recently, so a
+ * credential can be held off for a while without holding off the others.
+ *
+ * Keys are hashed into N slots and looked up in the COOL_DOWN_PROBES slots
+ * that follow. An expired entry is simply reused, so nothing has to be
+ * deleted; when all probed slots are held the one that expires first is
+ * evicted, which only makes that credential decidable a little early.
+ *
+ * @tparam N number of slots, a power of two
+ */
+template <uint16_t N>
+class CoolDownTable {
+    static_assert(N >= COOL_DOWN_PROBES && (N & (N - 1)) == 0, "N must be a power of two");
+
+    public:
+    CoolDownTable() { clear(); }
+
+    /**
+     * @brief Whether key was added less than holdMillis before nowMillis.
+     */
+    bool holding(uint64_t key, unsigned long nowMillis, unsigned long holdMillis) const {
+        uint16_t start = slot(key);
+        for (uint8_t i = 0; i < COOL_DOWN_PROBES; i++) {
+            const Entry& e = _entries[(start + i) & (N - 1)];
+            if (e.used && e.key == key) {
+                return nowMillis - e.millis < holdMillis;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Starts, or restarts, the hold of key at nowMillis.
+     */
+    void add(uint64_t key, unsigned long nowMillis, unsigned long holdMillis) {
+        uint16_t start = slot(key);
+        Entry* free = nullptr;
+        Entry* oldest = nullptr;
+        Entry* victim = nullptr;
+        for (uint8_t i = 0; i < COOL_DOWN_PROBES; i++) {
+            Entry& e = _entries[(start + i) & (N - 1)];
+            if (e.used && e.key == key) {
+                victim = &e;
+                break;
+            }
+            if (!e.used || nowMillis - e.millis >= holdMillis) {
+                if (!free) {
+                    free = &e;
+                }
+            } else if (!oldest || nowMillis - e.millis > nowMillis - oldest->millis) {
+                oldest = &e;
+            }
+        }
+        if (!victim) {
+            victim = free ? free : oldest;
+            if (!free) {
+                ++evictions;
+            }
+        }
+        victim->key = key;
+        victim->millis = nowMillis;
+        victim->used = true;
+    }
+
+    void clear() {
+        for (uint16_t i = 0; i < N; i++) {
+            _entries[i].used = false;
+        }
+    }
+
+    uint16_t capacity() const { return N; }
+
+    unsigned long evictions = 0; // credentials dropped while still held
+
+    private:
+    struct Entry {
+        uint64_t key;
+        unsigned long millis;
+        bool used;
+    };
+
+    Entry _entries[N];
+
+    static uint16_t slot(uint64_t key) {
+        // Fibonacci hashing; consecutive card numbers land far apart
+        return (key * 0x9E3779B97F4A7C15ULL) >> 48 & (N - 1);
+    }
+};
+
+#endif
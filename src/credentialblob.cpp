@@ -0,0 +1,257 @@
+#include "credentialblob.h"
+#include "helpers.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+CredentialBlobClass CredentialBlob;
+
+static uint32_t fmix32(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+CredentialBlobClass::CredentialBlobClass()
+: _fs(nullptr)
+, _path(CREDENTIAL_BLOB_FILE)
+, _displacements(nullptr)
+, _ready(false)
+, _uploadSize(0)
+, _uploadCrc(0)
+, _received(0)
+{
+	memset(&_header, 0, sizeof(_header));
+}
+
+uint32_t CredentialBlobClass::hash(uint64_t key, uint32_t seed) {
+	return fmix32(fmix32((uint32_t) key ^ seed) ^ (uint32_t) (key >> 32));
+}
+
+uint32_t CredentialBlobClass::slot(uint32_t g, uint16_t displacement, uint32_t slots) {
+	// every displacement gives an independent position, so any free slot
+	// can be reached whatever the table size
+	return fmix32(g + displacement * 0x9e3779b9) % slots;
+}
+
+bool CredentialBlobClass::begin(FS& fs, const char* path) {
+	_fs = &fs;
+	_path = path;
+	if (!_fs->exists(_path)) {
+		return false;
+	}
+	return load();
+}
+
+bool CredentialBlobClass::checkHeader(const CredentialBlobHeader& header, uint32_t fileSize) {
+	if (header.magic != CREDENTIAL_BLOB_MAGIC ||
+	    header.version != CREDENTIAL_BLOB_VERSION ||
+	    header.entrySize != sizeof(CredentialIndexEntry) ||
+	    header.entriesOffset % CREDENTIAL_BLOB_ALIGN != 0 ||
+	    header.entriesOffset < sizeof(header) + header.buckets * sizeof(uint16_t) ||
+	    header.records > header.slots ||
+	    (header.slots > 0 && header.buckets == 0)) {
+		return false;
+	}
+	return header.entriesOffset + header.slots * sizeof(CredentialIndexEntry) == fileSize;
+}
+
+bool CredentialBlobClass::load() {
+	unload();
+
+	// read and write, so revoke() can clear entries in place
+	_file = _fs->open(_path, "r+");
+	if (!_file) {
+		return false;
+	}
+
+	if (_file.read((uint8_t*) &_header, sizeof(_header)) != sizeof(_header) ||
+	    !checkHeader(_header, _file.size())) {
+		DEBUG_SERIAL.println(F("[ WARN ] Credential image invalid, ignoring it"));
+		unload();
+		return false;
+	}
+
+	_displacements = new (std::nothrow) uint16_t[_header.buckets];
+	if (_displacements == nullptr) {
+		DEBUG_SERIAL.printf("[ ERROR ] No memory for %u credential image buckets\n", _header.buckets);
+		unload();
+		return false;
+	}
+
+	size_t len = _header.buckets * sizeof(uint16_t);
+	if (_file.read((uint8_t*) _displacements, len) != len) {
+		unload();
+		return false;
+	}
+
+	_ready = true;
+	DEBUG_SERIAL.printf("[ INFO ] Credential image loaded: %u entries, %u bytes of RAM\n", _header.records, ramBytes());
+	return true;
+}
+
+void CredentialBlobClass::unload() {
+	_ready = false;
+	if (_file) {
+		_file.close();
+	}
+	delete[] _displacements;
+	_displacements = nullptr;
+	memset(&_header, 0, sizeof(_header));
+}
+
+int CredentialBlobClass::find(uint64_t key, CredentialIndexEntry& entry) {
+	if (!_ready) {
+		return -1;
+	}
+	if (_header.records == 0) {
+		return 1;
+	}
+
+	unsigned long start = micros();
+	uint32_t pos;
+	int found = 1;
+	if (locate(key, pos, entry)) {
+		found = 0;
+		++stats.hits;
+	}
+
+	unsigned long elapsed = micros() - start;
+	++stats.lookups;
+	stats.lastMicros = elapsed;
+	stats.totalMicros += elapsed;
+	if (elapsed > stats.maxMicros) {
+		stats.maxMicros = elapsed;
+	}
+	return found;
+}
+
+bool CredentialBlobClass::locate(uint64_t key, uint32_t& pos, CredentialIndexEntry& entry) {
+	uint32_t g = hash(key, _header.seed);
+	pos = slot(g, _displacements[g % _header.buckets], _header.slots);
+	return entryAt(pos, entry) && entry.key == key;
+}
+
+bool CredentialBlobClass::revoke(uint64_t key) {
+	uint32_t pos;
+	CredentialIndexEntry entry;
+	if (!_ready || _header.records == 0 || !locate(key, pos, entry)) {
+		return false;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	entry.key = CREDENTIAL_BLOB_EMPTY_KEY;
+	_file.seek(_header.entriesOffset + pos * sizeof(CredentialIndexEntry), SeekSet);
+	if (_file.write((const uint8_t*) &entry, sizeof(entry)) != sizeof(entry)) {
+		DEBUG_SERIAL.println(F("[ WARN ] Failed to revoke credential in image"));
+		return false;
+	}
+
+	--_header.records;
+	_file.seek(0, SeekSet);
+	_file.write((const uint8_t*) &_header, sizeof(_header));
+	_file.flush();
+	return true;
+}
+
+bool CredentialBlobClass::entryAt(uint32_t slot, CredentialIndexEntry& entry) {
+	if (!_ready || slot >= _header.slots) {
+		return false;
+	}
+	_file.seek(_header.entriesOffset + slot * sizeof(CredentialIndexEntry), SeekSet);
+	return _file.read((uint8_t*) &entry, sizeof(entry)) == sizeof(entry);
+}
+
+void CredentialBlobClass::clear() {
+	unload();
+	abortUpload();
+	if (_fs) {
+		_fs->remove(_path);
+	}
+}
+
+bool CredentialBlobClass::beginUpload(uint32_t size, uint32_t crc) {
+	if (_fs == nullptr || size < sizeof(CredentialBlobHeader)) {
+		return false;
+	}
+
+	FSInfo fsinfo;
+	if (_fs->info(fsinfo) && size > fsinfo.totalBytes - fsinfo.usedBytes) {
+		DEBUG_SERIAL.printf("[ WARN ] Credential image of %u bytes does not fit\n", size);
+		return false;
+	}
+
+	abortUpload();
+	_upload = _fs->open(CREDENTIAL_BLOB_TEMP, "w");
+	if (!_upload) {
+		return false;
+	}
+	_uploadSize = size;
+	_uploadCrc = crc;
+	_received = 0;
+	return true;
+}
+
+bool CredentialBlobClass::writeUpload(uint32_t offset, const uint8_t* data, size_t len) {
+	if (!_upload || offset != _received || _received + len > _uploadSize) {
+		return false;
+	}
+	if (_upload.write(data, len) != len) {
+		abortUpload();
+		return false;
+	}
+	_received += len;
+	return true;
+}
+
+bool CredentialBlobClass::commitUpload() {
+	if (!_upload || _received != _uploadSize) {
+		return false;
+	}
+	_upload.close();
+
+	// verify what is actually on flash, not what was received
+	File f = _fs->open(CREDENTIAL_BLOB_TEMP, "r");
+	CredentialBlobHeader header;
+	bool ok = f && f.read((uint8_t*) &header, sizeof(header)) == sizeof(header) &&
+	          checkHeader(header, f.size());
+
+	uint32_t crc = 0;
+	uint8_t buf[256];
+	while (ok && f.position() < f.size()) {
+		size_t len = f.read(buf, sizeof(buf));
+		if (len == 0) {
+			ok = false;
+			break;
+		}
+		crc = crc32Update(crc, buf, len);
+		yield();
+	}
+	if (f) {
+		f.close();
+	}
+
+	if (!ok || crc != header.crc || crc != _uploadCrc) {
+		DEBUG_SERIAL.println(F("[ WARN ] Credential image failed verification"));
+		_fs->remove(CREDENTIAL_BLOB_TEMP);
+		return false;
+	}
+
+	unload();
+	_fs->remove(_path);
+	if (!_fs->rename(CREDENTIAL_BLOB_TEMP, _path)) {
+		return false;
+	}
+	return load();
+}
+
+void CredentialBlobClass::abortUpload() {
+	if (_upload) {
+		_upload.close();
+		_fs->remove(CREDENTIAL_BLOB_TEMP);
+	}
+	_received = 0;
+	_uploadSize = 0;
+}
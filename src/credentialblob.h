@@ -0,0 +1,144 @@
+#ifndef credentialblob_h
+#define credentialblob_h
+
+#include <Arduino.h>
+#include <FS.h>
+#include "credentialindex.h"
+
+#define CREDENTIAL_BLOB_FILE "/mph.bin"
+#define CREDENTIAL_BLOB_TEMP "/mph.tmp"
+#define CREDENTIAL_BLOB_MAGIC 0x48504D43 // "CMPH"
+#define CREDENTIAL_BLOB_VERSION 1
+#define CREDENTIAL_BLOB_ALIGN 32         // entries never straddle a flash page
+#define CREDENTIAL_BLOB_EMPTY_KEY 0xFFFFFFFFFFFFFFFFULL // above any 19 digit credential
+
+/**
+ * @brief Header of a credential image built by tools/credentialblob.
+ *
+ * Layout: header, `buckets` uint16 displacements, zero padding up to
+ * entriesOffset (a multiple of CREDENTIAL_BLOB_ALIGN), then `slots`
+ * CredentialIndexEntry records, `records` of them in use. Unused slots hold
+ * CREDENTIAL_BLOB_EMPTY_KEY. All fields are little endian. crc is the
+ * CRC-32 of every byte after the header.
+ *
+ * A key is placed by hash-and-displace: with g = hash(key, seed),
+ * bucket = g % buckets and slot = slot(g, displacement[bucket], slots).
+ * The generator picks displacements so that every key gets its own slot.
+ */
+struct __attribute__((packed)) CredentialBlobHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t slots;
+    uint32_t buckets;
+    uint32_t seed;
+    uint32_t entriesOffset;
+    uint32_t crc;
+    uint32_t records;
+};
+
+/**
+ * @brief Read-only credential image with minimal perfect hash lookups.
+ *
+ * Only the displacement table (2 bytes per bucket, about half a byte per
+ * credential) is kept in RAM. A lookup is one hash and one aligned read of
+ * a single entry. The image is replaced as a whole by uploading a new one;
+ * the current image keeps serving until the upload is verified. Deleted
+ * credentials are cleared from their slot in place, see revoke().
+ */
+class CredentialBlobClass {
+    public:
+    CredentialBlobClass();
+
+    /**
+     * @brief Loads the image at path if there is one.
+     */
+    bool begin(FS& fs, const char* path = CREDENTIAL_BLOB_FILE);
+
+    /**
+     * @brief Looks up a key.
+     *
+     * @return 0 if found, 1 if not found, -1 if no image is loaded
+     */
+    int find(uint64_t key, CredentialIndexEntry& entry);
+
+    /**
+     * @brief Clears the slot of key, so a credential deleted with db/delete
+     * is no longer found in the image. The image's CRC only covers it as
+     * uploaded, so it is not checked again after this.
+     *
+     * @return true if key was in the image
+     */
+    bool revoke(uint64_t key);
+
+    /**
+     * @brief Reads the entry in a slot, for walking the whole image. Unused
+     * slots read as CREDENTIAL_BLOB_EMPTY_KEY.
+     */
+    bool entryAt(uint32_t slot, CredentialIndexEntry& entry);
+
+    /**
+     * @brief Unloads and deletes the image.
+     */
+    void clear();
+
+    bool ready() const { return _ready; }
+    uint32_t count() const { return _header.records; }
+    uint32_t slots() const { return _header.slots; }
+    uint32_t size() const { return _ready ? _header.entriesOffset + _header.slots * sizeof(CredentialIndexEntry) : 0; }
+    size_t ramBytes() const { return _ready ? _header.buckets * sizeof(uint16_t) : 0; }
+
+    /**
+     * @brief Starts receiving a new image into a temporary file.
+     */
+    bool beginUpload(uint32_t size, uint32_t crc);
+
+    /**
+     * @brief Appends a chunk. Chunks must arrive in order.
+     */
+    bool writeUpload(uint32_t offset, const uint8_t* data, size_t len);
+
+    /**
+     * @brief Checks size, CRC and header of the received image, then makes
+     * it the active image.
+     */
+    bool commitUpload();
+    void abortUpload();
+
+    bool uploading() const { return (bool) _upload; }
+    uint32_t uploadReceived() const { return _received; }
+    uint32_t uploadSize() const { return _uploadSize; }
+
+    static uint32_t hash(uint64_t key, uint32_t seed);
+    static uint32_t slot(uint32_t g, uint16_t displacement, uint32_t slots);
+
+    struct Stats {
+        unsigned long lookups = 0;
+        unsigned long hits = 0;
+        unsigned long lastMicros = 0;
+        unsigned long maxMicros = 0;
+        unsigned long totalMicros = 0;
+    } stats;
+
+    private:
+    FS* _fs;
+    const char* _path;
+    File _file;
+    CredentialBlobHeader _header;
+    uint16_t* _displacements;
+    bool _ready;
+
+    File _upload;
+    uint32_t _uploadSize;
+    uint32_t _uploadCrc;
+    uint32_t _received;
+
+    bool load();
+    void unload();
+    bool locate(uint64_t key, uint32_t& pos, CredentialIndexEntry& entry);
+    static bool checkHeader(const CredentialBlobHeader& header, uint32_t fileSize);
+};
+
+extern CredentialBlobClass CredentialBlob;
+
+#endif
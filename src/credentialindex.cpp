@@ -0,0 +1,830 @@
+#include "credentialindex.h"
+#include "config.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+#define ENTRY_OFFSET(pos) (sizeof(CredentialIndexHeader) + (pos) * sizeof(CredentialIndexEntry))
+#define READ_CHUNK 8
+
+static CredentialIndexHeader makeHeader(uint32_t count) {
+	CredentialIndexHeader header = CredentialIndexHeader();
+	header.magic = CREDENTIAL_INDEX_MAGIC;
+	header.version = CREDENTIAL_INDEX_VERSION;
+	header.entrySize = sizeof(CredentialIndexEntry);
+	header.count = count;
+	header.hexKeys = config.wiegandReadHex;
+	return header;
+}
+
+CredentialIndexClass CredentialIndex;
+
+CredentialIndexClass::CredentialIndexClass()
+: _fs(nullptr)
+, _store(nullptr)
+, _path(CREDENTIAL_INDEX_FILE)
+, _count(0)
+, _overflow(0)
+, _deleted(0)
+, _merging(false)
+, _ready(false)
+{
+}
+
+bool CredentialIndexClass::begin(FS& fs, CredentialStore& store, const char* path) {
+	_fs = &fs;
+	_store = &store;
+	_path = path;
+
+	if (open()) {
+		DEBUG_SERIAL.printf("[ INFO ] Credential index opened: %u entries\n", _count);
+		return true;
+	}
+
+	DEBUG_SERIAL.println(F("[ WARN ] Credential index missing or invalid, rebuilding"));
+	return rebuild();
+}
+
+/**
+ * @brief Opens the index file and checks the header against the file size.
+ * A mismatch means that a write was interrupted, in which case the caller
+ * should rebuild. So does a merge that was rewriting entries in place, and a
+ * change of config.wiegandReadHex, since the keys were parsed from the file
+ * names in the other base.
+ */
+bool CredentialIndexClass::open() {
+	_ready = false;
+	_count = 0;
+	_overflow = 0;
+	_deleted = 0;
+	_merging = false;
+
+	if (_file) {
+		_file.close();
+	}
+
+	if (!_fs->exists(_path)) {
+		return false;
+	}
+
+	_file = _fs->open(_path, "r+");
+	if (!_file) {
+		return false;
+	}
+
+	CredentialIndexHeader header;
+	if (_file.read((uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		_file.close();
+		return false;
+	}
+
+	if (header.magic != CREDENTIAL_INDEX_MAGIC ||
+	    header.version != CREDENTIAL_INDEX_VERSION ||
+	    header.entrySize != sizeof(CredentialIndexEntry) ||
+	    header.hexKeys != config.wiegandReadHex ||
+	    header.merging ||
+	    header.deleted > header.count + header.overflow ||
+	    _file.size() != ENTRY_OFFSET(header.count + header.overflow)) {
+		_file.close();
+		return false;
+	}
+
+	_count = header.count;
+	_overflow = header.overflow;
+	_deleted = header.deleted;
+	_ready = true;
+	return true;
+}
+
+bool CredentialIndexClass::fail() {
+	_ready = false;
+	return false;
+}
+
+bool CredentialIndexClass::readEntry(uint32_t pos, CredentialIndexEntry& entry) {
+	++stats.reads;
+	if (!_file.seek(ENTRY_OFFSET(pos), SeekSet)) {
+		return false;
+	}
+	return _file.read((uint8_t*) &entry, sizeof(entry)) == sizeof(entry);
+}
+
+bool CredentialIndexClass::writeEntry(uint32_t pos, const CredentialIndexEntry& entry) {
+	if (!_file.seek(ENTRY_OFFSET(pos), SeekSet)) {
+		return false;
+	}
+	return _file.write((const uint8_t*) &entry, sizeof(entry)) == sizeof(entry);
+}
+
+bool CredentialIndexClass::writeHeader() {
+	CredentialIndexHeader header = makeHeader(_count);
+	header.overflow = _overflow;
+	header.deleted = _deleted;
+	header.merging = _merging;
+
+	if (!_file.seek(0, SeekSet) || _file.write((const uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		return fail();
+	}
+	_file.flush();
+	return true;
+}
+
+/**
+ * @brief Binary search for key among the sorted entries from first to last.
+ *
+ * @param pos set to the position of key, or the position key would be inserted at
+ * @param entry set to the matching entry when found
+ * @return true if key exists
+ */
+bool CredentialIndexClass::search(uint64_t key, uint32_t first, uint32_t last, uint32_t& pos, CredentialIndexEntry& entry) {
+	uint32_t lo = first;
+	uint32_t hi = last;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (!readEntry(mid, entry)) {
+			break;
+		}
+		if (entry.key == key) {
+			pos = mid;
+			return true;
+		} else if (entry.key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	pos = lo;
+	return false;
+}
+
+/**
+ * @brief Linear search of the unsorted tail from first on, READ_CHUNK
+ * entries per read.
+ */
+bool CredentialIndexClass::findTail(uint64_t key, uint32_t first, uint32_t& pos, CredentialIndexEntry& entry) {
+	CredentialIndexEntry buf[READ_CHUNK];
+	const uint32_t end = _count + _overflow;
+	for (uint32_t i = first; i < end; ) {
+		uint32_t n = end - i < READ_CHUNK ? end - i : READ_CHUNK;
+		++stats.reads;
+		if (!_file.seek(ENTRY_OFFSET(i), SeekSet) ||
+		    _file.read((uint8_t*) buf, n * sizeof(CredentialIndexEntry)) != n * sizeof(CredentialIndexEntry)) {
+			return false;
+		}
+		for (uint32_t j = 0; j < n; j++) {
+			if (buf[j].key == key) {
+				pos = i + j;
+				entry = buf[j];
+				return true;
+			}
+		}
+		i += n;
+	}
+	return false;
+}
+
+/**
+ * @brief Finds the entry of key, deleted or not, in the sorted entries,
+ * then in each run, largest first, then in the tail.
+ */
+bool CredentialIndexClass::locate(uint64_t key, uint32_t& pos, CredentialIndexEntry& entry) {
+	if (search(key, 0, _count, pos, entry)) {
+		return true;
+	}
+	uint32_t first = _count;
+	const uint32_t runs = _overflow / CREDENTIAL_INDEX_OVERFLOW;
+	for (uint8_t bit = 32; bit-- > 0; ) {
+		if (runs & (1UL << bit)) {
+			uint32_t last = first + ((uint32_t) CREDENTIAL_INDEX_OVERFLOW << bit);
+			if (search(key, first, last, pos, entry)) {
+				return true;
+			}
+			first = last;
+		}
+	}
+	return findTail(key, first, pos, entry);
+}
+
+int CredentialIndexClass::find(uint64_t key, CredentialIndexEntry& entry) {
+	if (!_ready) {
+		return -1;
+	}
+
+	unsigned long start = micros();
+	uint32_t pos;
+	bool found = locate(key, pos, entry) && !(entry.flags & CREDENTIAL_FLAG_DELETED);
+	unsigned long elapsed = micros() - start;
+
+	++stats.lookups;
+	stats.lastMicros = elapsed;
+	stats.totalMicros += elapsed;
+	if (elapsed > stats.maxMicros) {
+		stats.maxMicros = elapsed;
+	}
+
+	if (found) {
+		++stats.hits;
+		return 0;
+	}
+	return 1;
+}
+
+bool CredentialIndexClass::put(const CredentialIndexEntry& entry) {
+	if (!_ready) {
+		return false;
+	}
+
+	CredentialIndexEntry live = entry;
+	live.flags &= ~CREDENTIAL_FLAG_DELETED;
+
+	uint32_t pos;
+	CredentialIndexEntry existing;
+	if (locate(entry.key, pos, existing)) {
+		// same key, same slot: no need to move anything
+		if (!writeEntry(pos, live)) {
+			return fail();
+		}
+		if (existing.flags & CREDENTIAL_FLAG_DELETED) {
+			--_deleted;
+			return writeHeader();
+		}
+		_file.flush();
+		return true;
+	}
+
+	if (!writeEntry(_count + _overflow, live)) {
+		return fail();
+	}
+
+	++_overflow;
+	if (_overflow % CREDENTIAL_INDEX_OVERFLOW == 0) {
+		return compact();
+	}
+	// header is written last, so an interrupted insert is caught by open()
+	return writeHeader();
+}
+
+bool CredentialIndexClass::remove(uint64_t key) {
+	if (!_ready) {
+		return false;
+	}
+
+	uint32_t pos;
+	CredentialIndexEntry existing;
+	if (!locate(key, pos, existing) || (existing.flags & CREDENTIAL_FLAG_DELETED)) {
+		return false;
+	}
+
+	existing.flags |= CREDENTIAL_FLAG_DELETED;
+	if (!writeEntry(pos, existing)) {
+		return fail();
+	}
+	++_deleted;
+	return writeHeader();
+}
+
+bool CredentialIndexClass::put(const char* credential, const JsonDocument& json) {
+	uint64_t key;
+	if (!credentialFromText(credential, key)) {
+		return false;
+	}
+	CredentialIndexEntry entry;
+	entryFromJson(key, json, entry);
+	return put(entry);
+}
+
+bool CredentialIndexClass::remove(const char* credential) {
+	uint64_t key;
+	if (!credentialFromText(credential, key)) {
+		return false;
+	}
+	return remove(key);
+}
+
+bool CredentialIndexClass::clear() {
+	if (_file) {
+		_file.close();
+	}
+	_fs->remove(_path);
+
+	_file = _fs->open(_path, "w+");
+	if (!_file) {
+		return fail();
+	}
+	_count = 0;
+	_overflow = 0;
+	_deleted = 0;
+	_merging = false;
+	bool ok = writeHeader();
+	_file.close();
+
+	return ok && open();
+}
+
+/**
+ * @brief The sorted ranges of the overflow area: one run for each bit set
+ * in runs, largest first, then the tail up to the end of the file.
+ */
+void CredentialIndexClass::runRanges(uint32_t runs, std::vector<Range>& ranges) {
+	uint32_t first = _count;
+	for (uint8_t bit = 32; bit-- > 0; ) {
+		if (runs & (1UL << bit)) {
+			uint32_t last = first + ((uint32_t) CREDENTIAL_INDEX_OVERFLOW << bit);
+			ranges.push_back(Range { first, last, false, CredentialIndexEntry() });
+			first = last;
+		}
+	}
+	if (first < _count + _overflow) {
+		ranges.push_back(Range { first, _count + _overflow, false, CredentialIndexEntry() });
+	}
+}
+
+bool CredentialIndexClass::readRange(Range& range) {
+	range.valid = false;
+	if (range.next >= range.end) {
+		return true;
+	}
+	if (!_file.seek(ENTRY_OFFSET(range.next), SeekSet) ||
+	    _file.read((uint8_t*) &range.head, sizeof(range.head)) != sizeof(range.head)) {
+		return false;
+	}
+	++range.next;
+	range.valid = true;
+	return true;
+}
+
+/**
+ * @brief Streams sorted ranges of the index into out in key order. Keys are
+ * unique across the ranges, since put() overwrites an existing key in place.
+ */
+bool CredentialIndexClass::mergeRanges(std::vector<Range>& ranges, File& out, bool dropDeleted, uint32_t& written) {
+	written = 0;
+	for (Range& range : ranges) {
+		if (!readRange(range)) {
+			return false;
+		}
+	}
+
+	for (;;) {
+		Range* min = nullptr;
+		for (Range& range : ranges) {
+			if (range.valid && (!min || range.head.key < min->head.key)) {
+				min = &range;
+			}
+		}
+		if (!min) {
+			return true;
+		}
+		if (!dropDeleted || !(min->head.flags & CREDENTIAL_FLAG_DELETED)) {
+			if (out.write((const uint8_t*) &min->head, sizeof(min->head)) != sizeof(min->head)) {
+				return false;
+			}
+			++written;
+		}
+		if (!readRange(*min)) {
+			return false;
+		}
+		yield();
+	}
+}
+
+/**
+ * @brief Called when put() has filled the tail: sorts it into a run, then
+ * merges it with the smaller runs before it, or everything into the sorted
+ * entries once the runs hold half as many. The header is marked while
+ * entries are rewritten in place, so an interrupted merge makes open()
+ * rebuild.
+ */
+bool CredentialIndexClass::compact() {
+	_merging = true;
+	if (!writeHeader() || !sortTail(_count + _overflow - CREDENTIAL_INDEX_OVERFLOW)) {
+		return fail();
+	}
+
+	// the runs before the tail was filled, and the tail
+	std::vector<Range> ranges;
+	runRanges(_overflow / CREDENTIAL_INDEX_OVERFLOW - 1, ranges);
+
+	if (_overflow >= _count / 2) {
+		// adopting the merged file clears the mark
+		return mergeAll(ranges) || fail();
+	}
+	if (!mergeRuns(ranges)) {
+		return fail();
+	}
+	_merging = false;
+	return writeHeader();
+}
+
+bool CredentialIndexClass::sortTail(uint32_t first) {
+	const uint32_t n = _count + _overflow - first;
+	const size_t len = n * sizeof(CredentialIndexEntry);
+	std::vector<CredentialIndexEntry> tail(n);
+	if (!_file.seek(ENTRY_OFFSET(first), SeekSet) || _file.read((uint8_t*) tail.data(), len) != len) {
+		return false;
+	}
+	std::sort(tail.begin(), tail.end(),
+		[](const CredentialIndexEntry& a, const CredentialIndexEntry& b) { return a.key < b.key; });
+	return _file.seek(ENTRY_OFFSET(first), SeekSet) && _file.write((const uint8_t*) tail.data(), len) == len;
+}
+
+/**
+ * @brief Merges the sorted tail with the runs that end where it starts,
+ * those whose bits a binary counter carries over when the tail is added:
+ * the result is one run of twice the size of the largest of them. It is
+ * written to a temporary file and copied back over the same entries.
+ */
+bool CredentialIndexClass::mergeRuns(std::vector<Range>& ranges) {
+	const uint8_t carried = __builtin_ctz(_overflow / CREDENTIAL_INDEX_OVERFLOW);
+	if (carried == 0) {
+		// the sorted tail is the new run
+		return true;
+	}
+	ranges.erase(ranges.begin(), ranges.end() - (carried + 1));
+	const uint32_t first = ranges.front().next;
+	const uint32_t size = _count + _overflow - first;
+
+	File out = _fs->open(CREDENTIAL_INDEX_TEMP, "w+");
+	if (!out) {
+		return false;
+	}
+	uint32_t written;
+	bool ok = mergeRanges(ranges, out, false, written) && written == size && out.seek(0, SeekSet);
+
+	CredentialIndexEntry buf[READ_CHUNK];
+	for (uint32_t i = 0; ok && i < size; ) {
+		uint32_t n = size - i < READ_CHUNK ? size - i : READ_CHUNK;
+		size_t len = n * sizeof(CredentialIndexEntry);
+		ok = out.read((uint8_t*) buf, len) == len && _file.seek(ENTRY_OFFSET(first + i), SeekSet) &&
+		     _file.write((const uint8_t*) buf, len) == len;
+		i += n;
+	}
+	out.close();
+	_fs->remove(CREDENTIAL_INDEX_TEMP);
+
+	++stats.runMerges;
+	return ok;
+}
+
+/**
+ * @brief Streams the sorted entries and the runs, without the deleted
+ * entries, into a temporary file, which then replaces the index.
+ */
+bool CredentialIndexClass::mergeAll(std::vector<Range>& ranges) {
+	ranges.insert(ranges.begin(), Range { 0, _count, false, CredentialIndexEntry() });
+
+	File out = _fs->open(CREDENTIAL_INDEX_TEMP, "w+");
+	if (!out) {
+		return false;
+	}
+
+	// the header is written with the count once the merge is complete
+	CredentialIndexHeader header = makeHeader(0);
+	uint32_t written = 0;
+	bool ok = out.write((const uint8_t*) &header, sizeof(header)) == sizeof(header) &&
+	          mergeRanges(ranges, out, true, written);
+	header.count = written;
+	ok = ok && out.seek(0, SeekSet) && out.write((const uint8_t*) &header, sizeof(header)) == sizeof(header);
+	out.close();
+	if (!ok) {
+		_fs->remove(CREDENTIAL_INDEX_TEMP);
+		return false;
+	}
+
+	++stats.merges;
+	return adopt(CREDENTIAL_INDEX_TEMP);
+}
+
+bool CredentialIndexClass::adopt(const char* path) {
+	if (_file) {
+		_file.close();
+	}
+	_fs->remove(_path);
+	if (!_fs->rename(path, _path)) {
+		return fail();
+	}
+	return open();
+}
+
+bool CredentialIndexClass::rebuild() {
+	unsigned long start = millis();
+	CredentialIndexBuilder builder(*_fs, CREDENTIAL_INDEX_RUNS, CREDENTIAL_INDEX_TEMP);
+	if (!builder.begin()) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not create credential index"));
+		_ready = false;
+		return false;
+	}
+
+	std::unique_ptr<CredentialCursor> cursor = _store->iterate();
+	while (cursor->next()) {
+		uint64_t key;
+		if (!credentialFromText(cursor->credential().c_str(), key)) {
+			continue;
+		}
+
+		UserRecord user;
+		if (_store->get(cursor->credential(), user) != 0) {
+			continue;
+		}
+
+		CredentialIndexEntry entry;
+		entryFromUser(key, user, entry);
+		if (!builder.add(entry)) {
+			break;
+		}
+		yield();
+	}
+
+	builder.merge();
+	if (!builder.done() || !adopt(builder.path())) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not rebuild credential index"));
+		_ready = false;
+		return false;
+	}
+
+	DEBUG_SERIAL.printf("[ INFO ] Credential index rebuilt: %u entries in %lu ms\n", _count, millis() - start);
+	return _ready;
+}
+
+CredentialIndexBuilder::CredentialIndexBuilder(FS& fs, const char* runPath, const char* outPath)
+: _fs(fs)
+, _runPath(runPath)
+, _outPath(outPath)
+{
+}
+
+bool CredentialIndexBuilder::begin() {
+	abort();
+	_runs = _fs.open(_runPath, "w+");
+	if (!_runs) {
+		return fail();
+	}
+	_batch.reserve(CREDENTIAL_INDEX_BATCH);
+	_runEnd = 0;
+	_added = 0;
+	_written = 0;
+	_state = adding;
+	return true;
+}
+
+bool CredentialIndexBuilder::fail() {
+	_state = error;
+	if (_runs) {
+		_runs.close();
+	}
+	if (_out) {
+		_out.close();
+	}
+	return false;
+}
+
+void CredentialIndexBuilder::abort() {
+	if (_runs) {
+		_runs.close();
+	}
+	if (_out) {
+		_out.close();
+	}
+	if (_state != idle) {
+		_fs.remove(_runPath);
+		if (_state != complete) {
+			_fs.remove(_outPath);
+		}
+	}
+	std::vector<CredentialIndexEntry>().swap(_batch);
+	std::vector<Run>().swap(_heads);
+	_state = idle;
+}
+
+bool CredentialIndexBuilder::add(const CredentialIndexEntry& entry) {
+	if (_state != adding) {
+		return false;
+	}
+	_batch.push_back(entry);
+	++_added;
+	return _batch.size() < CREDENTIAL_INDEX_BATCH || flushBatch();
+}
+
+/**
+ * @brief Sorts the batch and appends it to the run file as one run. Of
+ * entries with the same key only the last added is kept.
+ */
+bool CredentialIndexBuilder::flushBatch() {
+	if (_batch.empty()) {
+		return true;
+	}
+	std::stable_sort(_batch.begin(), _batch.end(),
+		[](const CredentialIndexEntry& a, const CredentialIndexEntry& b) { return a.key < b.key; });
+
+	size_t kept = 0;
+	for (size_t i = 0; i < _batch.size(); i++) {
+		if (i + 1 < _batch.size() && _batch[i + 1].key == _batch[i].key) {
+			continue;
+		}
+		_batch[kept++] = _batch[i];
+	}
+
+	size_t len = kept * sizeof(CredentialIndexEntry);
+	if (_runs.write((const uint8_t*) _batch.data(), len) != len) {
+		return fail();
+	}
+	_heads.push_back(Run { _runEnd, _runEnd + (uint32_t) kept, false, CredentialIndexEntry() });
+	_runEnd += kept;
+	_batch.clear();
+	return true;
+}
+
+bool CredentialIndexBuilder::readRun(Run& run) {
+	run.valid = false;
+	if (run.next >= run.end) {
+		return true;
+	}
+	_runs.seek(run.next * sizeof(CredentialIndexEntry), SeekSet);
+	if (_runs.read((uint8_t*) &run.head, sizeof(run.head)) != sizeof(run.head)) {
+		return fail();
+	}
+	++run.next;
+	run.valid = true;
+	return true;
+}
+
+bool CredentialIndexBuilder::startMerge() {
+	if (!flushBatch()) {
+		return false;
+	}
+	std::vector<CredentialIndexEntry>().swap(_batch);
+
+	_out = _fs.open(_outPath, "w+");
+	if (!_out) {
+		return fail();
+	}
+	// the header is written with the count once the merge is complete
+	CredentialIndexHeader header = CredentialIndexHeader();
+	if (_out.write((const uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		return fail();
+	}
+
+	for (Run& run : _heads) {
+		if (!readRun(run)) {
+			return false;
+		}
+	}
+	_state = merging;
+	return true;
+}
+
+bool CredentialIndexBuilder::merge(unsigned long budgetMicros) {
+	if (_state == adding && !startMerge()) {
+		return true;
+	}
+	if (_state != merging) {
+		return true;
+	}
+
+	unsigned long start = micros();
+	do {
+		// the smallest head; of equal keys the one of the later run, added last
+		Run* min = nullptr;
+		for (Run& run : _heads) {
+			if (run.valid && (!min || run.head.key <= min->head.key)) {
+				min = &run;
+			}
+		}
+
+		if (!min) {
+			CredentialIndexHeader header = makeHeader(_written);
+			bool ok = _out.seek(0, SeekSet) && _out.write((const uint8_t*) &header, sizeof(header)) == sizeof(header);
+			_out.close();
+			_runs.close();
+			_fs.remove(_runPath);
+			std::vector<Run>().swap(_heads);
+			_state = ok ? complete : error;
+			return true;
+		}
+
+		if (_written == 0 || min->head.key != _lastKey) {
+			if (_out.write((const uint8_t*) &min->head, sizeof(min->head)) != sizeof(min->head)) {
+				fail();
+				return true;
+			}
+			_lastKey = min->head.key;
+			++_written;
+		}
+		if (!readRun(*min)) {
+			return true;
+		}
+	} while (budgetMicros == 0 || micros() - start < budgetMicros);
+	return false;
+}
+
+void CredentialIndexClass::entryFromUser(uint64_t key, const UserRecord& user, CredentialIndexEntry& entry) {
+	memset(&entry, 0, sizeof(entry));
+	entry.key = key;
+	entry.validsince = user.validsince;
+	entry.validuntil = user.validuntil;
+
+	if (user.has_validsince) {
+		entry.flags |= CREDENTIAL_FLAG_HAS_VALIDSINCE;
+	}
+	if (user.has_validuntil) {
+		entry.flags |= CREDENTIAL_FLAG_HAS_VALIDUNTIL;
+	}
+	if (user.is_banned) {
+		entry.flags |= CREDENTIAL_FLAG_BANNED;
+	}
+
+	strncpy(entry.username, user.person.c_str(), CREDENTIAL_INDEX_NAME_LEN);
+}
+
+void CredentialIndexClass::entryFromJson(uint64_t key, const JsonDocument& json, CredentialIndexEntry& entry) {
+	memset(&entry, 0, sizeof(entry));
+	entry.key = key;
+	entry.validsince = json["validsince"].as<unsigned long>();
+	entry.validuntil = json["validuntil"].as<unsigned long>();
+
+	if (json.containsKey("validsince")) {
+		entry.flags |= CREDENTIAL_FLAG_HAS_VALIDSINCE;
+	}
+	if (json.containsKey("validuntil")) {
+		entry.flags |= CREDENTIAL_FLAG_HAS_VALIDUNTIL;
+	}
+	if (json["is_banned"].as<int>() > 0) {
+		entry.flags |= CREDENTIAL_FLAG_BANNED;
+	}
+
+	// records written from the web UI use "user" rather than "username"
+	const char* name = json.containsKey("username") ? json["username"] | "" : json["user"] | "";
+	strncpy(entry.username, name, CREDENTIAL_INDEX_NAME_LEN);
+}
+
+bool CredentialIndexClass::benchmark(FS& fs, uint32_t records, uint32_t lookups, BenchResult& result) {
+	result.records = records;
+	result.lookups = lookups;
+	result.buildMillis = 0;
+	result.avgMicros = 0;
+	result.maxMicros = 0;
+	result.avgReads = 0;
+
+	if (records == 0 || records > CREDENTIAL_INDEX_BENCH_MAX || lookups == 0) {
+		return false;
+	}
+
+	unsigned long start = millis();
+	fs.remove(CREDENTIAL_INDEX_BENCH);
+	File f = fs.open(CREDENTIAL_INDEX_BENCH, "w");
+	if (!f) {
+		return false;
+	}
+
+	CredentialIndexHeader header = makeHeader(records);
+	if (f.write((const uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		f.close();
+		fs.remove(CREDENTIAL_INDEX_BENCH);
+		return false;
+	}
+
+	// synthetic keys are written in order, so no sorting is needed
+	CredentialIndexEntry buf[READ_CHUNK];
+	memset(buf, 0, sizeof(buf));
+	for (uint32_t i = 0; i < records; ) {
+		uint32_t n = records - i < READ_CHUNK ? records - i : READ_CHUNK;
+		for (uint32_t j = 0; j < n; j++) {
+			buf[j].key = (uint64_t) (i + j) * 3 + 1;
+			buf[j].validuntil = 0xFFFFFFFF;
+			buf[j].flags = CREDENTIAL_FLAG_HAS_VALIDUNTIL;
+		}
+		if (f.write((const uint8_t*) buf, n * sizeof(CredentialIndexEntry)) != n * sizeof(CredentialIndexEntry)) {
+			f.close();
+			fs.remove(CREDENTIAL_INDEX_BENCH);
+			return false;
+		}
+		i += n;
+		yield();
+	}
+	f.close();
+	result.buildMillis = millis() - start;
+
+	CredentialIndexClass bench;
+	bench._fs = &fs;
+	bench._path = CREDENTIAL_INDEX_BENCH;
+	bool ok = bench.open();
+
+	if (ok) {
+		CredentialIndexEntry entry;
+		for (uint32_t i = 0; i < lookups; i++) {
+			uint64_t key = (uint64_t) random(records) * 3 + 1;
+			if (bench.find(key, entry) != 0) {
+				ok = false;
+				break;
+			}
+			yield();
+		}
+		result.avgMicros = bench.stats.totalMicros / lookups;
+		result.maxMicros = bench.stats.maxMicros;
+		result.avgReads = bench.stats.reads / lookups;
+		bench._file.close();
+	}
+
+	fs.remove(CREDENTIAL_INDEX_BENCH);
+	return ok;
+}
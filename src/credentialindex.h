@@ -0,0 +1,262 @@
+#ifndef credentialindex_h
+#define credentialindex_h
+
+#include <algorithm>
+#include <vector>
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "userrecord.h"
+#include "credentialkey.h"
+#include "credentialstore.h"
+
+#define CREDENTIAL_INDEX_FILE "/idx.bin"
+#define CREDENTIAL_INDEX_TEMP "/idx.tmp"
+#define CREDENTIAL_INDEX_RUNS "/idx.run"
+#define CREDENTIAL_INDEX_BENCH "/idxbench.bin"
+#define CREDENTIAL_INDEX_MAGIC 0x58444943 // "CIDX"
+#define CREDENTIAL_INDEX_VERSION 3
+#define CREDENTIAL_INDEX_NAME_LEN 15
+#define CREDENTIAL_INDEX_BATCH 128   // entries sorted in RAM per run during a build
+#define CREDENTIAL_INDEX_OVERFLOW 64 // unsorted entries appended by put() before they are sorted into a run
+#define CREDENTIAL_INDEX_BENCH_MAX 10000 // largest synthetic index written by benchmark()
+
+#define CREDENTIAL_FLAG_BANNED 0x01
+#define CREDENTIAL_FLAG_HAS_VALIDSINCE 0x02
+#define CREDENTIAL_FLAG_HAS_VALIDUNTIL 0x04
+#define CREDENTIAL_FLAG_DELETED 0x80 // left by remove() until the next full merge
+
+/**
+ * @brief Fixed-size record stored in the index file. Records are kept sorted
+ * by key so that a lookup is a binary search over the file.
+ *
+ * The username is truncated to CREDENTIAL_INDEX_NAME_LEN characters and is
+ * not necessarily null terminated.
+ */
+struct __attribute__((packed)) CredentialIndexEntry {
+    uint64_t key;
+    uint32_t validsince;
+    uint32_t validuntil;
+    uint8_t flags;
+    char username[CREDENTIAL_INDEX_NAME_LEN];
+};
+
+struct __attribute__((packed)) CredentialIndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;     // sorted entries
+    uint32_t hexKeys;   // 1 if the keys were parsed from hexadecimal credentials
+    uint32_t overflow;  // entries after the sorted ones: sorted runs, then the unsorted tail
+    uint32_t deleted;   // entries marked CREDENTIAL_FLAG_DELETED
+    uint32_t merging;   // 1 while runs are rewritten in place
+};
+
+/**
+ * @brief Writes a sorted index file from entries added in any order, with
+ * flash writes linear in their number. Entries are sorted in RAM
+ * CREDENTIAL_INDEX_BATCH at a time and appended to a run file as sorted
+ * runs; merge() then combines all runs in one pass. When a key is added
+ * more than once the last entry wins.
+ *
+ * merge() can be called with a time budget, so a build can be spread over
+ * several loop() calls.
+ */
+class CredentialIndexBuilder {
+    public:
+    CredentialIndexBuilder(FS& fs, const char* runPath, const char* outPath);
+    ~CredentialIndexBuilder() { abort(); }
+
+    bool begin();
+    bool add(const CredentialIndexEntry& entry);
+
+    /**
+     * @brief Merges the runs into the output file for about budgetMicros,
+     * or until done with 0. The first call ends the adding.
+     *
+     * @return true once the output file is complete or the build failed
+     */
+    bool merge(unsigned long budgetMicros = 0);
+
+    /**
+     * @brief Stops the build and removes its files.
+     */
+    void abort();
+
+    bool building() const { return _state == adding || _state == merging; }
+    bool done() const { return _state == complete; }
+    bool failed() const { return _state == error; }
+    uint32_t added() const { return _added; }
+    uint32_t written() const { return _written; }
+    const char* path() const { return _outPath; }
+
+    private:
+    enum State { idle, adding, merging, complete, error };
+
+    struct Run {
+        uint32_t next;  // position in the run file of the entry after head
+        uint32_t end;
+        bool valid;     // false once the run is used up
+        CredentialIndexEntry head;
+    };
+
+    FS& _fs;
+    const char* _runPath;
+    const char* _outPath;
+    State _state = idle;
+    File _runs;
+    File _out;
+    std::vector<CredentialIndexEntry> _batch;
+    std::vector<Run> _heads;
+    uint32_t _runEnd = 0;
+    uint32_t _added = 0;
+    uint32_t _written = 0;
+    uint64_t _lastKey = 0;
+
+    bool flushBatch();
+    bool startMerge();
+    bool readRun(Run& run);
+    bool fail();
+};
+
+/**
+ * @brief A single-file credential store of fixed-size records sorted by a
+ * numeric key.
+ *
+ * The CredentialStore remains the full record (used for the user list and
+ * db/get), while this index holds only the fields needed to make an access
+ * decision. The index file is kept open so a lookup does not pay for
+ * SPIFFS path resolution, and costs O(log n) record reads.
+ *
+ * put() appends new keys to a short unsorted tail after the sorted
+ * entries. Each time CREDENTIAL_INDEX_OVERFLOW keys have been added the
+ * tail is sorted and merged with the sorted runs before it, as a binary
+ * counter carries, so runs double in size and an entry is rewritten
+ * O(log n) times. Once the runs hold half as many entries as the sorted
+ * area, everything is merged into it. find() binary searches the sorted
+ * area and each run, then scans the tail.
+ *
+ * remove() only marks the entry CREDENTIAL_FLAG_DELETED, so nothing has
+ * to move; the next full merge drops it. A write that fails makes the
+ * index not ready, and callers fall back to the store.
+ */
+class CredentialIndexClass {
+    public:
+    CredentialIndexClass();
+
+    /**
+     * @brief Opens the index, rebuilding it from store if the file is
+     * missing or inconsistent.
+     */
+    bool begin(FS& fs, CredentialStore& store, const char* path = CREDENTIAL_INDEX_FILE);
+
+    /**
+     * @brief Looks up a key.
+     *
+     * @return 0 if found, 1 if not found, -1 if the index is not available
+     */
+    int find(uint64_t key, CredentialIndexEntry& entry);
+
+    /**
+     * @brief Overwrites an existing entry in place, or appends a new one
+     * to the overflow area.
+     */
+    bool put(const CredentialIndexEntry& entry);
+
+    bool remove(uint64_t key);
+    bool clear();
+
+    /**
+     * @brief Convenience wrappers for callers holding a credential string and
+     * a JSON user record. Credentials that cannot be indexed are ignored.
+     */
+    bool put(const char* credential, const JsonDocument& json);
+    bool remove(const char* credential);
+
+    /**
+     * @brief Recreates the index from the user records in the store.
+     */
+    bool rebuild();
+
+    /**
+     * @brief Replaces the index with the file a CredentialIndexBuilder
+     * wrote to path.
+     */
+    bool adopt(const char* path);
+
+    bool ready() const { return _ready; }
+    uint32_t count() const { return _count + _overflow - _deleted; }
+    uint32_t overflow() const { return _overflow; }
+
+    static void entryFromUser(uint64_t key, const UserRecord& user, CredentialIndexEntry& entry);
+
+    /**
+     * @brief Same as entryFromUser() for a JSON user record, without
+     * copying the username into a String.
+     */
+    static void entryFromJson(uint64_t key, const JsonDocument& json, CredentialIndexEntry& entry);
+
+    struct Stats {
+        unsigned long lookups = 0;
+        unsigned long hits = 0;
+        unsigned long reads = 0;
+        unsigned long lastMicros = 0;
+        unsigned long maxMicros = 0;
+        unsigned long totalMicros = 0;
+        unsigned long merges = 0;     // runs merged into the sorted entries
+        unsigned long runMerges = 0;  // runs merged into a larger run
+    } stats;
+
+    struct BenchResult {
+        uint32_t records;
+        uint32_t lookups;
+        unsigned long buildMillis;
+        unsigned long avgMicros;
+        unsigned long maxMicros;
+        unsigned long avgReads;
+    };
+
+    /**
+     * @brief Builds a throw-away index of synthetic records and times random
+     * lookups against it.
+     */
+    static bool benchmark(FS& fs, uint32_t records, uint32_t lookups, BenchResult& result);
+
+    private:
+    struct Range {
+        uint32_t next;  // position of the entry after head
+        uint32_t end;
+        bool valid;     // false once the range is used up
+        CredentialIndexEntry head;
+    };
+
+    FS* _fs;
+    CredentialStore* _store;
+    const char* _path;
+    File _file;
+    uint32_t _count;
+    uint32_t _overflow;
+    uint32_t _deleted;
+    bool _merging;
+    bool _ready;
+
+    bool open();
+    bool fail();
+    bool readEntry(uint32_t pos, CredentialIndexEntry& entry);
+    bool writeEntry(uint32_t pos, const CredentialIndexEntry& entry);
+    bool writeHeader();
+    bool search(uint64_t key, uint32_t first, uint32_t last, uint32_t& pos, CredentialIndexEntry& entry);
+    bool findTail(uint64_t key, uint32_t first, uint32_t& pos, CredentialIndexEntry& entry);
+    bool locate(uint64_t key, uint32_t& pos, CredentialIndexEntry& entry);
+    void runRanges(uint32_t runs, std::vector<Range>& ranges);
+    bool readRange(Range& range);
+    bool mergeRanges(std::vector<Range>& ranges, File& out, bool dropDeleted, uint32_t& written);
+    bool compact();
+    bool sortTail(uint32_t first);
+    bool mergeRuns(std::vector<Range>& ranges);
+    bool mergeAll(std::vector<Range>& ranges);
+};
+
+extern CredentialIndexClass CredentialIndex;
+
+#endif
@@ -0,0 +1,73 @@
+#include "credentialkey.h"
+
+bool credentialBaseHex(const char* setting) {
+	return setting != nullptr && strcmp(setting, "hexadecimal") == 0;
+}
+
+bool credentialFromText(const char* text, CredentialKey& key) {
+	if (text == nullptr || text[0] == '\0') {
+		return false;
+	}
+
+	// leading zeros would make two different file names share a key
+	if (text[0] == '0' && text[1] != '\0') {
+		return false;
+	}
+
+	const bool hex = credentialHexKeys();
+	uint64_t value = 0;
+	size_t len = 0;
+	for (const char* c = text; *c; ++c, ++len) {
+		uint8_t digit;
+		if (*c >= '0' && *c <= '9') {
+			digit = *c - '0';
+		} else if (hex && *c >= 'a' && *c <= 'f') {
+			digit = *c - 'a' + 10;
+		} else if (hex && *c >= 'A' && *c <= 'F') {
+			digit = *c - 'A' + 10;
+		} else {
+			return false;
+		}
+		if (len >= (hex ? 16 : 19)) {
+			return false;
+		}
+		value = hex ? (value << 4) | digit : value * 10 + digit;
+	}
+	key = value;
+	return true;
+}
+
+void credentialToText(CredentialKey key, char* buf) {
+	const uint8_t base = credentialHexKeys() ? 16 : 10;
+	char digits[CREDENTIAL_TEXT_LEN];
+	size_t n = 0;
+	do {
+		uint8_t digit = key % base;
+		digits[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		key /= base;
+	} while (key);
+	for (size_t i = 0; i < n; i++) {
+		buf[i] = digits[n - 1 - i];
+	}
+	buf[n] = '\0';
+}
+
+void credentialNormalize(char* text) {
+	if (!credentialHexKeys() || text == nullptr) {
+		return;
+	}
+	for (char* c = text; *c; ++c) {
+		if (*c >= 'A' && *c <= 'F') {
+			*c += 'a' - 'A';
+		}
+	}
+}
+
+bool credentialLegacyName(const char* text, String& name) {
+	if (!credentialHexKeys() || text == nullptr) {
+		return false;
+	}
+	name = text;
+	name.toUpperCase();
+	return name != text;
+}
@@ -0,0 +1,57 @@
+#ifndef credentialkey_h
+#define credentialkey_h
+
+#include <Arduino.h>
+
+#define CREDENTIAL_TEXT_LEN 21 // longest credential text, with its terminator
+
+/**
+ * @brief The canonical form of a credential: the number read from the card,
+ * as stored in the credential index. Readers produce it, AccessControl
+ * decides on it, and it is only turned into text where text is needed: file
+ * names, the enrolled filter, MQTT and the web UI.
+ */
+typedef uint64_t CredentialKey;
+
+/**
+ * @brief Whether credential text is hexadecimal: config.wiegandReadHex,
+ * defined next to the configuration.
+ */
+bool credentialHexKeys();
+
+/**
+ * @brief Wiegand base from the hardware "credentialbase" setting. Wiegand
+ * credentials have always been decimal, so only an explicit "hexadecimal"
+ * selects hex; the older useridstoragemode setting is not consulted.
+ */
+bool credentialBaseHex(const char* setting);
+
+/**
+ * @brief Parses credential text: hexadecimal when credentialHexKeys(),
+ * decimal otherwise. Wiegand readers take it from credentialBaseHex();
+ * with other readers credentials are hexadecimal. Text with leading zeros
+ * is rejected, so that two different file names never share a key.
+ */
+bool credentialFromText(const char* text, CredentialKey& key);
+
+/**
+ * @brief Inverse of credentialFromText(). buf must hold CREDENTIAL_TEXT_LEN
+ * bytes.
+ */
+void credentialToText(CredentialKey key, char* buf);
+
+/**
+ * @brief Lower-cases hexadecimal credential text in place, as
+ * credentialToText() renders it, so a credential enrolled in upper case is
+ * stored under the name a scan looks up. Decimal text is left as is.
+ */
+void credentialNormalize(char* text);
+
+/**
+ * @brief The name an earlier version may have stored normalized text under:
+ * the hexadecimal credential as enrolled in upper case.
+ * @return false if there is no such name, as for decimal text
+ */
+bool credentialLegacyName(const char* text, String& name);
+
+#endif
@@ -0,0 +1,69 @@
+#include "credentialsource.h"
+#include "accesscontrol.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+CredentialSourcesClass CredentialSources;
+VirtualBadgeClass VirtualBadge;
+ButtonSourceClass ButtonSource;
+
+bool CredentialSource::submit(CredentialEvent& event) {
+	event.reader = reader();
+	event.source = type();
+	if (!AccessControl.enqueue(event)) {
+		++rejected;
+		DEBUG_SERIAL.printf("[ WARN ] Read on reader %u ignored: duplicate or queue full\n", event.reader);
+		return false;
+	}
+	++events;
+	return true;
+}
+
+bool CredentialSourcesClass::add(CredentialSource* source) {
+	if (_count >= CREDENTIAL_SOURCES_MAX) {
+		return false;
+	}
+	_sources[_count++] = source;
+	return true;
+}
+
+void CredentialSourcesClass::loop() {
+	for (uint8_t i = 0; i < _count; i++) {
+		_sources[i]->loop();
+	}
+}
+
+bool VirtualBadgeClass::present(const char* credential) {
+	CredentialEvent event = CredentialEvent();
+	if (!credentialFromText(credential, event.code)) {
+		return false;
+	}
+	event.bits = 64 - (event.code ? __builtin_clzll(event.code) : 64);
+	event.micros = micros();
+	DEBUG_SERIAL.printf("[ INFO ] Virtual badge: %s\n", credential);
+	return submit(event);
+}
+
+void ButtonSourceClass::begin(uint8_t pin) {
+	_button = new Bounce();
+	_button->attach(pin, INPUT_PULLUP);
+	_button->interval(30);
+}
+
+void ButtonSourceClass::loop() {
+	if (!_button) {
+		return;
+	}
+	_button->update();
+	if (_button->fell()) {
+		if (onPress) {
+			onPress();
+		}
+		CredentialEvent event = CredentialEvent();
+		event.micros = micros();
+		event.reader = reader();
+		event.source = type();
+		AccessControl.reportButton(event);
+		++events;
+	}
+}
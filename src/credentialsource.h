@@ -0,0 +1,131 @@
+#ifndef credentialsource_h
+#define credentialsource_h
+
+#include <Arduino.h>
+#include <Bounce2.h>
+#include "magicnumbers.h"
+#include "credentialkey.h"
+
+#define PN532_READER WIEGAND_MAX_READERS         // reader numbers of the sources after the Wiegand readers
+#define RDM6300_READER (WIEGAND_MAX_READERS + 1)
+#define VIRTUAL_READER (WIEGAND_MAX_READERS + 2)
+#define BUTTON_READER (WIEGAND_MAX_READERS + 3)
+#define CREDENTIAL_SOURCES_MAX 8                 // sources that can be registered
+
+enum CredentialSourceType : uint8_t {
+    source_wiegand,
+    source_pn532,
+    source_rdm6300,
+    source_virtual,
+    source_button
+};
+
+/**
+ * @brief A credential presented at a reader, as queued for AccessControl.
+ *
+ * code is the canonical credential key; bits and facility describe the
+ * format it was read in. A button event has no code; it opens the door
+ * without a lookup.
+ */
+struct CredentialEvent {
+    CredentialKey code;
+    uint32_t facility;          // Wiegand facility code, 0 for formats without one
+    uint8_t reader;             // reader number, 0.. for Wiegand readers, then PN532_READER etc.
+    CredentialSourceType source;
+    uint8_t bits;               // length of the credential as read: Wiegand frame or UID bits
+    unsigned long micros;       // micros() when it was read: the last edge of a Wiegand frame
+    unsigned long queuedMicros; // set by AccessControlClass::enqueue()
+};
+
+/**
+ * @brief Anything that produces credentials: card readers, the virtual
+ * badge and the exit button. Registered sources are stepped by
+ * CredentialSources.loop() and hand their reads to AccessControl with
+ * submit(), so reading never waits for a decision.
+ */
+class CredentialSource {
+    public:
+    virtual ~CredentialSource() {}
+
+    /**
+     * @brief One short, non-blocking step of the source.
+     */
+    virtual void loop() {}
+
+    virtual bool active() const = 0;
+    virtual uint8_t reader() const = 0;
+    virtual CredentialSourceType type() const = 0;
+
+    unsigned long events = 0;    // events submitted
+    unsigned long rejected = 0;  // duplicates, or the queue was full
+
+    protected:
+    /**
+     * @brief Fills in reader and source and queues the event.
+     * @return true if it was queued
+     */
+    bool submit(CredentialEvent& event);
+};
+
+/**
+ * @brief The registered sources, in a fixed table.
+ */
+class CredentialSourcesClass {
+    public:
+    bool add(CredentialSource* source);
+    void loop();
+
+    uint8_t size() const { return _count; }
+    CredentialSource* operator[](uint8_t i) const { return _sources[i]; }
+
+    private:
+    CredentialSource* _sources[CREDENTIAL_SOURCES_MAX] = {};
+    uint8_t _count = 0;
+};
+
+/**
+ * @brief Credentials presented over MQTT (set/badge) or the WebSocket
+ * "badge" command, e.g. by a simulator or for testing a door remotely.
+ * They are decided like any card.
+ */
+class VirtualBadgeClass : public CredentialSource {
+    public:
+    bool active() const override { return true; }
+    uint8_t reader() const override { return VIRTUAL_READER; }
+    CredentialSourceType type() const override { return source_virtual; }
+
+    /**
+     * @brief Queues credential, given as stored (see credentialFromText()).
+     * @return false if it is not a valid credential or was not queued
+     */
+    bool present(const char* credential);
+};
+
+/**
+ * @brief The exit button. A press opens the door right away through
+ * onPress, without a lookup and without waiting behind queued reads, and is
+ * then published with AccessControlClass::reportButton().
+ */
+class ButtonSourceClass : public CredentialSource {
+    public:
+    void begin(uint8_t pin);
+    void loop() override;
+
+    /**
+     * @brief Opens the door, set up by main.
+     */
+    void (*onPress)() = nullptr;
+
+    bool active() const override { return _button != nullptr; }
+    uint8_t reader() const override { return BUTTON_READER; }
+    CredentialSourceType type() const override { return source_button; }
+
+    private:
+    Bounce* _button = nullptr;
+};
+
+extern CredentialSourcesClass CredentialSources;
+extern VirtualBadgeClass VirtualBadge;
+extern ButtonSourceClass ButtonSource;
+
+#endif
@@ -0,0 +1,481 @@
+#include "credentialstore.h"
+#include "logstore.h"
+#include "helpers.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+#if defined(USE_LITTLEFS)
+static LittleFsCredentialStore fileStore(LittleFS);
+#else
+static FsCredentialStore fileStore(SPIFFS);
+#endif
+
+#if defined(CREDENTIAL_STORE_MEMORY)
+static MemoryCredentialStore slotA;
+static MemoryCredentialStore slotB;
+#elif defined(CREDENTIAL_STORE_FILES)
+static CredentialStore& slotA = fileStore;
+#if defined(USE_LITTLEFS)
+static LittleFsCredentialStore slotB(LittleFS, CREDENTIAL_STORE_DIR_B);
+#else
+static FsCredentialStore slotB(SPIFFS, CREDENTIAL_STORE_DIR_B);
+#endif
+#else
+// records from the per-file layout are moved into the log on first boot
+static LogCredentialStore slotA(FILESYSTEM, &fileStore);
+static LogCredentialStore slotB(FILESYSTEM, nullptr, LOG_STORE_FILE_B, LOG_STORE_NEXT_B);
+#endif
+
+SlottedCredentialStore Credentials(FILESYSTEM, slotA, slotB);
+
+void CredentialStore::recordGet(unsigned long start, bool found) {
+	unsigned long elapsed = micros() - start;
+	++stats.gets;
+	if (!found) {
+		++stats.misses;
+	}
+	stats.lastMicros = elapsed;
+	stats.totalMicros += elapsed;
+	if (elapsed > stats.maxMicros) {
+		stats.maxMicros = elapsed;
+	}
+}
+
+bool CredentialStore::benchmark(CredentialStore& store, uint32_t records, uint32_t lookups, BenchResult& result) {
+	memset(&result, 0, sizeof(result));
+	result.records = records;
+	result.lookups = lookups;
+	if (records == 0 || lookups == 0 || !store.begin() || !store.clear()) {
+		return false;
+	}
+
+	StaticJsonDocument<256> json;
+	unsigned long start = millis();
+	for (uint32_t i = 0; i < records; i++) {
+		json.clear();
+		json["username"] = "bench";
+		json["validsince"] = 0;
+		json["validuntil"] = 0xFFFFFFFF;
+		json["record_time"] = i;
+		if (!store.put(String(i * 3 + 1), json)) {
+			store.clear();
+			return false;
+		}
+		yield();
+	}
+	result.putMillis = millis() - start;
+
+	bool ok = true;
+	Stats before = store.stats;
+	for (uint32_t i = 0; i < lookups; i++) {
+		UserRecord user;
+		if (store.get(String((uint32_t) random(records) * 3 + 1), user) != 0) {
+			ok = false;
+			break;
+		}
+		yield();
+	}
+	result.avgMicros = (store.stats.totalMicros - before.totalMicros) / lookups;
+	result.maxMicros = store.stats.maxMicros;
+	store.stats = before;
+
+	start = millis();
+	store.clear();
+	result.clearMillis = millis() - start;
+	return ok;
+}
+
+SlottedCredentialStore::SlottedCredentialStore(FS& fs, CredentialStore& a, CredentialStore& b)
+: _fs(fs)
+, _slots{&a, &b}
+, _active(0)
+, _staging(false)
+, _reclaiming(false)
+, _stageStart(0)
+, _lastCommitMillis(0)
+{
+}
+
+uint8_t SlottedCredentialStore::loadActive() {
+	// a power cut between removing the old slot file and renaming the new one
+	if (!_fs.exists(CREDENTIAL_STORE_SLOT_FILE) && _fs.exists(CREDENTIAL_STORE_SLOT_TEMP)) {
+		_fs.rename(CREDENTIAL_STORE_SLOT_TEMP, CREDENTIAL_STORE_SLOT_FILE);
+	}
+	File f = _fs.open(CREDENTIAL_STORE_SLOT_FILE, "r");
+	if (!f) {
+		return 0;
+	}
+	int c = f.read();
+	f.close();
+	return c == 'b' ? 1 : 0;
+}
+
+bool SlottedCredentialStore::saveActive(uint8_t active) {
+	File f = _fs.open(CREDENTIAL_STORE_SLOT_TEMP, "w");
+	if (!f) {
+		return false;
+	}
+	bool ok = f.write((uint8_t) (active ? 'b' : 'a')) == 1;
+	f.close();
+	if (!ok) {
+		return false;
+	}
+	_fs.remove(CREDENTIAL_STORE_SLOT_FILE);
+	return _fs.rename(CREDENTIAL_STORE_SLOT_TEMP, CREDENTIAL_STORE_SLOT_FILE);
+}
+
+bool SlottedCredentialStore::begin() {
+	_active = loadActive();
+	_staging = false;
+	if (!live().begin()) {
+		return false;
+	}
+
+	// whatever is left in the other slot is a resync that never committed,
+	// or an old copy that was not fully reclaimed before a reboot
+	_reclaiming = stage().begin();
+	DEBUG_SERIAL.printf("[ INFO ] Credential store slot %c is live\n", slot());
+	return true;
+}
+
+int SlottedCredentialStore::get(const String& credential, UserRecord& user) {
+	unsigned long start = micros();
+	int result = live().get(credential, user);
+	recordGet(start, result == 0);
+	return result;
+}
+
+bool SlottedCredentialStore::getJson(const String& credential, JsonDocument& json, size_t* size) {
+	return live().getJson(credential, json, size);
+}
+
+bool SlottedCredentialStore::put(const String& credential, const JsonDocument& json) {
+	if (!live().put(credential, json)) {
+		return false;
+	}
+	++stats.puts;
+	// a record added while a resync runs may be newer than the copy the
+	// server is sending, so it must survive the commit
+	if (_staging) {
+		stage().put(credential, json);
+	}
+	return true;
+}
+
+bool SlottedCredentialStore::remove(const String& credential) {
+	// likewise a revocation must not come back with the staged copy
+	if (_staging) {
+		stage().remove(credential);
+	}
+	if (!live().remove(credential)) {
+		return false;
+	}
+	++stats.removes;
+	return true;
+}
+
+bool SlottedCredentialStore::clear() {
+	abortStage();
+	stats.removes += live().count();
+	return live().clear();
+}
+
+bool SlottedCredentialStore::beginStage() {
+	// the staging slot may still hold the previous copy; reclaiming it
+	// here would hold up loop()
+	if (_reclaiming) {
+		return false;
+	}
+
+	if (!stage().begin() || !stage().clear()) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not prepare the staging credential slot"));
+		_reclaiming = true;
+		return false;
+	}
+	_staging = true;
+	_stageStart = millis();
+	return true;
+}
+
+bool SlottedCredentialStore::commitStage() {
+	if (!_staging || !saveActive(_active ^ 1)) {
+		return false;
+	}
+	_active ^= 1;
+	_staging = false;
+	_reclaiming = true;
+	_lastCommitMillis = millis() - _stageStart;
+	DEBUG_SERIAL.printf("[ INFO ] Credential store slot %c is live: %u records staged in %lu ms\n", slot(), live().count(), _lastCommitMillis);
+	return true;
+}
+
+void SlottedCredentialStore::abortStage() {
+	if (_staging) {
+		_staging = false;
+		_reclaiming = true;
+	}
+}
+
+void SlottedCredentialStore::loop() {
+	live().loop();
+	if (_staging) {
+		stage().loop();
+	} else if (_reclaiming) {
+		unsigned long start = micros();
+		while (micros() - start < CREDENTIAL_STORE_RECLAIM_MICROS) {
+			if (stage().reclaim()) {
+				_reclaiming = false;
+				break;
+			}
+		}
+	}
+}
+
+void SlottedCredentialStore::status(JsonObject& out) {
+	live().status(out);
+	out["slot"] = String(slot());
+	out["staging"] = _staging;
+	if (_staging) {
+		out["staged"] = stage().count();
+	}
+	out["reclaiming"] = _reclaiming;
+	out["last_commit_ms"] = _lastCommitMillis;
+}
+
+class FsCredentialCursor : public CredentialCursor {
+    public:
+	FsCredentialCursor(Dir dir, size_t nameOffset)
+	: _dir(dir)
+	, _nameOffset(nameOffset)
+	{
+	}
+
+	bool next() override {
+		if (!_dir.next()) {
+			return false;
+		}
+		_credential = _dir.fileName().substring(_nameOffset);
+		return true;
+	}
+
+	const String& credential() const override { return _credential; }
+	size_t size() override { return _dir.fileSize(); }
+
+    private:
+	Dir _dir;
+	size_t _nameOffset;
+	String _credential;
+};
+
+FsCredentialStore::FsCredentialStore(FS& fs, const char* prefix)
+: _fs(fs)
+, _prefix(prefix)
+{
+}
+
+int FsCredentialStore::get(const String& credential, UserRecord& user) {
+	unsigned long start = micros();
+	File f = _fs.open(path(credential), "r");
+	if (!f) {
+		recordGet(start, false);
+		return 1;
+	}
+
+	int error = readUserRecord(f, credential, user);
+	f.close();
+	recordGet(start, true);
+	return error;
+}
+
+bool FsCredentialStore::getJson(const String& credential, JsonDocument& json, size_t* size) {
+	File f = _fs.open(path(credential), "r");
+	if (!f) {
+		return false;
+	}
+	if (size) {
+		*size = f.size();
+	}
+	bool loaded = readUserRecordJson(f, credential, json);
+	f.close();
+	return loaded;
+}
+
+bool FsCredentialStore::put(const String& credential, const JsonDocument& json) {
+	File f = _fs.open(path(credential), "w");
+	if (!f) {
+		return false;
+	}
+	size_t written = writeUserRecord(f, json);
+	f.close();
+	++stats.puts;
+	return written > 0;
+}
+
+bool FsCredentialStore::remove(const String& credential) {
+	String file = path(credential);
+	if (!_fs.exists(file) || !_fs.remove(file)) {
+		return false;
+	}
+	++stats.removes;
+	return true;
+}
+
+bool FsCredentialStore::clear() {
+	// removing entries can disturb an open LittleFS directory listing, so
+	// repeat until a pass finds nothing left
+	size_t removed;
+	do {
+		removed = 0;
+		std::unique_ptr<CredentialCursor> cursor = iterate();
+		while (cursor->next()) {
+			if (_fs.remove(path(cursor->credential()))) {
+				++removed;
+				++stats.removes;
+			}
+			yield();
+		}
+	} while (removed > 0);
+	return true;
+}
+
+bool FsCredentialStore::reclaim() {
+	// a pass that finds nothing to remove means the directory is empty
+	unsigned long start = micros();
+	bool removed = false;
+	std::unique_ptr<CredentialCursor> cursor = iterate();
+	while (micros() - start < CREDENTIAL_STORE_RECLAIM_MICROS && cursor->next()) {
+		if (_fs.remove(path(cursor->credential()))) {
+			removed = true;
+			++stats.removes;
+		}
+	}
+	return !removed && !cursor->next();
+}
+
+size_t FsCredentialStore::count() {
+	size_t n = 0;
+	std::unique_ptr<CredentialCursor> cursor = iterate();
+	while (cursor->next()) {
+		++n;
+	}
+	return n;
+}
+
+std::unique_ptr<CredentialCursor> FsCredentialStore::iterate() {
+	return std::unique_ptr<CredentialCursor>(new FsCredentialCursor(_fs.openDir(_prefix), nameOffset()));
+}
+
+bool FsCredentialStore::info(size_t& used, size_t& total) {
+	FSInfo fsinfo;
+	if (!_fs.info(fsinfo)) {
+		return false;
+	}
+	used = fsinfo.usedBytes;
+	total = fsinfo.totalBytes;
+	return true;
+}
+
+LittleFsCredentialStore::LittleFsCredentialStore(FS& fs, const char* prefix)
+: FsCredentialStore(fs, prefix)
+{
+}
+
+bool LittleFsCredentialStore::begin() {
+	String dir = _prefix.substring(0, _prefix.length() - 1);
+	if (_fs.exists(dir)) {
+		return true;
+	}
+	if (!_fs.mkdir(dir)) {
+		DEBUG_SERIAL.printf("[ ERROR ] Could not create %s\n", dir.c_str());
+		return false;
+	}
+	return true;
+}
+
+class MemoryCredentialCursor : public CredentialCursor {
+    public:
+	MemoryCredentialCursor(std::map<String, MemoryCredentialStore::Entry>& records)
+	: _records(records)
+	, _it(records.begin())
+	, _started(false)
+	{
+	}
+
+	bool next() override {
+		if (_started && _it != _records.end()) {
+			++_it;
+		}
+		_started = true;
+		return _it != _records.end();
+	}
+
+	const String& credential() const override { return _it->first; }
+	size_t size() override { return sizeof(UserRecordHeader) + _it->second.user.person.length() + _it->second.json.length(); }
+
+    private:
+	std::map<String, MemoryCredentialStore::Entry>& _records;
+	std::map<String, MemoryCredentialStore::Entry>::iterator _it;
+	bool _started;
+};
+
+int MemoryCredentialStore::get(const String& credential, UserRecord& user) {
+	unsigned long start = micros();
+	auto it = _records.find(credential);
+	if (it == _records.end()) {
+		recordGet(start, false);
+		return 1;
+	}
+	user = it->second.user;
+	recordGet(start, true);
+	return 0;
+}
+
+bool MemoryCredentialStore::getJson(const String& credential, JsonDocument& json, size_t* size) {
+	auto it = _records.find(credential);
+	if (it == _records.end()) {
+		return false;
+	}
+	if (size) {
+		*size = it->second.json.length();
+	}
+	return !deserializeJson(json, it->second.json);
+}
+
+bool MemoryCredentialStore::put(const String& credential, const JsonDocument& json) {
+	Entry& entry = _records[credential];
+	_bytes -= entry.json.length();
+	decodeUserRecord(credential, json, entry.user);
+	entry.json = String();
+	serializeJson(json, entry.json);
+	_bytes += entry.json.length();
+	++stats.puts;
+	return true;
+}
+
+bool MemoryCredentialStore::remove(const String& credential) {
+	auto it = _records.find(credential);
+	if (it == _records.end()) {
+		return false;
+	}
+	_bytes -= it->second.json.length();
+	_records.erase(it);
+	++stats.removes;
+	return true;
+}
+
+bool MemoryCredentialStore::clear() {
+	stats.removes += _records.size();
+	_records.clear();
+	_bytes = 0;
+	return true;
+}
+
+std::unique_ptr<CredentialCursor> MemoryCredentialStore::iterate() {
+	return std::unique_ptr<CredentialCursor>(new MemoryCredentialCursor(_records));
+}
+
+bool MemoryCredentialStore::info(size_t& used, size_t& total) {
+	used = _bytes;
+	total = _bytes + ESP.getFreeHeap();
+	return true;
+}
@@ -0,0 +1,277 @@
+#ifndef credentialstore_h
+#define credentialstore_h
+
+#include <map>
+#include <memory>
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "userrecord.h"
+
+#define CREDENTIAL_STORE_DIR "/P/"
+#define CREDENTIAL_STORE_DIR_B "/Q/"
+#define CREDENTIAL_STORE_BENCH_DIR "/B/"
+#define CREDENTIAL_STORE_SLOT_FILE "/dbslot"
+#define CREDENTIAL_STORE_SLOT_TEMP "/dbslot.tmp"
+#define CREDENTIAL_STORE_RECLAIM_MICROS 2000 // time budget of one reclaim slice in loop()
+
+/**
+ * @brief Walks the credentials held by a store. The order is backend
+ * specific. Changing the store while a cursor is open is only safe for the
+ * flash backends.
+ */
+class CredentialCursor {
+    public:
+    virtual ~CredentialCursor() {}
+
+    /**
+     * @brief Advances to the next credential.
+     * @return false once every credential has been visited
+     */
+    virtual bool next() = 0;
+
+    virtual const String& credential() const = 0;
+
+    /**
+     * @brief Size of the stored record in bytes.
+     */
+    virtual size_t size() = 0;
+};
+
+/**
+ * @brief Storage backend for user records, keyed by credential string.
+ *
+ * The credential index, the enrolled filter and the AccessControl cache are
+ * derived from the store and must still be updated by whoever changes it.
+ */
+class CredentialStore {
+    public:
+    virtual ~CredentialStore() {}
+
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Prepares the backend. The file system must already be mounted.
+     */
+    virtual bool begin() = 0;
+
+    /**
+     * @brief Loads the fields needed for an access decision.
+     * @return 0 found, 1 not found, 2 record could not be decoded
+     */
+    virtual int get(const String& credential, UserRecord& user) = 0;
+
+    /**
+     * @brief Loads the full JSON form of a record.
+     * @param size set to the stored record size when not null
+     */
+    virtual bool getJson(const String& credential, JsonDocument& json, size_t* size = nullptr) = 0;
+
+    virtual bool put(const String& credential, const JsonDocument& json) = 0;
+    virtual bool remove(const String& credential) = 0;
+    virtual bool clear() = 0;
+    virtual size_t count() = 0;
+    virtual std::unique_ptr<CredentialCursor> iterate() = 0;
+
+    /**
+     * @brief Bytes used and available to the backend.
+     */
+    virtual bool info(size_t& used, size_t& total) = 0;
+
+    /**
+     * @brief Runs background maintenance. Called from the main loop.
+     */
+    virtual void loop() {}
+
+    /**
+     * @brief Adds backend specific details to the db/status reply.
+     */
+    virtual void status(JsonObject& out) {}
+
+    /**
+     * @brief Frees a slice of the storage held by a store that no longer
+     * serves lookups. Called from the main loop until it returns true; the
+     * store must be started with begin() before it is used again.
+     */
+    virtual bool reclaim() { clear(); return true; }
+
+    struct Stats {
+        unsigned long gets = 0;
+        unsigned long misses = 0;
+        unsigned long puts = 0;
+        unsigned long removes = 0;
+        unsigned long lastMicros = 0;
+        unsigned long maxMicros = 0;
+        unsigned long totalMicros = 0;
+    } stats;
+
+    struct BenchResult {
+        uint32_t records;
+        uint32_t lookups;
+        unsigned long putMillis;
+        unsigned long avgMicros;
+        unsigned long maxMicros;
+        unsigned long clearMillis;
+    };
+
+    /**
+     * @brief Writes synthetic records to an empty store, times random
+     * lookups against them and clears the store again.
+     */
+    static bool benchmark(CredentialStore& store, uint32_t records, uint32_t lookups, BenchResult& result);
+
+    protected:
+    void recordGet(unsigned long start, bool found);
+};
+
+/**
+ * @brief One file per credential below a directory prefix, each holding a
+ * binary user record (see userrecord.h).
+ */
+class FsCredentialStore : public CredentialStore {
+    public:
+    FsCredentialStore(FS& fs, const char* prefix = CREDENTIAL_STORE_DIR);
+
+    const char* name() const override { return "spiffs"; }
+    bool begin() override { return true; }
+    int get(const String& credential, UserRecord& user) override;
+    bool getJson(const String& credential, JsonDocument& json, size_t* size = nullptr) override;
+    bool put(const String& credential, const JsonDocument& json) override;
+    bool remove(const String& credential) override;
+    bool clear() override;
+    size_t count() override;
+    std::unique_ptr<CredentialCursor> iterate() override;
+    bool info(size_t& used, size_t& total) override;
+    bool reclaim() override;
+
+    protected:
+    FS& _fs;
+    String _prefix;
+
+    String path(const String& credential) const { return _prefix + credential; }
+
+    /**
+     * @brief Number of leading characters of Dir::fileName() that are not
+     * part of the credential. SPIFFS returns the full path.
+     */
+    virtual size_t nameOffset() const { return _prefix.length(); }
+};
+
+/**
+ * @brief Same layout as FsCredentialStore, but in a real LittleFS directory.
+ * LittleFS mounts without scanning every page, so boot time does not grow
+ * with the number of records.
+ */
+class LittleFsCredentialStore : public FsCredentialStore {
+    public:
+    LittleFsCredentialStore(FS& fs, const char* prefix = CREDENTIAL_STORE_DIR);
+
+    const char* name() const override { return "littlefs"; }
+    bool begin() override;
+
+    protected:
+    // LittleFS returns names relative to the opened directory
+    size_t nameOffset() const override { return 0; }
+};
+
+/**
+ * @brief Keeps every record in RAM. Nothing survives a reboot; this is
+ * meant for benchmarking the other backends and for running the lookup
+ * path without flash.
+ */
+class MemoryCredentialStore : public CredentialStore {
+    public:
+    const char* name() const override { return "memory"; }
+    bool begin() override { return true; }
+    int get(const String& credential, UserRecord& user) override;
+    bool getJson(const String& credential, JsonDocument& json, size_t* size = nullptr) override;
+    bool put(const String& credential, const JsonDocument& json) override;
+    bool remove(const String& credential) override;
+    bool clear() override;
+    size_t count() override { return _records.size(); }
+    std::unique_ptr<CredentialCursor> iterate() override;
+    bool info(size_t& used, size_t& total) override;
+
+    private:
+    struct Entry {
+        UserRecord user;
+        String json;
+    };
+    std::map<String, Entry> _records;
+    size_t _bytes = 0;
+
+    friend class MemoryCredentialCursor;
+};
+
+/**
+ * @brief Two stores of the same backend, A and B. One is live and serves
+ * every call of the CredentialStore interface; the other is filled as a
+ * staging copy during a full resync.
+ *
+ * commitStage() makes the staged copy live in one step and records the
+ * live slot in CREDENTIAL_STORE_SLOT_FILE, so the switch survives a reboot.
+ * The old copy is then reclaimed a slice at a time from loop(). Until the
+ * commit, lookups are answered from the live slot as if no resync was
+ * running.
+ */
+class SlottedCredentialStore : public CredentialStore {
+    public:
+    SlottedCredentialStore(FS& fs, CredentialStore& a, CredentialStore& b);
+
+    const char* name() const override { return live().name(); }
+    bool begin() override;
+    int get(const String& credential, UserRecord& user) override;
+    bool getJson(const String& credential, JsonDocument& json, size_t* size = nullptr) override;
+    bool put(const String& credential, const JsonDocument& json) override;
+    bool remove(const String& credential) override;
+    bool clear() override;
+    size_t count() override { return live().count(); }
+    std::unique_ptr<CredentialCursor> iterate() override { return live().iterate(); }
+    bool info(size_t& used, size_t& total) override { return live().info(used, total); }
+    void loop() override;
+    void status(JsonObject& out) override;
+
+    /**
+     * @brief Empties the staging slot and starts collecting records in it.
+     * Fails while the previous copy is still being reclaimed.
+     */
+    bool beginStage();
+
+    /**
+     * @brief The staging slot, only valid while staging() is true.
+     */
+    CredentialStore& stage() { return *_slots[_active ^ 1]; }
+
+    /**
+     * @brief Makes the staging slot live.
+     */
+    bool commitStage();
+    void abortStage();
+
+    bool staging() const { return _staging; }
+    bool reclaiming() const { return _reclaiming; }
+    char slot() const { return _active ? 'b' : 'a'; }
+
+    private:
+    FS& _fs;
+    CredentialStore* _slots[2];
+    uint8_t _active;
+    bool _staging;
+    bool _reclaiming;
+    unsigned long _stageStart;
+    unsigned long _lastCommitMillis;
+
+    CredentialStore& live() const { return *_slots[_active]; }
+    bool saveActive(uint8_t active);
+    uint8_t loadActive();
+};
+
+/**
+ * @brief The store selected at build time: one file per credential with
+ * CREDENTIAL_STORE_FILES, RAM with CREDENTIAL_STORE_MEMORY, and the
+ * append-only log (see logstore.h) otherwise, each with an A and a B slot.
+ * File based stores use LittleFS with USE_LITTLEFS and SPIFFS otherwise.
+ */
+extern SlottedCredentialStore Credentials;
+
+#endif
@@ -10,6 +10,7 @@
  */
 
 #include "door.h"
+#include "eventbus.h"
 
 #define DEBUG_SERIAL if(DEBUG)Serial
 
@@ -18,11 +19,19 @@ void debugPrint(const char *info)
   Serial.printf("milliseconds: %lu - %s\n", millis(), info);
 }
 
+static void report(EventType type, bool on)
+{
+  BusEvent event = BusEvent();
+  event.type = type;
+  event.on = on;
+  EventBus.publish(event);
+}
+
 bool BounceWithCB::update() 
 {
   bool changed = Bounce::update();
-  if (changed && onStateChangeCB) {
-    onStateChangeCB(read());
+  if (changed) {
+    report(event_door_sensor, read());
   }
   return changed;
 }
@@ -30,9 +39,7 @@ bool BounceWithCB::update()
 void BounceWithCB::begin()
 {
   Bounce::begin();
-  if (onStateChangeCB) {
-    onStateChangeCB(read());
-  }
+  report(event_door_sensor, read());
 }
 
 Door::Door(Bounce *door_sensor, Relay *lock, Relay *indicator, Relay *alarm, Relay *open, Relay *close)
@@ -154,9 +161,7 @@ bool Door::update()
       state = tamper; // tamper
       // send alarm
       debugPrint("tamper detected");
-      if (tamperCallBack) {
-        tamperCallBack(true);
-      }
+      report(event_tamper, true);
     }
     break;
 
@@ -290,9 +295,7 @@ bool Door::update()
       state = secure;
       acted = true;
       debugPrint("door closed -- alarm off");
-      if (alarmCallBack) {
-        alarmCallBack(false);
-      }
+      report(event_alarm, false);
     }
     break;
 
@@ -308,9 +311,7 @@ bool Door::update()
       state = secure; // to verify door locked from alarm state
       acted = true;
       debugPrint("door closed -- door locked");
-      if (tamperCallBack) {
-        tamperCallBack(false);
-      }
+      report(event_tamper, false);
     }
     else if (millis() > lastMilli + 10000)
     {
@@ -321,9 +322,7 @@ bool Door::update()
       state = alarm;
       acted = true;
       debugPrint("tamper alarm triggered");
-      if (alarmCallBack) {
-        alarmCallBack(true);
-      }
+      report(event_alarm, true);
     }
     break;
 
@@ -332,9 +331,7 @@ bool Door::update()
     lastMilli = millis();
     DEBUG_SERIAL.printf("Door::update(): unknown state: %d", state);
     state = alarm;
-    if (alarmCallBack) {
-      alarmCallBack(true);
-    }
+    report(event_alarm, true);
     // log error
     break;
   }
@@ -13,10 +13,12 @@
 // #define RELAY_CLOSE 4
 // #define RELAY_COUNT 5
 
+/**
+ * @brief A Bounce that publishes event_door_sensor when its state changes.
+ */
 class BounceWithCB : public Bounce 
 {
 public:
-    void (*onStateChangeCB)(bool newState) = nullptr;
     bool update();
     void begin();
 };
@@ -85,8 +87,7 @@ public:
 
     // void (*activateCallBack)();
     // void (*doorStateCallBack)(DoorState state);
-    void (*tamperCallBack)(bool on) = nullptr;
-    void (*alarmCallBack)(bool on) = nullptr;
+    // tamper and alarm changes are published as event_tamper and event_alarm
     // void unlock();
     // void open();
     // void close();
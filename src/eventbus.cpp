@@ -0,0 +1,82 @@
+#include "eventbus.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+EventBusClass EventBus;
+
+static_assert(EVENT_BUS_ACCESS_RESERVE < EVENT_BUS_QUEUE_SIZE - 1, "other events need room in the queue too");
+
+bool EventBusClass::subscribe(EventType type, EventHandler handler, bool immediately) {
+	if (type >= EVENT_TYPES) {
+		return false;
+	}
+	Table& table = immediately ? immediate[type] : deferred[type];
+	if (table.count >= EVENT_BUS_SUBSCRIBERS) {
+		return false;
+	}
+	table.handlers[table.count++] = handler;
+	return true;
+}
+
+bool EventBusClass::publish(BusEvent& event) {
+	event.postedMicros = micros();
+	++stats[event.type].published;
+
+	const Table& first = immediate[event.type];
+	for (uint8_t i = 0; i < first.count; i++) {
+		first.handlers[i](event);
+	}
+
+	if (deferred[event.type].count == 0) {
+		return true;
+	}
+	if (event.type == event_access) {
+		if (!queue.push(event)) {
+			// too late to queue, but a decision is never lost
+			++stats[event.type].direct;
+			DEBUG_SERIAL.println(F("[ WARN ] Event bus full, access event dispatched directly"));
+			dispatch(event);
+		}
+		return true;
+	}
+	if (queue.capacity() - queue.size() <= EVENT_BUS_ACCESS_RESERVE || !queue.push(event)) {
+		++stats[event.type].dropped;
+		DEBUG_SERIAL.printf("[ WARN ] Event bus full, %s event dropped\n", typeName(event.type));
+		return false;
+	}
+	return true;
+}
+
+void EventBusClass::loop() {
+	BusEvent event;
+	for (uint8_t n = 0; n < EVENT_BUS_BURST && queue.pop(event); n++) {
+		dispatch(event);
+	}
+}
+
+void EventBusClass::dispatch(const BusEvent& event) {
+	Stats& s = stats[event.type];
+	unsigned long start = micros();
+	if (start - event.postedMicros > s.maxWaitMicros) {
+		s.maxWaitMicros = start - event.postedMicros;
+	}
+
+	const Table& table = deferred[event.type];
+	for (uint8_t i = 0; i < table.count; i++) {
+		table.handlers[i](event);
+	}
+
+	unsigned long elapsed = micros() - start;
+	++s.dispatched;
+	s.totalMicros += elapsed;
+	if (elapsed > s.maxMicros) {
+		s.maxMicros = elapsed;
+	}
+}
+
+const char* EventBusClass::typeName(EventType type) {
+	static const char* const names[EVENT_TYPES] = {
+		"access", "relay", "door_sensor", "tamper", "alarm", "relay_test"
+	};
+	return type < EVENT_TYPES ? names[type] : "unknown";
+}
@@ -0,0 +1,115 @@
+#ifndef eventbus_h
+#define eventbus_h
+
+#include <Arduino.h>
+#include "spscring.h"
+#include "accesscontrol.h"
+
+#define EVENT_BUS_QUEUE_SIZE 16 // events waiting for their deferred subscribers, a power of two; one slot is kept free
+#define EVENT_BUS_SUBSCRIBERS 4 // subscribers per event type
+#define EVENT_BUS_BURST 4       // queued events dispatched per loop()
+#define EVENT_BUS_ACCESS_RESERVE 4 // queue slots only access events may take
+
+class Relay;
+
+enum EventType : uint8_t {
+    event_access,       // a decision, see ScanEvent
+    event_relay,        // a relay changed state
+    event_door_sensor,  // the door status pin changed, on is true when closed
+    event_tamper,       // the door was opened while locked, or closed again
+    event_alarm,        // the door was open too long, or the alarm was cleared
+    event_relay_test,   // the web UI asked to activate relay index
+    EVENT_TYPES
+};
+
+/**
+ * @brief An event, copied into the bus queue. Only the member of the
+ * union that belongs to type is set.
+ */
+struct BusEvent {
+    EventType type;
+    unsigned long postedMicros;    // set by publish()
+    union {
+        ScanEvent scan;            // event_access
+        struct {
+            const Relay* relay;
+            uint8_t operation;     // Relay::OperationState
+            uint8_t override;      // Relay::OverrideState
+        } relay;                   // event_relay
+        bool on;                   // event_door_sensor, event_tamper, event_alarm
+        uint8_t index;             // event_relay_test
+    };
+};
+
+typedef void (*EventHandler)(const BusEvent& event);
+
+/**
+ * @brief Connects the parts of the firmware that report something to the
+ * parts that act on it, without them knowing each other.
+ *
+ * A subscriber is either immediate, called from publish() itself, or
+ * deferred, called from loop() once the event has been taken off a fixed
+ * queue. Only what must not wait, like opening the door, should be
+ * immediate; MQTT, the web UI and logging are deferred, so a slow sink
+ * never holds up the door or the next read. Subscriber tables and the
+ * queue are static, so publishing does not allocate.
+ *
+ * Events are published from the main loop or from the network callbacks,
+ * which the ESP8266 runs between loop() calls; never from an ISR.
+ *
+ * Decisions must always be reported, so the last EVENT_BUS_ACCESS_RESERVE
+ * queue slots are kept for event_access, and an access event that still
+ * finds the queue full is dispatched to its deferred subscribers right
+ * away. Other events are dropped instead.
+ */
+class EventBusClass {
+    public:
+    /**
+     * @return false if type already has EVENT_BUS_SUBSCRIBERS subscribers
+     */
+    bool subscribe(EventType type, EventHandler handler, bool immediately = false);
+
+    /**
+     * @brief Calls the immediate subscribers and queues the event for the
+     * deferred ones.
+     *
+     * @return false if the event had to be dropped because the queue was
+     * full; never for event_access
+     */
+    bool publish(BusEvent& event);
+
+    /**
+     * @brief Dispatches up to EVENT_BUS_BURST queued events.
+     */
+    void loop();
+
+    uint16_t queueDepth() const { return queue.size(); }
+
+    struct Stats {
+        unsigned long published = 0;
+        unsigned long dropped = 0;      // the queue was full
+        unsigned long direct = 0;       // dispatched from publish(), the queue was full
+        unsigned long dispatched = 0;
+        unsigned long totalMicros = 0;  // time in the deferred subscribers
+        unsigned long maxMicros = 0;
+        unsigned long maxWaitMicros = 0; // time in the queue
+    } stats[EVENT_TYPES];
+
+    static const char* typeName(EventType type);
+
+    private:
+    struct Table {
+        EventHandler handlers[EVENT_BUS_SUBSCRIBERS] = {};
+        uint8_t count = 0;
+    };
+
+    void dispatch(const BusEvent& event);
+
+    Table immediate[EVENT_TYPES];
+    Table deferred[EVENT_TYPES];
+    SpscRing<BusEvent, EVENT_BUS_QUEUE_SIZE> queue;
+};
+
+extern EventBusClass EventBus;
+
+#endif
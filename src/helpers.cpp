@@ -21,6 +21,79 @@ void ICACHE_FLASH_ATTR parseBytes(const char *str, char sep, byte *bytes, int ma
 	}
 }
 
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len)
+{
+	crc = ~crc;
+	while (len--)
+	{
+		crc ^= *data++;
+		for (uint8_t k = 0; k < 8; k++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+static int base64Value(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return -1;
+}
+
+size_t base64Decode(const char *in, uint8_t *out, size_t maxLen)
+{
+	size_t len = 0;
+	uint32_t bits = 0;
+	int count = 0;
+	for (; *in; in++)
+	{
+		int v = base64Value(*in);
+		if (v < 0)
+		{
+			break;
+		}
+		bits = (bits << 6) | v;
+		if (++count == 4)
+		{
+			if (len + 3 > maxLen)
+			{
+				return 0;
+			}
+			out[len++] = bits >> 16;
+			out[len++] = bits >> 8;
+			out[len++] = bits;
+			bits = 0;
+			count = 0;
+		}
+	}
+
+	// a trailing group of 2 or 3 characters holds 1 or 2 bytes
+	if (count > 1)
+	{
+		if (len + count - 1 > maxLen)
+		{
+			return 0;
+		}
+		bits <<= 6 * (4 - count);
+		out[len++] = bits >> 16;
+		if (count == 3)
+		{
+			out[len++] = bits >> 8;
+		}
+	}
+	return len;
+}
+
 // String ICACHE_FLASH_ATTR generateUid(int type, int length)
 // {
 
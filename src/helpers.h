@@ -5,12 +5,33 @@
 
 #include "Arduino.h"
 #include <FS.h>
+
+// config, logs and user records all live on the same flash file system
+#ifdef USE_LITTLEFS
+#include <LittleFS.h>
+#define FILESYSTEM LittleFS
+#else
+#define FILESYSTEM SPIFFS
+#endif
 // #include <TimeLib.h>
 // #include <Strings.h>
 // #include <IPAddress.h>
 
 // String printIP(IPAddress adress);
 void parseBytes(const char *str, char sep, byte *bytes, int maxBytes, int base);
+
+/**
+ * @brief CRC-32 (IEEE 802.3), continuing from crc. Pass 0 to start.
+ */
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Decodes base64 text, stopping at the first character that is not
+ * part of the alphabet or padding.
+ *
+ * @return number of bytes written to out, 0 if they would not fit
+ */
+size_t base64Decode(const char *in, uint8_t *out, size_t maxLen);
 // String generateUid(int type = 0, int length = 12);
 
 /**
@@ -0,0 +1,798 @@
+#include "logstore.h"
+#include "helpers.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1                  // offset 4 is inside the file header
+#define SLOT_NEXT_FILE 0x80000000
+#define SLOT_TAG_MASK 0x7FF00000
+#define SLOT_OFFSET_MASK 0x000FFFFF
+
+#define SLOT_OFFSET(s) (((s) & SLOT_OFFSET_MASK) << 2)
+#define SLOT_IN_NEXT(s) (((s) & SLOT_NEXT_FILE) != 0)
+#define SLOT_USED(s) ((s) > SLOT_DELETED)
+
+/**
+ * @brief Print sink over a fixed buffer, used to build a record value in RAM
+ * before its CRC is known.
+ */
+class BufferPrint : public Print {
+    public:
+	BufferPrint(uint8_t* buf, size_t size)
+	: _buf(buf)
+	, _size(size)
+	, _len(0)
+	{
+	}
+
+	size_t write(uint8_t c) override {
+		if (_len >= _size) {
+			return 0;
+		}
+		_buf[_len++] = c;
+		return 1;
+	}
+
+	size_t write(const uint8_t* data, size_t len) override {
+		if (_len + len > _size) {
+			return 0;
+		}
+		memcpy(_buf + _len, data, len);
+		_len += len;
+		return len;
+	}
+
+	size_t length() const { return _len; }
+
+    private:
+	uint8_t* _buf;
+	size_t _size;
+	size_t _len;
+};
+
+static uint32_t recordCrc(LogRecordHeader header, const char* key, const uint8_t* value) {
+	header.crc = 0;
+	uint32_t crc = crc32Update(0, (const uint8_t*) &header, sizeof(header));
+	crc = crc32Update(crc, (const uint8_t*) key, header.keyLength);
+	return crc32Update(crc, value, header.valueLength);
+}
+
+class LogCredentialCursor : public CredentialCursor {
+    public:
+	LogCredentialCursor(LogCredentialStore& store)
+	: _store(store)
+	, _pos(sizeof(LogStoreHeader))
+	, _inNext(false)
+	, _size(0)
+	{
+		++_store._cursors;
+	}
+
+	~LogCredentialCursor() {
+		--_store._cursors;
+	}
+
+	bool next() override {
+		while (true) {
+			File& f = _inNext ? _store._next : _store._log;
+			uint32_t end = _inNext ? _store._nextSize : _store._logSize;
+			if (_pos >= end) {
+				if (_inNext || !_store._compacting) {
+					return false;
+				}
+				_inNext = true;
+				_pos = sizeof(LogStoreHeader);
+				continue;
+			}
+
+			LogRecordHeader header;
+			char key[LOG_STORE_MAX_KEY + 1];
+			if (!_store.readRecord(f, _pos, header, key)) {
+				return false;
+			}
+			uint32_t offset = _pos;
+			_pos += LogCredentialStore::recordSize(header.keyLength, header.valueLength);
+
+			if (header.type == LOG_RECORD_PUT && _store.isLive(key, header.keyLength, _inNext, offset)) {
+				_credential = key;
+				_size = header.valueLength;
+				return true;
+			}
+		}
+	}
+
+	const String& credential() const override { return _credential; }
+	size_t size() override { return _size; }
+
+    private:
+	LogCredentialStore& _store;
+	uint32_t _pos;
+	bool _inNext;
+	size_t _size;
+	String _credential;
+};
+
+LogCredentialStore::LogCredentialStore(FS& fs, CredentialStore* legacy, const char* path, const char* next)
+: _fs(fs)
+, _legacy(legacy)
+, _path(path)
+, _nextPath(next)
+, _logSize(0)
+, _nextSize(0)
+, _dead(0)
+, _nextDead(0)
+, _count(0)
+, _slots(nullptr)
+, _mask(0)
+, _used(0)
+, _compacting(false)
+, _compactPos(0)
+, _compactStart(0)
+, _cursors(0)
+{
+}
+
+LogCredentialStore::~LogCredentialStore() {
+	if (_log) {
+		_log.close();
+	}
+	if (_next) {
+		_next.close();
+	}
+	delete[] _slots;
+}
+
+uint32_t LogCredentialStore::recordSize(uint8_t keyLength, uint16_t valueLength) {
+	return (sizeof(LogRecordHeader) + keyLength + valueLength + 3) & ~3;
+}
+
+uint32_t LogCredentialStore::hashKey(const char* key, uint8_t keyLength) {
+	uint32_t h = 2166136261u;
+	for (uint8_t i = 0; i < keyLength; i++) {
+		h = (h ^ (uint8_t) key[i]) * 16777619u;
+	}
+	return h;
+}
+
+uint32_t LogCredentialStore::makeSlot(bool next, uint32_t offset, uint32_t hash) {
+	return (next ? SLOT_NEXT_FILE : 0) | (((hash >> 21) << 20) & SLOT_TAG_MASK) | ((offset >> 2) & SLOT_OFFSET_MASK);
+}
+
+File& LogCredentialStore::fileOf(uint32_t slot) {
+	return SLOT_IN_NEXT(slot) ? _next : _log;
+}
+
+bool LogCredentialStore::begin() {
+	if (_log) {
+		_log.close();
+	}
+	if (_next) {
+		_next.close();
+	}
+	delete[] _slots;
+	_slots = nullptr;
+	if (!resize(LOG_STORE_MIN_SLOTS)) {
+		return false;
+	}
+	_count = 0;
+	_dead = 0;
+	_nextDead = 0;
+	_compacting = false;
+
+	// a power cut between removing the old log and renaming the new one
+	if (!_fs.exists(_path) && _fs.exists(_nextPath)) {
+		_fs.rename(_nextPath, _path);
+	}
+
+	if (!openLog()) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not open credential log"));
+		return false;
+	}
+
+	unsigned long start = millis();
+	replay(_log, false, _logSize);
+
+	if (_fs.exists(_nextPath)) {
+		// interrupted compaction: the new file holds copies of old records
+		// and everything written after the compaction started
+		_next = _fs.open(_nextPath, "r+");
+		LogStoreHeader header;
+		if (_next && _next.read((uint8_t*) &header, sizeof(header)) == sizeof(header) &&
+		    header.magic == LOG_STORE_MAGIC && header.version == LOG_STORE_VERSION) {
+			replay(_next, true, _nextSize);
+			_compacting = true;
+			_compactPos = sizeof(LogStoreHeader);
+			_compactStart = millis();
+			DEBUG_SERIAL.println(F("[ INFO ] Resuming credential log compaction"));
+		} else {
+			// nothing was copied before the header was written
+			_next.close();
+			_fs.remove(_nextPath);
+		}
+	}
+
+	DEBUG_SERIAL.printf("[ INFO ] Credential log replayed: %u records, %u bytes, %u dead in %lu ms\n", _count, _logSize, _dead, millis() - start);
+
+	if (_legacy) {
+		import();
+	}
+	return true;
+}
+
+bool LogCredentialStore::createLog(File& f, const char* path) {
+	f = _fs.open(path, "w+");
+	if (!f) {
+		return false;
+	}
+	LogStoreHeader header;
+	header.magic = LOG_STORE_MAGIC;
+	header.version = LOG_STORE_VERSION;
+	header.reserved = 0;
+	if (f.write((const uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		f.close();
+		return false;
+	}
+	f.flush();
+	return true;
+}
+
+bool LogCredentialStore::openLog() {
+	if (_fs.exists(_path)) {
+		_log = _fs.open(_path, "r+");
+		LogStoreHeader header;
+		if (_log && _log.read((uint8_t*) &header, sizeof(header)) == sizeof(header) &&
+		    header.magic == LOG_STORE_MAGIC && header.version == LOG_STORE_VERSION) {
+			return true;
+		}
+		DEBUG_SERIAL.println(F("[ WARN ] Credential log header invalid, starting a new log"));
+		_log.close();
+	}
+	_logSize = sizeof(LogStoreHeader);
+	return createLog(_log, _path);
+}
+
+/**
+ * @brief Applies every valid record of f to the slot table and truncates the
+ * file after the last one.
+ */
+bool LogCredentialStore::replay(File& f, bool next, uint32_t& size) {
+	std::unique_ptr<uint8_t[]> value(new uint8_t[LOG_STORE_MAX_VALUE]);
+	uint32_t end = f.size();
+	uint32_t pos = sizeof(LogStoreHeader);
+
+	while (pos + sizeof(LogRecordHeader) <= end) {
+		LogRecordHeader header;
+		char key[LOG_STORE_MAX_KEY + 1];
+		if (!readRecord(f, pos, header, key)) {
+			break;
+		}
+		uint32_t rec = recordSize(header.keyLength, header.valueLength);
+		if (pos + rec > end || header.valueLength > LOG_STORE_MAX_VALUE) {
+			break;
+		}
+		if (f.read(value.get(), header.valueLength) != header.valueLength ||
+		    recordCrc(header, key, value.get()) != header.crc) {
+			break;
+		}
+
+		apply(header.type, key, header.keyLength, next, pos, rec);
+		pos += rec;
+		yield();
+	}
+
+	if (pos < end) {
+		DEBUG_SERIAL.printf("[ WARN ] Credential log: dropping %u bytes after offset %u\n", end - pos, pos);
+		logStats.recoveredBytes += end - pos;
+		f.truncate(pos);
+	}
+	size = pos;
+	return true;
+}
+
+/**
+ * @brief Moves every record of the legacy store into the log. The legacy
+ * records are only removed once all of them have been appended, so an
+ * interrupted import is simply repeated on the next boot.
+ */
+bool LogCredentialStore::import() {
+	if (!_legacy->begin()) {
+		return false;
+	}
+
+	unsigned long start = millis();
+	uint32_t n = 0;
+	{
+		std::unique_ptr<CredentialCursor> cursor = _legacy->iterate();
+		DynamicJsonDocument json(1024);
+		while (cursor->next()) {
+			json.clear();
+			if (_legacy->getJson(cursor->credential(), json) && put(cursor->credential(), json)) {
+				++n;
+			}
+			yield();
+		}
+	}
+	if (n == 0) {
+		return true;
+	}
+
+	_legacy->clear();
+	logStats.imported += n;
+	DEBUG_SERIAL.printf("[ INFO ] Imported %u records from %s store in %lu ms\n", n, _legacy->name(), millis() - start);
+	return true;
+}
+
+bool LogCredentialStore::readRecord(File& f, uint32_t offset, LogRecordHeader& header, char* key) {
+	if (!f.seek(offset, SeekSet) || f.read((uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		return false;
+	}
+	if (header.magic != LOG_RECORD_MAGIC || header.keyLength == 0 || header.keyLength > LOG_STORE_MAX_KEY ||
+	    (header.type != LOG_RECORD_PUT && header.type != LOG_RECORD_DELETE)) {
+		return false;
+	}
+	if (f.read((uint8_t*) key, header.keyLength) != header.keyLength) {
+		return false;
+	}
+	key[header.keyLength] = '\0';
+	return true;
+}
+
+/**
+ * @brief Appends a record to the file that currently takes writes.
+ * @return offset of the record, 0 on failure
+ */
+uint32_t LogCredentialStore::append(uint8_t type, const char* key, uint8_t keyLength, const uint8_t* value, uint16_t valueLength, bool& next) {
+	next = _compacting;
+	File& f = next ? _next : _log;
+	uint32_t& size = next ? _nextSize : _logSize;
+	uint32_t rec = recordSize(keyLength, valueLength);
+	if (size + rec > LOG_STORE_MAX_SIZE) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Credential log full"));
+		return 0;
+	}
+
+	LogRecordHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = LOG_RECORD_MAGIC;
+	header.type = type;
+	header.keyLength = keyLength;
+	header.valueLength = valueLength;
+	header.crc = recordCrc(header, key, value);
+
+	static const uint8_t padding[3] = {0, 0, 0};
+	uint32_t pad = rec - sizeof(header) - keyLength - valueLength;
+
+	f.seek(size, SeekSet);
+	size_t written = f.write((const uint8_t*) &header, sizeof(header));
+	written += f.write((const uint8_t*) key, keyLength);
+	written += f.write(value, valueLength);
+	written += f.write(padding, pad);
+	f.flush();
+
+	if (written != rec) {
+		// drop the partial record so the next append starts clean
+		f.truncate(size);
+		return 0;
+	}
+
+	uint32_t offset = size;
+	size += rec;
+	return offset;
+}
+
+void LogCredentialStore::addDead(uint32_t slot) {
+	LogRecordHeader header;
+	char key[LOG_STORE_MAX_KEY + 1];
+	if (!readRecord(fileOf(slot), SLOT_OFFSET(slot), header, key)) {
+		return;
+	}
+	uint32_t rec = recordSize(header.keyLength, header.valueLength);
+	if (SLOT_IN_NEXT(slot)) {
+		_nextDead += rec;
+	} else {
+		_dead += rec;
+	}
+}
+
+/**
+ * @brief Points the slot of key at a new record, or frees it for a delete.
+ * The record it replaces becomes dead. Delete records are dead as soon as
+ * they are written, as compaction only copies live puts.
+ */
+void LogCredentialStore::apply(uint8_t type, const char* key, uint8_t keyLength, bool next, uint32_t offset, uint32_t size) {
+	uint32_t hash = hashKey(key, keyLength);
+	int32_t i = findSlot(key, keyLength, hash);
+	if (i >= 0) {
+		addDead(_slots[i]);
+	}
+
+	if (type == LOG_RECORD_PUT) {
+		uint32_t slot = makeSlot(next, offset, hash);
+		if (i >= 0) {
+			_slots[i] = slot;
+		} else if (insertSlot(hash, slot)) {
+			++_count;
+		}
+		return;
+	}
+
+	if (next) {
+		_nextDead += size;
+	} else {
+		_dead += size;
+	}
+	if (i >= 0) {
+		_slots[i] = SLOT_DELETED;
+		--_count;
+	}
+}
+
+bool LogCredentialStore::isLive(const char* key, uint8_t keyLength, bool next, uint32_t offset) {
+	uint32_t hash = hashKey(key, keyLength);
+	int32_t i = findSlot(key, keyLength, hash);
+	return i >= 0 && _slots[i] == makeSlot(next, offset, hash);
+}
+
+/**
+ * @brief Linear probe for key. Slots whose tag matches are confirmed by
+ * reading the key back from flash.
+ */
+int32_t LogCredentialStore::findSlot(const char* key, uint8_t keyLength, uint32_t hash, LogRecordHeader* header) {
+	if (_slots == nullptr) {
+		return -1;
+	}
+
+	uint32_t tag = ((hash >> 21) << 20) & SLOT_TAG_MASK;
+	uint32_t i = hash & _mask;
+	for (uint32_t n = 0; n <= _mask; n++, i = (i + 1) & _mask) {
+		uint32_t slot = _slots[i];
+		if (slot == SLOT_EMPTY) {
+			return -1;
+		}
+		if (!SLOT_USED(slot) || (slot & SLOT_TAG_MASK) != tag) {
+			continue;
+		}
+
+		LogRecordHeader h;
+		char stored[LOG_STORE_MAX_KEY + 1];
+		if (readRecord(fileOf(slot), SLOT_OFFSET(slot), h, stored) &&
+		    h.keyLength == keyLength && memcmp(stored, key, keyLength) == 0) {
+			if (header) {
+				*header = h;
+			}
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool LogCredentialStore::insertSlot(uint32_t hash, uint32_t slot) {
+	// keep the load (including deleted slots) under 3/4
+	if ((_used + 1) * 4 > (_mask + 1) * 3) {
+		uint32_t capacity = _mask + 1;
+		if ((_count + 1) * 2 > capacity) {
+			capacity *= 2;
+		}
+		if (!resize(capacity)) {
+			return false;
+		}
+	}
+
+	uint32_t i = hash & _mask;
+	while (SLOT_USED(_slots[i])) {
+		i = (i + 1) & _mask;
+	}
+	if (_slots[i] == SLOT_EMPTY) {
+		++_used;
+	}
+	_slots[i] = slot;
+	return true;
+}
+
+/**
+ * @brief Rehashes the live slots into a table of the given capacity (a power
+ * of two). Only the tags are kept in RAM, so each key is read back.
+ */
+bool LogCredentialStore::resize(uint32_t capacity) {
+	uint32_t* slots = new (std::nothrow) uint32_t[capacity];
+	if (slots == nullptr) {
+		DEBUG_SERIAL.printf("[ ERROR ] Credential log: no memory for %u slots\n", capacity);
+		return false;
+	}
+	memset(slots, 0, capacity * sizeof(uint32_t));
+
+	uint32_t* old = _slots;
+	uint32_t oldCapacity = old ? _mask + 1 : 0;
+	_slots = slots;
+	_mask = capacity - 1;
+	_used = 0;
+
+	for (uint32_t j = 0; j < oldCapacity; j++) {
+		if (!SLOT_USED(old[j])) {
+			continue;
+		}
+		LogRecordHeader header;
+		char key[LOG_STORE_MAX_KEY + 1];
+		if (!readRecord(fileOf(old[j]), SLOT_OFFSET(old[j]), header, key)) {
+			continue;
+		}
+		uint32_t i = hashKey(key, header.keyLength) & _mask;
+		while (_slots[i] != SLOT_EMPTY) {
+			i = (i + 1) & _mask;
+		}
+		_slots[i] = old[j];
+		++_used;
+	}
+
+	delete[] old;
+	return true;
+}
+
+int LogCredentialStore::get(const String& credential, UserRecord& user) {
+	unsigned long start = micros();
+	LogRecordHeader header;
+	int32_t i = findSlot(credential.c_str(), credential.length(), hashKey(credential.c_str(), credential.length()), &header);
+	if (i < 0) {
+		recordGet(start, false);
+		return 1;
+	}
+
+	// the JSON side blob is not needed for a decision
+	uint8_t value[sizeof(UserRecordHeader) + 256];
+	size_t len = header.valueLength < sizeof(value) ? header.valueLength : sizeof(value);
+	File& f = fileOf(_slots[i]);
+	if (f.read(value, len) != len) {
+		recordGet(start, true);
+		return 2;
+	}
+
+	int error = readUserRecord(value, len, credential, user);
+	recordGet(start, true);
+	return error;
+}
+
+bool LogCredentialStore::getJson(const String& credential, JsonDocument& json, size_t* size) {
+	LogRecordHeader header;
+	int32_t i = findSlot(credential.c_str(), credential.length(), hashKey(credential.c_str(), credential.length()), &header);
+	if (i < 0) {
+		return false;
+	}
+
+	std::unique_ptr<uint8_t[]> value(new uint8_t[header.valueLength]);
+	if (fileOf(_slots[i]).read(value.get(), header.valueLength) != header.valueLength) {
+		return false;
+	}
+	if (size) {
+		*size = header.valueLength;
+	}
+	return readUserRecordJson(value.get(), header.valueLength, credential, json);
+}
+
+bool LogCredentialStore::put(const String& credential, const JsonDocument& json) {
+	if (_slots == nullptr || credential.length() == 0 || credential.length() > LOG_STORE_MAX_KEY) {
+		return false;
+	}
+
+	std::unique_ptr<uint8_t[]> value(new uint8_t[LOG_STORE_MAX_VALUE]);
+	BufferPrint out(value.get(), LOG_STORE_MAX_VALUE);
+	size_t len = writeUserRecord(out, json);
+	if (len == 0) {
+		return false;
+	}
+
+	bool next;
+	uint32_t offset = append(LOG_RECORD_PUT, credential.c_str(), credential.length(), value.get(), len, next);
+	if (offset == 0) {
+		return false;
+	}
+	apply(LOG_RECORD_PUT, credential.c_str(), credential.length(), next, offset, recordSize(credential.length(), len));
+	++stats.puts;
+
+	if (!_compacting && _logSize >= LOG_STORE_COMPACT_MIN && _dead * 100 >= _logSize * LOG_STORE_COMPACT_RATIO) {
+		startCompaction();
+	}
+	return true;
+}
+
+bool LogCredentialStore::remove(const String& credential) {
+	uint32_t hash = hashKey(credential.c_str(), credential.length());
+	if (findSlot(credential.c_str(), credential.length(), hash) < 0) {
+		return false;
+	}
+
+	bool next;
+	uint32_t offset = append(LOG_RECORD_DELETE, credential.c_str(), credential.length(), nullptr, 0, next);
+	if (offset == 0) {
+		return false;
+	}
+	apply(LOG_RECORD_DELETE, credential.c_str(), credential.length(), next, offset, recordSize(credential.length(), 0));
+	++stats.removes;
+
+	if (!_compacting && _logSize >= LOG_STORE_COMPACT_MIN && _dead * 100 >= _logSize * LOG_STORE_COMPACT_RATIO) {
+		startCompaction();
+	}
+	return true;
+}
+
+bool LogCredentialStore::clear() {
+	if (_compacting) {
+		_next.close();
+		_fs.remove(_nextPath);
+		_compacting = false;
+	}
+
+	stats.removes += _count;
+	if (_slots) {
+		memset(_slots, 0, (_mask + 1) * sizeof(uint32_t));
+	}
+	_count = 0;
+	_used = 0;
+	_dead = 0;
+	_nextDead = 0;
+
+	_logSize = sizeof(LogStoreHeader);
+	return _log.truncate(_logSize);
+}
+
+void LogCredentialStore::destroy() {
+	clear();
+	_log.close();
+	_fs.remove(_path);
+	delete[] _slots;
+	_slots = nullptr;
+}
+
+/**
+ * @brief Drops the slot table first so nothing refers to the log any more,
+ * then cuts the log down LOG_STORE_RECLAIM_STEP bytes at a time. Freeing a
+ * large file in one go can stall the loop for as long as a mass delete.
+ */
+bool LogCredentialStore::reclaim() {
+	if (_compacting) {
+		_next.close();
+		_fs.remove(_nextPath);
+		_compacting = false;
+	}
+	if (_slots) {
+		stats.removes += _count;
+		delete[] _slots;
+		_slots = nullptr;
+		_mask = 0;
+		_count = 0;
+		_used = 0;
+		_dead = 0;
+		_nextDead = 0;
+	}
+	if (!_log) {
+		return true;
+	}
+
+	if (_logSize > sizeof(LogStoreHeader) + LOG_STORE_RECLAIM_STEP) {
+		_logSize -= LOG_STORE_RECLAIM_STEP;
+	} else {
+		_logSize = sizeof(LogStoreHeader);
+	}
+	_log.truncate(_logSize);
+	if (_logSize > sizeof(LogStoreHeader)) {
+		return false;
+	}
+	_log.close();
+	return true;
+}
+
+std::unique_ptr<CredentialCursor> LogCredentialStore::iterate() {
+	return std::unique_ptr<CredentialCursor>(new LogCredentialCursor(*this));
+}
+
+bool LogCredentialStore::info(size_t& used, size_t& total) {
+	FSInfo fsinfo;
+	if (!_fs.info(fsinfo)) {
+		return false;
+	}
+	used = fsinfo.usedBytes;
+	total = fsinfo.totalBytes;
+	return true;
+}
+
+void LogCredentialStore::startCompaction() {
+	_fs.remove(_nextPath);
+	if (!createLog(_next, _nextPath)) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not start credential log compaction"));
+		return;
+	}
+	_nextSize = sizeof(LogStoreHeader);
+	_nextDead = 0;
+	_compactPos = sizeof(LogStoreHeader);
+	_compactStart = millis();
+	_compacting = true;
+	DEBUG_SERIAL.printf("[ INFO ] Compacting credential log: %u of %u bytes dead\n", _dead, _logSize);
+}
+
+/**
+ * @brief Copies live records from the log to the new file until the slice
+ * budget is spent. Paused while a cursor is open, as records moving between
+ * the files would be visited twice.
+ */
+void LogCredentialStore::loop() {
+	if (!_compacting || _cursors > 0) {
+		return;
+	}
+
+	++logStats.slices;
+	unsigned long start = micros();
+	while (micros() - start < LOG_STORE_SLICE_MICROS) {
+		if (_compactPos >= _logSize) {
+			finishCompaction();
+			return;
+		}
+
+		LogRecordHeader header;
+		char key[LOG_STORE_MAX_KEY + 1];
+		if (!readRecord(_log, _compactPos, header, key)) {
+			DEBUG_SERIAL.printf("[ ERROR ] Credential log unreadable at %u\n", _compactPos);
+			return;
+		}
+		uint32_t offset = _compactPos;
+		uint32_t rec = recordSize(header.keyLength, header.valueLength);
+		_compactPos += rec;
+
+		if (header.type != LOG_RECORD_PUT) {
+			continue;
+		}
+
+		uint32_t hash = hashKey(key, header.keyLength);
+		int32_t i = findSlot(key, header.keyLength, hash);
+		if (i < 0 || _slots[i] != makeSlot(false, offset, hash)) {
+			continue;
+		}
+
+		std::unique_ptr<uint8_t[]> value(new uint8_t[header.valueLength]);
+		_log.seek(offset + sizeof(header) + header.keyLength, SeekSet);
+		if (_log.read(value.get(), header.valueLength) != header.valueLength) {
+			return;
+		}
+
+		bool next;
+		uint32_t copied = append(LOG_RECORD_PUT, key, header.keyLength, value.get(), header.valueLength, next);
+		if (copied == 0) {
+			_compactPos = offset;
+			return;
+		}
+		_slots[i] = makeSlot(true, copied, hash);
+	}
+}
+
+void LogCredentialStore::finishCompaction() {
+	_log.close();
+	_next.close();
+	_fs.remove(_path);
+	_fs.rename(_nextPath, _path);
+	_log = _fs.open(_path, "r+");
+
+	for (uint32_t i = 0; i <= _mask; i++) {
+		if (SLOT_USED(_slots[i])) {
+			_slots[i] &= ~SLOT_NEXT_FILE;
+		}
+	}
+
+	DEBUG_SERIAL.printf("[ INFO ] Credential log compacted from %u to %u bytes in %lu ms\n", _logSize, _nextSize, millis() - _compactStart);
+	_logSize = _nextSize;
+	_dead = _nextDead;
+	_nextSize = 0;
+	_nextDead = 0;
+	_compacting = false;
+	++logStats.compactions;
+	logStats.lastCompactMillis = millis() - _compactStart;
+}
+
+void LogCredentialStore::status(JsonObject& out) {
+	out["log_bytes"] = _logSize + _nextSize;
+	out["dead_bytes"] = _dead + _nextDead;
+	out["slots"] = _slots ? _mask + 1 : 0;
+	out["compacting"] = _compacting;
+	out["compactions"] = logStats.compactions;
+	out["last_compact_ms"] = logStats.lastCompactMillis;
+	out["recovered_bytes"] = logStats.recoveredBytes;
+	out["imported"] = logStats.imported;
+}
@@ -0,0 +1,156 @@
+#ifndef logstore_h
+#define logstore_h
+
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "credentialstore.h"
+
+#define LOG_STORE_FILE "/creds.log"
+#define LOG_STORE_NEXT "/creds.new"
+#define LOG_STORE_FILE_B "/credsb.log"
+#define LOG_STORE_NEXT_B "/credsb.new"
+#define LOG_STORE_MAGIC 0x474F4C43 // "CLOG"
+#define LOG_STORE_VERSION 1
+#define LOG_STORE_MAX_KEY 32
+#define LOG_STORE_MAX_VALUE 1024
+#define LOG_STORE_MIN_SLOTS 256
+#define LOG_STORE_MAX_SIZE 0x400000       // offsets are kept in 20 bits of 4-byte units
+#define LOG_STORE_COMPACT_RATIO 50        // percent of dead bytes that starts a compaction
+#define LOG_STORE_COMPACT_MIN 16384       // logs smaller than this (bytes) are never compacted
+#define LOG_STORE_SLICE_MICROS 2000       // time budget of one compaction slice in loop()
+#define LOG_STORE_RECLAIM_STEP 16384      // bytes cut from the end of the log per reclaim slice
+
+#define LOG_RECORD_MAGIC 0xA5
+#define LOG_RECORD_PUT 1
+#define LOG_RECORD_DELETE 2
+
+struct __attribute__((packed)) LogStoreHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+};
+
+/**
+ * @brief Header of every record appended to the log. It is followed by
+ * keyLength bytes of credential and valueLength bytes of binary user record
+ * (see userrecord.h), then padded to a multiple of 4 bytes.
+ *
+ * The CRC covers the header (with crc set to 0), the key and the value, so
+ * a record torn by a power cut is detected when the log is replayed.
+ */
+struct __attribute__((packed)) LogRecordHeader {
+    uint8_t magic;
+    uint8_t type;
+    uint8_t keyLength;
+    uint8_t reserved;
+    uint16_t valueLength;
+    uint16_t reserved2;
+    uint32_t crc;
+};
+
+/**
+ * @brief Append-only credential store.
+ *
+ * Puts and deletes are appended to a single log file, so a resync is a
+ * sequential write instead of thousands of file creations. An open
+ * addressing table in RAM maps each live credential to its latest record
+ * (4 bytes per slot), so a lookup costs one probe and one read.
+ *
+ * Overwritten and deleted records stay in the log as dead bytes. Once they
+ * reach LOG_STORE_COMPACT_RATIO percent of the log, live records are copied
+ * to LOG_STORE_NEXT a slice at a time from loop(); new writes go to that
+ * file while compaction runs. When the copy is complete the new file
+ * replaces the log.
+ *
+ * On begin() the log is replayed and truncated after the last record with a
+ * valid CRC. If a compaction was interrupted, both files are replayed in
+ * order and the compaction resumes.
+ */
+class LogCredentialStore : public CredentialStore {
+    public:
+    /**
+     * @param legacy records found in this store are moved into the log by
+     * begin(), so devices keep their database when switching backends
+     */
+    LogCredentialStore(FS& fs, CredentialStore* legacy = nullptr, const char* path = LOG_STORE_FILE, const char* next = LOG_STORE_NEXT);
+    ~LogCredentialStore();
+
+    const char* name() const override { return "log"; }
+    bool begin() override;
+    int get(const String& credential, UserRecord& user) override;
+    bool getJson(const String& credential, JsonDocument& json, size_t* size = nullptr) override;
+    bool put(const String& credential, const JsonDocument& json) override;
+    bool remove(const String& credential) override;
+    bool clear() override;
+    size_t count() override { return _count; }
+    std::unique_ptr<CredentialCursor> iterate() override;
+    bool info(size_t& used, size_t& total) override;
+    void loop() override;
+    void status(JsonObject& out) override;
+    bool reclaim() override;
+
+    /**
+     * @brief Closes and deletes the log files.
+     */
+    void destroy();
+
+    bool compacting() const { return _compacting; }
+
+    struct LogStats {
+        unsigned long compactions = 0;
+        unsigned long slices = 0;
+        unsigned long lastCompactMillis = 0;
+        unsigned long recoveredBytes = 0;
+        unsigned long imported = 0;
+    } logStats;
+
+    private:
+    FS& _fs;
+    CredentialStore* _legacy;
+    const char* _path;
+    const char* _nextPath;
+    File _log;
+    File _next;
+    uint32_t _logSize;
+    uint32_t _nextSize;
+    uint32_t _dead;
+    uint32_t _nextDead;
+    uint32_t _count;
+
+    uint32_t* _slots;
+    uint32_t _mask;
+    uint32_t _used;
+
+    bool _compacting;
+    uint32_t _compactPos;
+    unsigned long _compactStart;
+    unsigned int _cursors;
+
+    bool openLog();
+    bool createLog(File& f, const char* path);
+    bool replay(File& f, bool next, uint32_t& size);
+    bool import();
+
+    bool readRecord(File& f, uint32_t offset, LogRecordHeader& header, char* key);
+    uint32_t append(uint8_t type, const char* key, uint8_t keyLength, const uint8_t* value, uint16_t valueLength, bool& next);
+    void apply(uint8_t type, const char* key, uint8_t keyLength, bool next, uint32_t offset, uint32_t size);
+    bool isLive(const char* key, uint8_t keyLength, bool next, uint32_t offset);
+
+    int32_t findSlot(const char* key, uint8_t keyLength, uint32_t hash, LogRecordHeader* header = nullptr);
+    bool insertSlot(uint32_t hash, uint32_t slot);
+    bool resize(uint32_t capacity);
+    File& fileOf(uint32_t slot);
+    void addDead(uint32_t slot);
+
+    void startCompaction();
+    void finishCompaction();
+
+    static uint32_t recordSize(uint8_t keyLength, uint16_t valueLength);
+    static uint32_t hashKey(const char* key, uint8_t keyLength);
+    static uint32_t makeSlot(bool next, uint32_t offset, uint32_t hash);
+
+    friend class LogCredentialCursor;
+};
+
+#endif
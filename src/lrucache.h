@@ -0,0 +1,117 @@
+#ifndef lrucache_h
+#define lrucache_h
+
+#include <Arduino.h>
+
+/**
+ * @brief Fixed-capacity least-recently-used cache keyed by credential key.
+ *
+ * Slots are statically sized and searched linearly, which is cheaper than a
+ * hash map for the few dozen entries that fit in RAM on the ESP8266. Keys are
+ * integers, so a lookup compares no strings and nothing is allocated.
+ *
+ * @tparam T value type, must be copy assignable
+ * @tparam N number of slots
+ */
+template <typename T, size_t N>
+class LruCache {
+    public:
+    LruCache() : _tick(0) { clear(); }
+
+    /**
+     * @brief Returns the cached value and marks it most recently used, or
+     * nullptr on a miss.
+     */
+    T* get(uint64_t key) {
+        int i = find(key);
+        if (i < 0) {
+            ++stats.misses;
+            return nullptr;
+        }
+        ++stats.hits;
+        _slots[i].used = ++_tick;
+        return &_slots[i].value;
+    }
+
+    /**
+     * @brief Inserts or replaces a value, evicting the least recently used
+     * slot when full.
+     */
+    void put(uint64_t key, const T& value) {
+        int i = find(key);
+        if (i < 0) {
+            i = 0;
+            for (size_t j = 0; j < N; j++) {
+                if (!_slots[j].valid) {
+                    i = j;
+                    break;
+                }
+                if (_slots[j].used < _slots[i].used) {
+                    i = j;
+                }
+            }
+            if (_slots[i].valid) {
+                ++stats.evictions;
+            }
+        }
+        _slots[i].key = key;
+        _slots[i].value = value;
+        _slots[i].used = ++_tick;
+        _slots[i].valid = true;
+    }
+
+    bool invalidate(uint64_t key) {
+        int i = find(key);
+        if (i < 0) {
+            return false;
+        }
+        _slots[i].valid = false;
+        ++stats.invalidations;
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < N; i++) {
+            _slots[i].valid = false;
+        }
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (size_t i = 0; i < N; i++) {
+            n += _slots[i].valid ? 1 : 0;
+        }
+        return n;
+    }
+
+    size_t capacity() const { return N; }
+
+    struct Stats {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long evictions = 0;
+        unsigned long invalidations = 0;
+    } stats;
+
+    private:
+    struct Slot {
+        uint64_t key;
+        uint32_t used;
+        bool valid;
+        T value;
+    };
+
+    Slot _slots[N];
+    uint32_t _tick;
+
+    int find(uint64_t key) const {
+        for (size_t i = 0; i < N; i++) {
+            if (_slots[i].valid && _slots[i].key == key) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+#endif
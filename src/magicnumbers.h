@@ -13,6 +13,14 @@
 #define MIN_NTP_TIME 1600000000
 #define COOLDOWN_MILIS 2000          // Milliseconds the RFID reader will be blocked between inputs
 #define KEYBOARD_TIMEOUT_MILIS 10000 // timeout in milis for keyboard input
+#define LOOKUP_DELAY 950             // default upper bound (ms) of the wait for a remote lookup
+#define LOOKUP_MIN_DELAY 50          // default lower bound (ms) of the wait for a remote lookup
+#define LOOKUP_PERCENTILE 95         // default percentile of recent round trips used as the wait
+#define LOOKUP_MIN_SAMPLES 8         // with fewer round trips measured the upper bound is used
+#define COOL_DOWN_DELAY 1500         // default time (ms) after a decision before the same card is decided again
+#define DUPLICATE_READ_DELAY 3000    // default time (ms) in which another read of the same card is ignored
+#define WIEGAND_MIN_TIME 2100        // default minimum time (us) between D0/D1 edges
+#define WIEGAND_MAX_MIN_TIME 10000   // upper bound (us) of config.wiegandMinTime
 
 // user related numbers
 
@@ -30,6 +38,9 @@
 // hardware defines
 
 #define MAX_NUM_RELAYS 4
+#define WIEGAND_MAX_READERS 2
+#define WIEGAND_D0_PIN 13 // default D0 pin of the first Wiegand reader
+#define WIEGAND_D1_PIN 12 // default D1 pin of the first Wiegand reader
 
 #define LOCKTYPE_MOMENTARY 0
 #define LOCKTYPE_CONTINUOUS 1
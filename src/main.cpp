@@ -56,6 +56,11 @@ SOFTWARE.
 #include "relay.h"
 #include "door.h"
 #include "accesscontrol.h"
+#include "pn532reader.h"
+#include "rdm6300reader.h"
+#include "credentialindex.h"
+#include "credentialblob.h"
+#include "eventbus.h"
 
 #define DEBUG_SERIAL if(DEBUG)Serial
 
@@ -124,7 +129,6 @@ unsigned long lastbeat = 0;
 
 
 Door *door = nullptr;
-Bounce *openLockButton = nullptr;
 BounceWithCB *doorStatusPin = nullptr;
 Relay *relayLock = nullptr;
 Relay *relayGreen = nullptr;
@@ -132,10 +136,6 @@ MqttDatabaseSender *mqttDbSender = nullptr;
 
 bool networkFirstUp = false;
 
-// relay specific variables
-bool activateRelay[MAX_NUM_RELAYS] = {false, false, false, false};
-bool deactivateRelay[MAX_NUM_RELAYS] = {false, false, false, false};
-
 #include "led.esp"
 #include "beeper.esp"
 #include "wsResponses.esp"
@@ -151,49 +151,69 @@ bool deactivateRelay[MAX_NUM_RELAYS] = {false, false, false, false};
  * This implements "on-demand" lookup for cases where the local lookup results in
  * access denied
  * 
- * @param uid RFID fob value ASCII decimal format
+ * @param key credential key of the scan
+ * @return the request ID the reply will carry
  */
-void armRemoteLookup(String uid);
+uint32_t armRemoteLookup(CredentialKey key);
 
 // @{
 /**
- * @brief Callback from AccessContoller when it is determined the user is 
- * authorized. This will trigger the MQTT logging message and trigger the
- * door activation function.
+ * @brief Immediate event_access subscriber: opens the door on a granted
+ * scan before any deferred subscriber has run.
  * 
- * @param result Result to report
- * @param detail Random details of how the result was obtained
- * @param credential The RFID fob (or other) credential used
- * @param name The name of individual, if available
+ * @param event The decision: result, reason, credential, reader and name
  */
-void accessGranted_wrapper(AccessResult result, String detail, String credential, String name)
+void openDoorOnGranted(const BusEvent& event)
 {
-	DEBUG_SERIAL.printf("[ INFO ] Access granted: %s\n", detail.c_str());
-	DEBUG_SERIAL.printf("Wi-Fi connected: %d, NTP timer: %d, MQTT timer: %d\n", WiFi.isConnected(), NTPUpdateTimer.active(), mqttReconnectTimer.active());
-	DEBUG_SERIAL.println((unsigned long) mqttReconnectTimer._timer);
+	// the exit button has opened the door already
+	if (event.scan.result == granted && event.scan.source != source_button && door) {
+		door->activate();
+	}
+}
 
-	mqttPublishAccess(now(), result, detail, credential, name);
-	door->activate();
+/**
+ * @brief Opens the door on a press of the exit button, before it is reported.
+ */
+void openDoorOnButton()
+{
+	if (door) {
+		door->activate();
+	}
 }
 
 /**
- * @see accessGranted_wrapper
+ * @brief Deferred event_access subscriber: reports the decision over MQTT
+ * and in the latest log.
  */
-void accessDenied_wrapper(AccessResult result, String detail, String credential, String name)
+void reportAccess(const BusEvent& event)
 {
-	DEBUG_SERIAL.printf("[ INFO ] Access denied: %s\n", detail.c_str());
-	DEBUG_SERIAL.printf("Wi-Fi connected: %d, NTP timer: %d, MQTT timer: %d\n", WiFi.isConnected(), NTPUpdateTimer.active(), mqttReconnectTimer.active());
-	mqttPublishAccess(now(), result, detail, credential, name);
+	const ScanEvent& scan = event.scan;
+	if (scan.source == source_button) {
+		writeLatest(" ", "Button", 1);
+	}
+	mqttPublishAccess(now(), scan);
+
+#ifdef DEBUG
+	char detail[SCAN_DETAIL_LEN];
+	scanDetail(scan, detail, sizeof(detail));
+	Serial.printf("[ INFO ] Access %s: %s\n", scan.result == granted ? "granted" : "denied", detail);
+	Serial.printf("Wi-Fi connected: %d, NTP timer: %d, MQTT timer: %d\n", WiFi.isConnected(), NTPUpdateTimer.active(), mqttReconnectTimer.active());
+#endif
 }
 // @}
 
 /**
- * @brief Callback from Door to indicate when the lock state has changed
+ * @brief event_relay subscriber, reports when the lock relay state has changed
  * 
- * @param op_state whether the lock relay is locking/locked or unlocking/unlocked
- * @param or_state whether the lock relay is self-timing or in an override state
+ * @param event operation: whether the relay is locking/locked or unlocking/unlocked,
+ * override: whether the relay is self-timing or in an override state
  */
-void onLockChange(Relay::OperationState op_state, Relay::OverrideState or_state) {
+void onLockChange(const BusEvent& event) {
+	if (event.relay.relay != relayLock) {
+		return;
+	}
+	Relay::OperationState op_state = (Relay::OperationState) event.relay.operation;
+	Relay::OverrideState or_state = (Relay::OverrideState) event.relay.override;
 	DEBUG_SERIAL.printf("[ INFO ] Unlock relay: %s (%s)\n", 
 						Relay::OperationState_Label[op_state],
 						Relay::OverrideState_Label[or_state]);
@@ -203,34 +223,99 @@ void onLockChange(Relay::OperationState op_state, Relay::OverrideState or_state)
 }
 
 /**
- * @brief Callback from Door when the door open/closed feedback has changed.
+ * @brief event_door_sensor subscriber, the door open/closed feedback has changed.
  * @note This will be called @b after the debounce logic has run.
  * 
- * @param state whether the door is open or closed
+ * @param event on: whether the door is open or closed
  */
-void onOpenCloseChange(bool state) {
+void onOpenCloseChange(const BusEvent& event) {
 	DEBUG_SERIAL.printf("[ INFO ] Door state: %s\n",
-						state ? "open" : "closed");
-	mqttPublishIo("door_open", String(state ? "true" : "false"));
+						event.on ? "open" : "closed");
+	mqttPublishIo("door_open", String(event.on ? "true" : "false"));
 }
 
+/**
+ * @brief event_relay_test subscriber, the web UI asked to test a relay.
+ * Only the lock relay is handled.
+ */
+void onRelayTest(const BusEvent& event) {
+	if (event.index != 0) {
+		return;
+	}
+	door->activate();
+	mqttPublishIo("lock", "UNLOCKED");
+}
+
+
+/**
+ * @brief Local lookup backend for AccessControl using the sorted credential
+ * index, then the server-built credential image when one is loaded.
+ * Credentials that cannot be indexed fall back to the credential store.
+ *
+ * @param key credential key of the scan
+ * @param entry populated with the indexed fields when found
+ * @return 0 if found, 1 if not found, -1 if the index cannot answer
+ */
+int lookupIndexed(CredentialKey key, CredentialIndexEntry& entry) {
+	// records added with db/add since the image was built take precedence
+	int found = CredentialIndex.find(key, entry);
+	if (found != 0 && CredentialBlob.find(key, entry) == 0) {
+		found = 0;
+	}
+	return found;
+}
+
+/**
+ * @brief Fills the enrolled filter from the credential store and the
+ * credential image.
+ */
+void rebuildEnrolledFilter() {
+	EnrolledFilter.rebuild(Credentials);
+
+	char credential[CREDENTIAL_TEXT_LEN];
+	CredentialIndexEntry entry;
+	for (uint32_t i = 0; i < CredentialBlob.slots(); i++) {
+		if (CredentialBlob.entryAt(i, entry) && entry.key != CREDENTIAL_BLOB_EMPTY_KEY) {
+			credentialToText(entry.key, credential);
+			EnrolledFilter.add(credential);
+		}
+		yield();
+	}
+}
 
-static String localUid;
+/**
+ * @brief Asks the server for the record of key with a notify/db/lookup request. The reply
+ * is matched to the session that asked by its request ID.
+ * 
+ * @param key 
+ */
+uint32_t armRemoteLookup(CredentialKey key) {
+	return RemoteLookup.request(key);
+}
 
 /**
- * @brief Call this to copy the uid and allow matching against new records that arrive.
+ * @brief Called when a db/lookup reply is received over MQTT. A reply to a pending request
+ * completes the wait_remote state of its session right away; a reply saying the credential
+ * is unknown is decided as unrecognized.
  * 
- * @param uid 
+ * @param payload A reference to the MQTT JSON payload
  */
-void armRemoteLookup(String uid) {
-	localUid = uid;
-	
+void onLookupReply(const JsonDocument& payload) {
+	const char* credential = payload["credential"];
+	uint32_t request = payload["request"] | 0;
+	if (!RemoteLookup.complete(request, credential)) {
+		return;
+	}
+	CredentialKey key;
+	credentialFromText(credential, key);
+	if (!AccessControl.completeRemote(request, key, (payload["found"] | false) ? &payload : nullptr)) {
+		RemoteLookup.late();
+	}
 }
 
 /**
- * @brief Called when a ADD_UID message is received over MQTT. If the AccessControl object is
- * in the `wait_remote` state, then this will copy over the relevent data from the MQTT message to the
- * AccessControl record and update the AccessControl state.
+ * @brief Called when a ADD_UID message is received over MQTT. If a session is waiting
+ * for a remote record of this credential, the new record completes it.
  * 
  * @note This @e could be called asynchronously on the via the onMqttMessage() call back, but the
  * current implementation processes the MQTT payloads via the main loop, which is more than fast enough.
@@ -239,22 +324,10 @@ void armRemoteLookup(String uid) {
  * @param payload A reference to the MQTT JSON payload
  */
 void onNewRecord(const String uid, const JsonDocument& payload) {
-	if (!localUid.isEmpty() && AccessControl.state == ControlState::wait_remote) {
-		// this state means that localUid has been set
-		if (uid == localUid) {
-			// set next state asynchronously to stop timeout
-			AccessControl.state = ControlState::process_record_remote;
-			localUid.clear();
-			AccessControl.jsonRecord["username"] = payload["username"].as<char>();
-			AccessControl.jsonRecord["credential"] = payload["credential"].as<char>();
-			AccessControl.jsonRecord["validuntil"] = payload["validuntil"].as<unsigned long>();
-			AccessControl.jsonRecord["validsince"] = payload["validsince"].as<unsigned long>();
-			AccessControl.jsonRecord["is_banned"] = payload["is_banned"].as<unsigned long>();
-		}
-	} else if (AccessControl.state == ControlState::cool_down || AccessControl.state == ControlState::wait_read) {
-		localUid.clear();
+	CredentialKey key;
+	if (credentialFromText(uid.c_str(), key)) {
+		AccessControl.completeRemote(0, key, &payload);
 	}
-
 }
 
 
@@ -291,10 +364,10 @@ void ICACHE_FLASH_ATTR setup()
 #endif
 
 	bootInfo.formatted = true;
-	if (!SPIFFS.begin())
+	if (!FILESYSTEM.begin())
 	{
 		bootInfo.formatted = false;
-		if (SPIFFS.format())
+		if (FILESYSTEM.format())
 		{
 			writeEvent("WARN", "sys", "Filesystem formatted", "");
 		}
@@ -307,21 +380,36 @@ void ICACHE_FLASH_ATTR setup()
 		}
 	}
 
-	if (!SPIFFS.info(bootInfo.fsinfo)) {
-		DEBUG_SERIAL.println(F("[ ERROR ] Failed to retrieve SPIFFS info"));
+	if (!FILESYSTEM.info(bootInfo.fsinfo)) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Failed to retrieve filesystem info"));
 	}
 
 	bootInfo.configured = loadConfiguration();
 
+	if (!Credentials.begin()) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Failed to open credential store"));
+	}
+	DEBUG_SERIAL.printf("[ INFO ] Credential store: %s\n", Credentials.name());
+	CredentialIndex.begin(FILESYSTEM, Credentials);
+	CredentialBlob.begin(FILESYSTEM);
+	rebuildEnrolledFilter();
+
 	ws.setAuthentication(httpUsername, config.httpPass);
 
 	// There is a button marked "OPEN" on the ESP-RFID...
+	// subscribe before the relays and the door report their first state
+	EventBus.subscribe(event_access, openDoorOnGranted, true);
+	EventBus.subscribe(event_access, reportAccess);
+	EventBus.subscribe(event_relay, onLockChange);
+	EventBus.subscribe(event_door_sensor, onOpenCloseChange);
+	EventBus.subscribe(event_relay_test, onRelayTest);
+
 	if (config.openlockpin != 255)
 	{
 		// DEBUG_SERIAL.printf("microseconds: %lu - setting up openLockButton (pin %d)\n", micros(), config.openlockpin);
-		openLockButton = new Bounce();
-		openLockButton->attach(config.openlockpin, INPUT_PULLUP);
-		openLockButton->interval(30);
+		ButtonSource.begin(config.openlockpin);
+		ButtonSource.onPress = openDoorOnButton;
+		CredentialSources.add(&ButtonSource);
 	}
 
 
@@ -330,7 +418,6 @@ void ICACHE_FLASH_ATTR setup()
 		// DEBUG_SERIAL.printf("microseconds: %lu - setting up doorStatusPin (pin %d)\n", micros(), config.doorstatpin);
 		doorStatusPin = new BounceWithCB();
 		doorStatusPin->interval(2000);
-		doorStatusPin->onStateChangeCB = onOpenCloseChange;
 		doorStatusPin->attach(config.doorstatpin, INPUT);
 	}
 
@@ -341,7 +428,6 @@ void ICACHE_FLASH_ATTR setup()
 			(uint8_t)config.relayPin[0],
 			config.relayType[0] ? Relay::ControlType::activeHigh : Relay::ControlType::activeLow,
 			config.activateTime[0]);
-		relayLock->onStateChangeCB = onLockChange;
 	}
 
 	if (config.relayPin[1] != 255 && config.relayPin[1] != config.relayPin[0])
@@ -355,9 +441,21 @@ void ICACHE_FLASH_ATTR setup()
 
 	// DEBUG_SERIAL.printf("microseconds: %lu - setting up reader\n", micros());
 
-	TCMWiegand.begin(13, 12);
-	// pinMode(13, INPUT_PULLUP);
-	// pinMode(12, INPUT_PULLUP);
+	for (int i = 0; i < config.wiegandReaders; i++) {
+		if (config.wiegandD0Pin[i] != 255 && config.wiegandD1Pin[i] != 255) {
+			TCMWiegand[i].begin(i, config.wiegandD0Pin[i], config.wiegandD1Pin[i]);
+			CredentialSources.add(&TCMWiegand[i]);
+		}
+	}
+	if ((config.readertype == READER_PN532 || config.readertype == READER_PN532_RDM6300) && config.pn532SsPin != 255) {
+		Pn532Reader.begin(config.pn532SsPin, config.pn532IrqPin, config.pn532ResetPin, config.pn532AutoPoll);
+		CredentialSources.add(&Pn532Reader);
+	}
+	if (config.rdm6300) {
+		Rdm6300Reader.begin();
+		CredentialSources.add(&Rdm6300Reader);
+	}
+	CredentialSources.add(&VirtualBadge);
 
 	// DEBUG_SERIAL.printf("microseconds: %lu - setting up door\n", micros());
 
@@ -365,10 +463,9 @@ void ICACHE_FLASH_ATTR setup()
 	door->maxOpenTime = config.maxOpenDoorTime;
 	door->begin();
 
-	// These connect AccessControl to Door and mqttClient.
-	AccessControl.accessGranted = accessGranted_wrapper;
-	AccessControl.accessDenied = accessDenied_wrapper;
+	// These connect AccessControl to the local and remote databases.
 	AccessControl.lookupRemote = armRemoteLookup;
+	AccessControl.lookupLocal = lookupIndexed;
 	
 	setupMqtt();
 
@@ -387,29 +484,21 @@ void ICACHE_RAM_ATTR loop()
 	deltaTime = currentMillis - previousLoopMillis;
 	previousLoopMillis = currentMillis;
 
-	if (openLockButton)
-	{
-		openLockButton->update();
-		if (openLockButton->fell())
-		{
-			writeLatest(" ", "Button", 1);
-			mqttPublishAccess(now(), AccessResult::granted, String("N/A"), "Button", " ");
-			// door.activate();
-			activateRelay[0] = true;
-		}
-	}
-
 	ledWifiStatus();
 	ledAccessDeniedOff();
 	beeperBeep();
 	doorbellStatus();
 
-	// Bits are handled asynchronously. The TCMWiegand.loop() checks the bit
-	// count and timing to see if data is available.
-	// The loop will use the 
-	TCMWiegand.loop();
+	// Each reader, the button and the virtual badge take a short step and
+	// queue what they read; e.g. a Wiegand reader checks the bit count and
+	// timing of its frame. AccessControl then decides queued reads in order.
+	CredentialSources.loop();
 	AccessControl.loop();
 
+	// e.g. a slice of credential log compaction
+	Credentials.loop();
+	StagedBuild.loop();
+
 	// Door::update() handles relay and status pin updates
 	bool door_acted = door->update();
 
@@ -418,16 +507,9 @@ void ICACHE_RAM_ATTR loop()
 		mqttPublishIo("Door", String(door->status()));
 	}
 
-	// activateRelay[] is set by:
-	// WebSocket through UI
-	if (activateRelay[0])
-	{
-		door->activate();
-		// if (relayGreen)
-		// 	relayGreen->activate();
-		mqttPublishIo("lock", "UNLOCKED");
-		activateRelay[0] = false;
-	}
+	// reporting of decisions, relay and door changes, and the web UI's
+	// relay tests
+	EventBus.loop();
 
 	// if ((relayLock->state == Relay::OperationState::inactive) &&
 	// 	(relayGreen) &&
@@ -438,9 +520,9 @@ void ICACHE_RAM_ATTR loop()
 
 	if (formatreq) {
 		DEBUG_SERIAL.println(F("[ WARN ] Factory reset initiated..."));
-		SPIFFS.end();
+		FILESYSTEM.end();
 		ws.enable(false);
-		SPIFFS.format();
+		FILESYSTEM.format();
 		ESP.restart();
 	}
 
@@ -476,7 +558,7 @@ void ICACHE_RAM_ATTR loop()
 			mqttPublishShutdown(now(), NTP.getUptimeSec());
 			mqttClient.disconnect();
 		}
-		SPIFFS.end();
+		FILESYSTEM.end();
 		ESP.restart();
 	}
 
@@ -76,6 +76,7 @@ void processMqttMessage(MqttMessage& incomingMessage)
 
 
 		strlcpy(incomingMessage.uid, mqttIncomingJson["credential"], 20);
+		credentialNormalize(incomingMessage.uid);
 		// DEBUG_SERIAL.print("[ INFO ] Adding credential: ");
 		// DEBUG_SERIAL.println(incomingMessage.uid);
 		if (DEBUG && mqttIncomingJson.memoryUsage() > 180) {
@@ -92,7 +93,8 @@ void processMqttMessage(MqttMessage& incomingMessage)
 			return;
 		}
 		DEBUG_SERIAL.print("[ INFO ] Deleting credential: ");
-		strncpy(incomingMessage.uid, mqttIncomingJson["credential"], 20);
+		strlcpy(incomingMessage.uid, mqttIncomingJson["credential"], 20);
+		credentialNormalize(incomingMessage.uid);
 		DEBUG_SERIAL.println(incomingMessage.uid);
 		deleteUserID(incomingMessage.uid);
 		break;
@@ -118,9 +120,28 @@ void processMqttMessage(MqttMessage& incomingMessage)
 		DEBUG_SERIAL.println("[ INFO ] Get DB status");
 		getDbStatus();
 		break;
+	case BENCH_DB:
+		DEBUG_SERIAL.println("[ INFO ] Benchmark credential index");
+		benchmarkIndex();
+		break;
+	case BLOB_DB:
+		receiveCredentialBlob();
+		break;
+	case STAGE_DB:
+		stageDb();
+		break;
+	case LOOKUP_REPLY:
+		onLookupReply(mqttIncomingJson);
+		break;
+	case SET_WIEGAND:
+		setWiegand();
+		break;
+	case SET_BADGE:
+		presentBadge();
+		break;
 	case GET_CONF:
 		DEBUG_SERIAL.println("[ INFO ] Get configuration");
-		f = SPIFFS.open("/config.json", "r");
+		f = FILESYSTEM.open("/config.json", "r");
 		if (f)
 		{
 			int fileSize = f.size();
@@ -159,10 +180,10 @@ MqttDatabaseSender::~MqttDatabaseSender() {
 	delete root;
 	// DEBUG_SERIAL.println("~MqttDatabaseSender");
 	// DEBUG_SERIAL.println((unsigned long) dir);
-	if (dir != nullptr) {
+	if (cursor != nullptr) {
 		FS_IN_USE = false;
-		delete dir;
-		// dir = nullptr;
+		delete cursor;
+		// cursor = nullptr;
 	}
 }
 
@@ -181,13 +202,12 @@ bool MqttDatabaseSender::run() {
 		}
 		FS_IN_USE = true;
 
-		// starting out, open filesystem
-		dir = new Dir;
-		*dir = SPIFFS.openDir("/P/");
-		DEBUG_SERIAL.println((unsigned long) dir);
+		// starting out, open the credential store
+		cursor = Credentials.iterate().release();
+		DEBUG_SERIAL.println((unsigned long) cursor);
 
-		// load first file
-		_available = dir->next();
+		// load first record
+		_available = cursor->next();
 	}
 
 	if (pkt_id == 1) {
@@ -207,26 +227,18 @@ bool MqttDatabaseSender::run() {
 
 			JsonObject item = users.createNestedObject();
 
-			String uid = dir->fileName();
-			uid.remove(0, 3);  // remove "/P/" from filename
+			const String& uid = cursor->credential();
 			item["uid"] = uid;
 
-			File f = SPIFFS.open(dir->fileName(), "r");
-			size_t size = f.size();
+			size_t size = 0;
+			StaticJsonDocument<512> record;
+			Credentials.getJson(uid, record, &size);
 			item["filesize"] = (unsigned) size;
 
-			std::unique_ptr<char[]> buf(new char[size + 1]);
-			f.readBytes(buf.get(), size);
-			f.close();
-
-			// ensure buffer is null terminated
-			buf[size] = '\0';
+			item["record"] = record.as<JsonObject>();
 
-			// presume that file is already JSON
-			item["record"] = serialized(buf.get());
-
-			// prepare for next file
-			_available = dir->next();
+			// prepare for next record
+			_available = cursor->next();
 		}
 
 		(*root)["size"] = i;
@@ -235,12 +247,13 @@ bool MqttDatabaseSender::run() {
 		if (!_available) {
 			// no next file, so we're done
 			// last json payload includes overall data
-			FSInfo fsinfo;
+			size_t used = 0;
+			size_t total = 0;
 
 			(*root)["total"] = count;
-			SPIFFS.info(fsinfo);
-			(*root)["flash_used"] = fsinfo.usedBytes;
-			(*root)["flash_available"] = fsinfo.totalBytes - fsinfo.usedBytes;
+			Credentials.info(used, total);
+			(*root)["flash_used"] = used;
+			(*root)["flash_available"] = total - used;
 			(*root)["complete"] = true;
 		} else {
 			(*root)["complete"] = false;
@@ -280,18 +293,12 @@ bool getUserRecord(String uid, JsonDocument& item) {
 	item["uid"] = uid;
 	item["filename"] = file;
 
-	File f = SPIFFS.open(file, "r");
-	if (f) {
+	size_t size = 0;
+	StaticJsonDocument<512> record;
+	if (Credentials.getJson(uid, record, &size)) {
 		item["result"] = F("found");
-		size_t size = f.size();
 		item["filesize"] = (unsigned) size;
-
-		std::unique_ptr<char[]> buf(new char[size + 1]);
-		f.readBytes(buf.get(), size);
-		buf[size] = '\0'; 		// ensure buffer is null terminated
-		f.close();
-		// presume that file is already JSON
-		item["record"] = serialized(&(buf.get()[0]));
+		item["record"] = record.as<JsonObject>();
 		return true;
 	} else {
 		item["result"] = F("not found");
@@ -320,6 +327,7 @@ void setupMqtt()
 
 	mqttClient.onDisconnect(onMqttDisconnect);
 	mqttClient.onPublish(onMqttPublish);
+	mqttClient.onPublish(&RemoteLookupClass::onMqttPublish);
 	mqttClient.onSubscribe(onMqttSubscribe);
 	mqttClient.onConnect(onMqttConnect);
 	mqttClient.onMessage(onMqttMessage);
@@ -387,12 +395,28 @@ MqttAccessTopic decodeMqttTopic(const char *topic) {
 	} else if (strcmp(subTopic, "db/get") == 0) {
 		DEBUG_SERIAL.println("[ INFO ] db/get");
  		return GET_FULL_DB;
+	} else if (strcmp(subTopic, "db/bench") == 0) {
+		DEBUG_SERIAL.println("[ INFO ] db/bench");
+ 		return BENCH_DB;
+	} else if (strcmp(subTopic, "db/blob") == 0) {
+ 		return BLOB_DB;
+	} else if (strcmp(subTopic, "db/lookup") == 0) {
+ 		return LOOKUP_REPLY;
+	} else if (strcmp(subTopic, "db/stage") == 0) {
+		DEBUG_SERIAL.println("[ INFO ] db/stage");
+ 		return STAGE_DB;
 	} else if (strcmp(subTopic, "set/unlock") == 0) {
 		DEBUG_SERIAL.println("[ INFO ] set/unlock");
  		return UNLOCK;
 	} else if (strcmp(subTopic, "set/lock") == 0) {
 		DEBUG_SERIAL.println("[ INFO ] set/lock");
  		return LOCK;
+	} else if (strcmp(subTopic, "set/wiegand") == 0) {
+		DEBUG_SERIAL.println("[ INFO ] set/wiegand");
+ 		return SET_WIEGAND;
+	} else if (strcmp(subTopic, "set/badge") == 0) {
+		DEBUG_SERIAL.println("[ INFO ] set/badge");
+ 		return SET_BADGE;
 	} else if (strcmp(subTopic, "conf/get") == 0) {
 		DEBUG_SERIAL.println("[ INFO ] conf/get");
 		return GET_CONF;
@@ -613,15 +637,160 @@ void mqttPublishConnect(time_t boot_time)
 
 void mqttPublishHeartbeat(time_t heartbeat, time_t uptime)
 {
-	DynamicJsonDocument root(512);
+	DynamicJsonDocument root(1280 + WIEGAND_MAX_READERS * 512 + CREDENTIAL_SOURCES_MAX * 96 + EVENT_TYPES * 128);
 	String topic("notify/heartbeat");
 	root["time"] = heartbeat;
 	root["uptime"] = uptime;
 	root["free_ram"] = ESP.getFreeHeap();
+
+	JsonObject bloom = root.createNestedObject("enrolled_filter");
+	bloom["bytes"] = EnrolledFilter.sizeBytes();
+	bloom["hashes"] = EnrolledFilter.hashes();
+	bloom["entries"] = EnrolledFilter.stats.entries;
+	bloom["removed"] = EnrolledFilter.stats.removed;
+	bloom["fill"] = EnrolledFilter.fillRatio();
+	bloom["fpr_estimate"] = EnrolledFilter.falsePositiveRate();
+	bloom["checks"] = EnrolledFilter.stats.checks;
+	bloom["negatives"] = EnrolledFilter.stats.negatives;
+	bloom["false_positives"] = EnrolledFilter.stats.falsePositives;
+
+	JsonObject access = root.createNestedObject("access");
+	access["adaptive"] = config.wiegandAdaptive;
+	access["min_time_us"] = config.wiegandMinTime;
+	access["fixed_gap_us"] = WIEGAND_FRAME_GAP;
+	access["decision_p50_us"] = AccessControl.decisionLatency.percentile(50);
+	access["decision_p95_us"] = AccessControl.decisionLatency.percentile(95);
+	access["queue_depth"] = AccessControl.queueDepth();
+	access["queue_max_depth"] = AccessControl.queueStats.maxDepth;
+	access["queued"] = AccessControl.queueStats.queued;
+	access["duplicates"] = AccessControl.queueStats.duplicates;
+	access["queue_dropped"] = AccessControl.queueStats.dropped;
+	access["queue_wait_p50_us"] = AccessControl.queueWait.percentile(50);
+	access["queue_wait_p95_us"] = AccessControl.queueWait.percentile(95);
+	access["hold_ms"] = AccessControlClass::holdTime();
+	access["hold_evictions"] = AccessControl.coolDowns.evictions;
+	access["sessions"] = ACCESS_SESSIONS;
+	access["sessions_busy"] = AccessControl.busySessions();
+	access["sessions_max_busy"] = AccessControl.queueStats.maxBusy;
+	access["overtakes"] = AccessControl.queueStats.overtakes;
+
+	JsonArray sources = root.createNestedArray("sources");
+	for (uint8_t i = 0; i < CredentialSources.size(); i++) {
+		JsonObject source = sources.createNestedObject();
+		source["reader"] = CredentialSources[i]->reader();
+		source["type"] = (int)CredentialSources[i]->type();
+		source["events"] = CredentialSources[i]->events;
+		source["rejected"] = CredentialSources[i]->rejected;
+	}
+
+	JsonObject bus = root.createNestedObject("event_bus");
+	bus["depth"] = EventBus.queueDepth();
+	for (uint8_t i = 0; i < EVENT_TYPES; i++) {
+		const EventBusClass::Stats& stats = EventBus.stats[i];
+		JsonObject type = bus.createNestedObject(EventBusClass::typeName((EventType)i));
+		type["published"] = stats.published;
+		type["dropped"] = stats.dropped;
+		type["direct"] = stats.direct;
+		type["dispatched"] = stats.dispatched;
+		type["avg_us"] = stats.dispatched ? stats.totalMicros / stats.dispatched : 0;
+		type["max_us"] = stats.maxMicros;
+		type["max_wait_us"] = stats.maxWaitMicros;
+	}
+
+	JsonArray readers = root.createNestedArray("wiegand");
+	for (uint8_t i = 0; i < WIEGAND_MAX_READERS; i++) {
+		TCMWiegandClass& reader = TCMWiegand[i];
+		if (!reader.active()) {
+			continue;
+		}
+		JsonObject wiegand = readers.createNestedObject();
+		wiegand["reader"] = reader.id();
+		wiegand["edges"] = reader.stats.edges;
+		wiegand["glitches"] = reader.stats.glitches;
+		wiegand["dropped"] = reader.edgesDropped();
+		wiegand["overflows"] = reader.stats.overflows;
+		wiegand["max_depth"] = reader.stats.maxDepth;
+		wiegand["frames"] = reader.stats.frames;
+		wiegand["undecoded"] = reader.stats.undecoded;
+		wiegand["parity_errors"] = reader.stats.parityErrors;
+		wiegand["keypresses"] = reader.stats.keypresses;
+		wiegand["diagnostics"] = reader.diagnostics.enabled;
+		wiegand["bit_period_us"] = reader.bitPeriod();
+		wiegand["frame_gap_us"] = reader.frameGap();
+		wiegand["learned_bits"] = reader.learnedBits();
+		wiegand["early_frames"] = reader.stats.earlyFrames;
+		wiegand["gap_frames"] = reader.stats.gapFrames;
+		wiegand["early_mistakes"] = reader.stats.earlyMistakes;
+		wiegand["frame_p50_us"] = reader.frameLatency.percentile(50);
+		wiegand["frame_p95_us"] = reader.frameLatency.percentile(95);
+		wiegand["decode_last_us"] = reader.stats.lastDecodeMicros;
+		wiegand["decode_max_us"] = reader.stats.maxDecodeMicros;
+		wiegand["decode_avg_us"] = reader.stats.frames ? reader.stats.totalDecodeMicros / reader.stats.frames : 0;
+	}
+
+	if (Pn532Reader.active()) {
+		JsonObject pn532 = root.createNestedObject("pn532");
+		pn532["reader"] = PN532_READER;
+		pn532["state"] = (int)Pn532Reader.state();
+		pn532["commands"] = Pn532Reader.stats.commands;
+		pn532["timeouts"] = Pn532Reader.stats.timeouts;
+		pn532["errors"] = Pn532Reader.stats.errors;
+		pn532["cards"] = Pn532Reader.stats.cards;
+		pn532["repeats"] = Pn532Reader.stats.repeats;
+		pn532["unsupported"] = Pn532Reader.stats.unsupported;
+		pn532["max_step_us"] = Pn532Reader.stats.maxStepMicros;
+		pn532["read_p50_us"] = Pn532Reader.readLatency.percentile(50);
+		pn532["read_p95_us"] = Pn532Reader.readLatency.percentile(95);
+	}
+
+	if (Rdm6300Reader.active()) {
+		JsonObject rdm6300 = root.createNestedObject("rdm6300");
+		rdm6300["reader"] = RDM6300_READER;
+		rdm6300["frames"] = Rdm6300Reader.frames();
+		rdm6300["errors"] = Rdm6300Reader.errors();
+		rdm6300["repeats"] = Rdm6300Reader.repeats();
+		rdm6300["cards"] = Rdm6300Reader.events;
+	}
+
+	JsonObject remote = root.createNestedObject("remote_lookup");
+	remote["requests"] = RemoteLookup.stats.requests;
+	remote["unsent"] = RemoteLookup.stats.unsent;
+	remote["replies"] = RemoteLookup.stats.replies;
+	remote["late"] = RemoteLookup.stats.late;
+	remote["unmatched"] = RemoteLookup.stats.unmatched;
+	remote["pending"] = RemoteLookup.pending();
+	remote["last_us"] = RemoteLookup.stats.lastMicros;
+	remote["min_us"] = RemoteLookup.stats.minMicros;
+	remote["max_us"] = RemoteLookup.stats.maxMicros;
+	remote["avg_us"] = RemoteLookup.stats.replies ? RemoteLookup.stats.totalMicros / RemoteLookup.stats.replies : 0;
+	remote["samples"] = RemoteLookup.roundTrips.samples();
+	remote["rtt_p50_us"] = RemoteLookup.roundTrips.percentile(50);
+	remote["rtt_pct_us"] = RemoteLookup.roundTrips.percentile(config.lookupPercentile);
+	remote["puback_samples"] = RemoteLookup.pubacks.samples();
+	remote["puback_p50_us"] = RemoteLookup.pubacks.percentile(50);
+	remote["puback_pct_us"] = RemoteLookup.pubacks.percentile(config.lookupPercentile);
+	remote["percentile"] = config.lookupPercentile;
+	remote["timeout_ms"] = RemoteLookup.timeout();
+	remote["min_ms"] = config.lookupMinTime;
+	remote["max_ms"] = config.lookupMaxTime;
+	remote["cool_down_ms"] = config.coolDownTime;
 	// root["id"] = WiFi.localIP().toString();
 	mqttPublishEvent(&root, topic);
 }
 
+/**
+ * @brief Asks the server for the record of a credential that is not in the
+ * local database. The server answers on db/lookup with the same `request`,
+ * the `credential`, `found` and, when found, the db/add record fields.
+ */
+uint16_t mqttPublishLookup(const char* credential, uint32_t request)
+{
+	DynamicJsonDocument root(256);
+	root["credential"] = credential;
+	root["request"] = request;
+	return mqttPublishEvent(&root, String("notify/db/lookup"), 1);
+}
+
 void mqttPublishShutdown(time_t heartbeat, time_t uptime) {
 	DynamicJsonDocument root(512);
 	String topic("notify/shutdown");
@@ -632,12 +801,16 @@ void mqttPublishShutdown(time_t heartbeat, time_t uptime) {
 }
 
 // void mqttPublishAccess(time_t accesstime, String const &isknown, String const &type, String const &user, String const &uid)
-void mqttPublishAccess(time_t accesstime, AccessResult const &result, String const &detail, String const &credential, String const &person)
+void mqttPublishAccess(time_t accesstime, const ScanEvent& scan)
 {
 	DynamicJsonDocument root(512);
 	const String topic = String("notify/scan");
+	char detail[SCAN_DETAIL_LEN];
+	char credential[CREDENTIAL_TEXT_LEN];
+	scanDetail(scan, detail, sizeof(detail));
+	scanCredential(scan, credential);
 
-	switch (result)
+	switch (scan.result)
 	{
 	case unrecognized:
 		root["result"] = "unrecognized";
@@ -665,9 +838,10 @@ void mqttPublishAccess(time_t accesstime, AccessResult const &result, String con
 	root["time"] = accesstime;
 	root["detail"] = detail;
 	root["credential"] = credential;
+	root["reader"] = scan.reader;
 
-	if (result != unrecognized) {
-		root["username"] = person;
+	if (scan.result != unrecognized) {
+		root["username"] = scan.name[0] ? scan.name : "N/A";
 	}
 
 	mqttPublishEvent(&root, topic);
@@ -696,16 +870,13 @@ void getUserID(const MqttMessage& message) {
 	filename += message.uid;
 
 	SEMAPHORE_FS_TAKE();
-	File f = SPIFFS.open(filename, "w");
+	mqttIncomingJson["record_time"] = now();
+	mqttIncomingJson["source"] = "MQTT";
+	// mqttIncomingJson["uid"] = message.uid;
+	mqttIncomingJson.remove("id");
 
-	if (f)
+	if (Credentials.put(message.uid, mqttIncomingJson))
 	{
-		mqttIncomingJson["record_time"] = now();
-		mqttIncomingJson["source"] = "MQTT";
-		// mqttIncomingJson["uid"] = message.uid;
-		mqttIncomingJson.remove("id");
-		serializeJson(mqttIncomingJson, f);
-		f.close();
 		mqttPublishAck("notify/db/add", filename.c_str());
 	} else {
 		mqttPublishNack("notify/db/add", "could not create file");
@@ -727,16 +898,31 @@ void addUserID(const MqttMessage& message) {
 	filename += message.uid;
 
 	SEMAPHORE_FS_TAKE();
-	File f = SPIFFS.open(filename, "w");
+	mqttIncomingJson["record_time"] = now();
+	mqttIncomingJson["source"] = "MQTT";
+	// mqttIncomingJson["uid"] = message.uid;
+	mqttIncomingJson.remove("id");
+
+	// part of a resync: only the staging slot changes until db/stage commit
+	bool staged = mqttIncomingJson["stage"] | false;
+	if (staged) {
+		mqttIncomingJson.remove("stage");
+		if (StagedBuild.collecting() && Credentials.stage().put(message.uid, mqttIncomingJson)) {
+			StagedBuild.add(message.uid, mqttIncomingJson);
+			mqttPublishAck("notify/db/add", filename.c_str());
+		} else {
+			mqttPublishNack("notify/db/add", StagedBuild.collecting() ? "could not stage record" : "not staging");
+		}
+		SEMAPHORE_FS_GIVE();
+		return;
+	}
 
-	if (f)
+	if (Credentials.put(message.uid, mqttIncomingJson))
 	{
-		mqttIncomingJson["record_time"] = now();
-		mqttIncomingJson["source"] = "MQTT";
-		// mqttIncomingJson["uid"] = message.uid;
-		mqttIncomingJson.remove("id");
-		serializeJson(mqttIncomingJson, f);
-		f.close();
+		CredentialIndex.put(message.uid, mqttIncomingJson);
+		EnrolledFilter.add(message.uid);
+		StagedBuild.put(message.uid, mqttIncomingJson);
+		AccessControl.invalidate(message.uid);
 		mqttPublishAck("notify/db/add", filename.c_str());
 	} else {
 		mqttPublishNack("notify/db/add", "could not create file");
@@ -747,14 +933,18 @@ void addUserID(const MqttMessage& message) {
 void deleteAllUserFiles()
 {
 	SEMAPHORE_FS_TAKE();
-	Dir dir = SPIFFS.openDir("/P/");
-	while (dir.next())
-	{
-		String uid = dir.fileName();
-		uid.remove(0, 3);
-		SPIFFS.remove(dir.fileName());
-	}
+	// a resync in progress would bring the records back
+	bool staged = StagedBuild.state() != staged_idle;
+	StagedBuild.abort();
+	Credentials.clear();
+	CredentialIndex.clear();
+	CredentialBlob.clear();
+	EnrolledFilter.clear();
+	AccessControl.cache.clear();
 	SEMAPHORE_FS_GIVE();
+	if (staged) {
+		mqttPublishStage("abort", true, "dropped");
+	}
 	mqttPublishAck("notify/db/drop", "complete");
 }
 
@@ -763,12 +953,21 @@ void deleteUserID(const char *uid)
 	// only do this if a user id has been provided
 	if (uid)
 	{
-		String myuid = String(uid);
-		myuid = "/P/" + myuid;
-
 		SEMAPHORE_FS_TAKE();
 
-		if (SPIFFS.exists(myuid.c_str()) && SPIFFS.remove(myuid.c_str())) {
+		CredentialIndex.remove(uid);
+		EnrolledFilter.invalidate();
+		StagedBuild.remove(uid);
+		AccessControl.invalidate(uid);
+		// a credential from the image would still be found there
+		CredentialKey key;
+		bool revoked = credentialFromText(uid, key) && CredentialBlob.revoke(key);
+		// so it does not come back with the next index rebuild
+		String legacy;
+		if (credentialLegacyName(uid, legacy) && Credentials.remove(legacy)) {
+			revoked = true;
+		}
+		if (Credentials.remove(uid) || revoked) {
 			mqttPublishAck("notify/db/delete", String(uid).c_str());
 		} else {
 			mqttPublishNack("notify/db/delete", String(uid).c_str());
@@ -778,25 +977,290 @@ void deleteUserID(const char *uid)
 }
 
 void getDbStatus() {
-	DynamicJsonDocument root(512);
+	DynamicJsonDocument root(1024);
+	size_t used = 0;
+	size_t total = 0;
 	SEMAPHORE_FS_TAKE();
-	Dir dir = SPIFFS.openDir("/P/");
-	int i = 0;
 	// DEBUG_SERIAL.println("[ INFO ] getDbStatus");
-	while (dir.next())
-	{
-		++i;
-	}
 	// root["id"] = config.deviceHostname;
-	root["total"] = i;
-	FSInfo fsinfo;
-	SPIFFS.info(fsinfo);
+	root["total"] = Credentials.count();
+	Credentials.info(used, total);
 	SEMAPHORE_FS_GIVE();
-	root["flash_used"] = fsinfo.usedBytes;
-	root["flash_available"] = fsinfo.totalBytes - fsinfo.usedBytes;
+	root["flash_used"] = used;
+	root["flash_available"] = total - used;
+
+	JsonObject store = root.createNestedObject("store");
+	store["backend"] = Credentials.name();
+	store["gets"] = Credentials.stats.gets;
+	store["misses"] = Credentials.stats.misses;
+	store["puts"] = Credentials.stats.puts;
+	store["removes"] = Credentials.stats.removes;
+	store["last_us"] = Credentials.stats.lastMicros;
+	store["max_us"] = Credentials.stats.maxMicros;
+	store["avg_us"] = Credentials.stats.gets ? Credentials.stats.totalMicros / Credentials.stats.gets : 0;
+	Credentials.status(store);
+	store["build"] = (int) StagedBuild.state();
+	store["last_swap_ms"] = StagedBuild.lastCommitMillis();
+
+	JsonObject index = root.createNestedObject("index");
+	index["ready"] = CredentialIndex.ready();
+	index["count"] = CredentialIndex.count();
+	index["lookups"] = CredentialIndex.stats.lookups;
+	index["hits"] = CredentialIndex.stats.hits;
+	index["last_us"] = CredentialIndex.stats.lastMicros;
+	index["max_us"] = CredentialIndex.stats.maxMicros;
+	index["avg_us"] = CredentialIndex.stats.lookups ? CredentialIndex.stats.totalMicros / CredentialIndex.stats.lookups : 0;
+
+	JsonObject image = root.createNestedObject("image");
+	image["loaded"] = CredentialBlob.ready();
+	image["count"] = CredentialBlob.count();
+	image["bytes"] = CredentialBlob.size();
+	image["ram_bytes"] = CredentialBlob.ramBytes();
+	image["lookups"] = CredentialBlob.stats.lookups;
+	image["hits"] = CredentialBlob.stats.hits;
+	image["max_us"] = CredentialBlob.stats.maxMicros;
+	image["avg_us"] = CredentialBlob.stats.lookups ? CredentialBlob.stats.totalMicros / CredentialBlob.stats.lookups : 0;
+
+	JsonObject cache = root.createNestedObject("cache");
+	cache["size"] = AccessControl.cache.size();
+	cache["capacity"] = AccessControl.cache.capacity();
+	cache["hits"] = AccessControl.cache.stats.hits;
+	cache["misses"] = AccessControl.cache.stats.misses;
+	cache["evictions"] = AccessControl.cache.stats.evictions;
+	cache["invalidations"] = AccessControl.cache.stats.invalidations;
 	mqttPublishEvent(&root, String("notify/db/count"));
 }
 
+/**
+ * @brief Times lookups against synthetic indexes of the sizes given in the
+ * `records` array of the db/bench payload (default 500, 2k and 5k, at most
+ * CREDENTIAL_INDEX_BENCH_MAX, about 320 kB of flash), then
+ * against `store_records` records (default 200) in each credential store
+ * backend. Then simulates `people` (default 20) at the door, see
+ * AccessControlClass::simulateQueue().
+ * @note This blocks the main loop while the synthetic files are written, so
+ * it should only be used on a device that is not in service.
+ */
+void benchmarkIndex() {
+	static const uint32_t defaultSizes[] = {500, 2000, 5000};
+	uint32_t lookups = mqttIncomingJson["lookups"] | 200;
+	JsonArray sizes = mqttIncomingJson["records"];
+
+	DynamicJsonDocument root(1024);
+	JsonArray results = root.createNestedArray("results");
+
+	SEMAPHORE_FS_TAKE();
+	size_t n = sizes.isNull() ? sizeof(defaultSizes) / sizeof(defaultSizes[0]) : sizes.size();
+	for (size_t i = 0; i < n && i < 8; i++) {
+		uint32_t records = sizes.isNull() ? defaultSizes[i] : sizes[i].as<uint32_t>();
+		CredentialIndexClass::BenchResult bench;
+		bool ok = CredentialIndexClass::benchmark(FILESYSTEM, records, lookups, bench);
+
+		JsonObject item = results.createNestedObject();
+		item["records"] = bench.records;
+		item["ok"] = ok;
+		item["build_ms"] = bench.buildMillis;
+		item["avg_us"] = bench.avgMicros;
+		item["max_us"] = bench.maxMicros;
+		item["avg_reads"] = bench.avgReads;
+	}
+
+	// the per-file, log and RAM backends, each in a scratch store
+	uint32_t storeRecords = mqttIncomingJson["store_records"] | 200;
+#ifdef USE_LITTLEFS
+	LittleFsCredentialStore flashStore(FILESYSTEM, CREDENTIAL_STORE_BENCH_DIR);
+#else
+	FsCredentialStore flashStore(FILESYSTEM, CREDENTIAL_STORE_BENCH_DIR);
+#endif
+	LogCredentialStore logStore(FILESYSTEM, nullptr, "/bench.log", "/bench.new");
+	MemoryCredentialStore memoryStore;
+	CredentialStore* stores[] = { &flashStore, &logStore, &memoryStore };
+
+	JsonArray storeResults = root.createNestedArray("stores");
+	for (CredentialStore* store : stores) {
+		CredentialStore::BenchResult bench;
+		bool ok = CredentialStore::benchmark(*store, storeRecords, lookups, bench);
+
+		JsonObject item = storeResults.createNestedObject();
+		item["backend"] = store->name();
+		item["records"] = bench.records;
+		item["ok"] = ok;
+		item["put_ms"] = bench.putMillis;
+		item["avg_us"] = bench.avgMicros;
+		item["max_us"] = bench.maxMicros;
+		item["clear_ms"] = bench.clearMillis;
+	}
+	logStore.destroy();
+	SEMAPHORE_FS_GIVE();
+
+	// a queue of people at the door, under the old and the per-credential cool down
+	AccessControlClass::QueueSimulation sim;
+	sim.people = mqttIncomingJson["people"] | sim.people;
+	sim.walkMillis = mqttIncomingJson["walk_ms"] | sim.walkMillis;
+	sim.retryMillis = mqttIncomingJson["retry_ms"] | sim.retryMillis;
+	AccessControlClass::QueueSimulationResult queue;
+	AccessControlClass::simulateQueue(sim, queue);
+
+	JsonObject door = root.createNestedObject("door");
+	door["people"] = sim.people;
+	door["walk_ms"] = sim.walkMillis;
+	door["cool_down_ms"] = config.coolDownTime;
+	door["hold_ms"] = AccessControlClass::holdTime();
+	door["global_ms"] = queue.globalMillis;
+	door["global_blocked"] = queue.globalBlocked;
+	door["global_per_min"] = queue.globalMillis ? 60000UL * sim.people / queue.globalMillis : 0;
+	door["per_credential_ms"] = queue.perCredentialMillis;
+	door["per_credential_blocked"] = queue.perCredentialBlocked;
+	door["per_credential_per_min"] = queue.perCredentialMillis ? 60000UL * sim.people / queue.perCredentialMillis : 0;
+
+	root["lookups"] = lookups;
+	mqttPublishEvent(&root, String("notify/db/bench"));
+}
+
+/**
+ * @brief Receives a credential image built by tools/credentialblob. The
+ * `action` of the db/blob payload is one of
+ *   begin   with `size` and `crc` (the CRC-32 from the image header)
+ *   chunk   with `offset` and base64 `data`, in order
+ *   commit  verify the image and switch lookups to it
+ *   abort
+ * Each message is answered on notify/db/blob with the next expected offset,
+ * so the sender can wait for it before sending the next chunk.
+ */
+void receiveCredentialBlob() {
+	const char* action = mqttIncomingJson["action"] | "";
+	bool ok = false;
+
+	SEMAPHORE_FS_TAKE();
+	if (strcmp(action, "begin") == 0) {
+		ok = CredentialBlob.beginUpload(mqttIncomingJson["size"], mqttIncomingJson["crc"]);
+	} else if (strcmp(action, "chunk") == 0) {
+		const char* data = mqttIncomingJson["data"] | "";
+		size_t max = strlen(data) * 3 / 4 + 3;
+		std::unique_ptr<uint8_t[]> buf(new uint8_t[max]);
+		size_t len = base64Decode(data, buf.get(), max);
+		ok = len > 0 && CredentialBlob.writeUpload(mqttIncomingJson["offset"], buf.get(), len);
+	} else if (strcmp(action, "commit") == 0) {
+		ok = CredentialBlob.commitUpload();
+	} else if (strcmp(action, "abort") == 0) {
+		CredentialBlob.abortUpload();
+		ok = true;
+	}
+	SEMAPHORE_FS_GIVE();
+
+	if (ok && strcmp(action, "commit") == 0) {
+		rebuildEnrolledFilter();
+		StagedBuild.imageChanged();
+		AccessControl.cache.clear();
+		DEBUG_SERIAL.printf("[ INFO ] Credential image active: %u entries\n", CredentialBlob.count());
+	}
+
+	DynamicJsonDocument root(256);
+	root["result"] = ok ? "ack" : "nack";
+	root["action"] = action;
+	root["offset"] = CredentialBlob.uploadReceived();
+	if (strcmp(action, "commit") == 0) {
+		root["count"] = CredentialBlob.count();
+	}
+	mqttPublishEvent(&root, String("notify/db/blob"));
+}
+
+/**
+ * @brief Full resync without emptying the live database, using the `action`
+ * of the db/stage payload:
+ *   begin   empty the staging slot; refused while the previous copy is
+ *           still being reclaimed
+ *   commit  finish the staged index and filter from loop(), then make the
+ *           staging slot live; answered once it is
+ *   abort   drop the staged records
+ * Between begin and commit the server sends db/add with `"stage": true`.
+ * Lookups keep using the live slot, index and filter until the commit
+ * swaps them, see StagedBuildClass.
+ */
+void stageDb() {
+	const char* action = mqttIncomingJson["action"] | "";
+	bool ok = false;
+	const char* reason = nullptr;
+
+	SEMAPHORE_FS_TAKE();
+	if (strcmp(action, "begin") == 0) {
+		if (Credentials.reclaiming()) {
+			reason = "reclaiming";
+		} else if (Credentials.beginStage()) {
+			ok = StagedBuild.begin();
+			if (!ok) {
+				Credentials.abortStage();
+			}
+		}
+	} else if (strcmp(action, "commit") == 0) {
+		ok = Credentials.staging() && StagedBuild.commit();
+	} else if (strcmp(action, "abort") == 0) {
+		StagedBuild.abort();
+		Credentials.abortStage();
+		ok = true;
+	}
+	SEMAPHORE_FS_GIVE();
+
+	if (ok && strcmp(action, "commit") == 0) {
+		// answered by StagedBuild once the swap is done
+		return;
+	}
+	mqttPublishStage(action, ok, reason);
+}
+
+void mqttPublishStage(const char* action, bool ok, const char* reason) {
+	DynamicJsonDocument root(256);
+	root["result"] = ok ? "ack" : "nack";
+	root["action"] = action;
+	if (reason) {
+		root["msg"] = reason;
+	}
+	root["slot"] = String(Credentials.slot());
+	root["count"] = Credentials.staging() ? Credentials.stage().count() : Credentials.count();
+	mqttPublishEvent(&root, String("notify/db/stage"));
+}
+
+/**
+ * @brief Changes the Wiegand glitch filter and diagnostics at runtime and
+ * replies with the diagnostics on notify/wiegand. All keys are optional, so
+ * a message with only an id just reads them:
+ *   mintime      minimum time (us) between edges
+ *   diagnostics  true to start recording edge timing, false to stop
+ *   clear        true to reset the histograms
+ *   reader       which reader the diagnostics keys apply to, 0 by default
+ * The filter setting is not saved; use hardware.wgdmintime in the config.
+ */
+void setWiegand() {
+	uint8_t reader = mqttIncomingJson["reader"] | 0;
+	if (reader >= WIEGAND_MAX_READERS || !TCMWiegand[reader].active()) {
+		mqttPublishNack("notify/wiegand", "unknown reader");
+		return;
+	}
+	TCMWiegand[reader].configure(mqttIncomingJson);
+
+	DynamicJsonDocument root(2048);
+	TCMWiegand[reader].report(root);
+	mqttPublishEvent(&root, String("notify/wiegand"));
+}
+
+/**
+ * @brief Presents the credential in "uid" as a virtual badge. It is
+ * decided like a card; the reply on notify/badge only says whether it was
+ * queued.
+ */
+void presentBadge() {
+	const char* credential = mqttIncomingJson["uid"];
+	if (!credential) {
+		mqttPublishNack("notify/badge", "missing uid");
+		return;
+	}
+	DynamicJsonDocument root(256);
+	root["uid"] = credential;
+	root["queued"] = VirtualBadge.present(credential);
+	root["queue_depth"] = AccessControl.queueDepth();
+	mqttPublishEvent(&root, String("notify/badge"));
+}
+
 void onMqttPublish(uint16_t packetId)
 {
 	DEBUG_SERIAL.printf("[ DEBUG ] %lu - publish acknowledged, id: %u\n", micros(), packetId);
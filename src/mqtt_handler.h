@@ -8,6 +8,15 @@
 #include <Ticker.h>
 #include "config.h"
 #include "accesscontrol.h"
+#include "credentialindex.h"
+#include "logstore.h"
+#include "credentialblob.h"
+#include "remotelookup.h"
+#include "pn532reader.h"
+#include "rdm6300reader.h"
+#include "credentialsource.h"
+#include "eventbus.h"
+#include "stagedbuild.h"
 #include "helpers.h"
 
 #define MAX_MQTT_BUFFER 2048
@@ -25,7 +34,13 @@ enum MqttAccessTopic {
     DROP_DB,
     UNLOCK,
     LOCK,
-    GET_CONF
+    GET_CONF,
+    BENCH_DB,
+    BLOB_DB,
+    STAGE_DB,
+    LOOKUP_REPLY,
+    SET_WIEGAND,
+    SET_BADGE
 };
 
 
@@ -104,7 +119,7 @@ class MqttDatabaseSender {
     private:
     DynamicJsonDocument *root;
     uint32_t lastSend = 0;
-    Dir *dir = nullptr;
+    CredentialCursor *cursor = nullptr;
 	bool _available = false;
 };
 
@@ -122,11 +137,13 @@ uint16_t mqttPublishEvent(const String payload, const String topic, const uint8_
 void mqttPublishAck(const char* command, const char* msg);
 void mqttPublishNack(const char* command, const char* msg);
 
-void mqttPublishAccess(time_t accesstime, AccessResult const &result, String const &detail, String const &credential, String const &person);
+void mqttPublishAccess(time_t accesstime, const ScanEvent& scan);
 
 void mqttPublishIo(String const &io, String const &state);
 void onMqttPublish(uint16_t packetId);
 void mqttPublishHeartbeat(time_t heartbeat, time_t uptime);
+uint16_t mqttPublishLookup(const char* credential, uint32_t request);
+void mqttPublishStage(const char* action, bool ok, const char* reason = nullptr);
 void mqttPublishShutdown(time_t heartbeat, time_t uptime);
 
 void onMqttMessage(char *topic, const char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
@@ -139,8 +156,15 @@ void getUserList();
 void deleteAllUserFiles();
 void deleteUserID(const char *uid);
 void addUserID(const MqttMessage& message);
+void benchmarkIndex();
+void receiveCredentialBlob();
+void stageDb();
+void setWiegand();
+void presentBadge();
 
 extern void onNewRecord(const String uid, const JsonDocument& payload);
+extern void onLookupReply(const JsonDocument& payload);
+extern void rebuildEnrolledFilter();
 
 extern AsyncMqttClient mqttClient;
 extern Ticker mqttReconnectTimer;
@@ -0,0 +1,49 @@
+#include "pn532frame.h"
+
+void Pn532FrameParser::begin(byte *buf, uint8_t cap) {
+	state = seek;
+	size = 0;
+	count = 0;
+	sum = 0;
+	previous = 0xFF;
+	scanned = 0;
+	buffer = buf;
+	capacity = cap;
+}
+
+bool Pn532FrameParser::push(byte b) {
+	switch (state) {
+		case seek:
+			if (previous == PN532_FRAME_START1 && b == PN532_FRAME_START2) {
+				state = length;
+			} else if (++scanned > PN532_FRAME_SCAN_LIMIT) {
+				state = failed;
+			}
+			previous = b;
+			break;
+		case length:
+			size = b;
+			state = length_check;
+			break;
+		case length_check:
+			if (size == 0 && b == 0xFF) {
+				state = done; // ACK
+			} else if (size == 0 || (uint8_t)(size + b) != 0 || size > capacity) {
+				state = failed;
+			} else {
+				state = data;
+			}
+			break;
+		case data:
+			buffer[count++] = b;
+			sum += b;
+			if (count == size) {
+				state = data_check;
+			}
+			break;
+		case data_check:
+			state = (uint8_t)(sum + b) == 0 && buffer[0] == PN532_FRAME_TO_HOST ? done : failed;
+			break;
+	}
+	return state != done && state != failed;
+}
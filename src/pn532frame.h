@@ -0,0 +1,41 @@
+#ifndef pn532frame_h
+#define pn532frame_h
+
+#include <Arduino.h>
+
+#define PN532_FRAME_START1 0x00    // start code, PN532_STARTCODE1 and 2 in the library
+#define PN532_FRAME_START2 0xFF
+#define PN532_FRAME_TO_HOST 0xD5   // first data byte of a response, PN532_PN532TOHOST
+#define PN532_FRAME_SCAN_LIMIT 80  // bytes skipped looking for the start code, PN532_PACKBUFFSIZE
+
+/**
+ * @brief Incremental parser of PN532 frames, fed one byte at a time so a
+ * frame can be read over several loop() steps. Bytes before the start code
+ * are skipped. The data of a normal information frame (starting with
+ * PN532_FRAME_TO_HOST) is copied to the buffer; an ACK frame has no data.
+ * Any other frame without data is an error.
+ */
+struct Pn532FrameParser {
+    enum State { seek, length, length_check, data, data_check, done, failed };
+
+    uint8_t state = seek;
+    uint8_t size = 0;       // data bytes announced by the frame
+    uint8_t count = 0;
+    uint8_t sum = 0;
+    uint8_t previous = 0xFF;
+    uint8_t scanned = 0;
+    byte *buffer = nullptr;
+    uint8_t capacity = 0;
+
+    void begin(byte *buf, uint8_t cap);
+
+    /**
+     * @return true while the frame needs more bytes
+     */
+    bool push(byte b);
+
+    bool complete() const { return state == done; }
+    bool ack() const { return state == done && size == 0; }
+};
+
+#endif
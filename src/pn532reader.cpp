@@ -0,0 +1,270 @@
+#include "pn532reader.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+static_assert(PN532_FRAME_START1 == PN532_STARTCODE1 && PN532_FRAME_START2 == PN532_STARTCODE2 &&
+              PN532_FRAME_TO_HOST == PN532_PN532TOHOST && PN532_FRAME_SCAN_LIMIT == PN532_PACKBUFFSIZE,
+              "Pn532FrameParser constants differ from the PN532 library");
+
+Pn532ReaderClass Pn532Reader;
+
+void Pn532ReaderClass::begin(uint8_t ssPin, uint8_t irqPin, uint8_t resetPin, bool autoPoll) {
+	_irqPin = irqPin;
+	_autoPoll = autoPoll;
+	_configured = false;
+	SetDebugLevel(0);
+	InitSoftwareSPI(PN532_CLK_PIN, PN532_MISO_PIN, PN532_MOSI_PIN, ssPin, resetPin);
+	Utils::WritePin(ssPin, HIGH);
+	if (_irqPin != 255) {
+		pinMode(_irqPin, INPUT);
+	}
+	PN532::begin();
+	_state = pn532_send;
+}
+
+uint64_t Pn532ReaderClass::uidToKey(const byte *uid, uint8_t length) {
+	uint64_t key = 0;
+	for (uint8_t i = 0; i < length && i < 8; i++) {
+		key = (key << 8) | uid[i];
+	}
+	return key;
+}
+
+void Pn532ReaderClass::sendCommand() {
+	byte *cmd = mu8_PacketBuffer;
+	byte len;
+	if (!_configured) {
+		cmd[0] = PN532_COMMAND_SAMCONFIGURATION;
+		cmd[1] = 0x01; // normal mode
+		cmd[2] = 0x14; // timeout 50ms * 20 = 1 second
+		cmd[3] = 0x01; // use IRQ pin
+		len = 4;
+	} else if (_autoPoll) {
+		cmd[0] = PN532_COMMAND_INAUTOPOLL;
+		cmd[1] = 0xFF; // poll until a card is found
+		cmd[2] = PN532_AUTOPOLL_PERIOD;
+		cmd[3] = PN532_AUTOPOLL_TYPE;
+		len = 4;
+	} else {
+		cmd[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+		cmd[1] = 1; // one card
+		cmd[2] = CARD_TYPE_106KB_ISO14443A;
+		len = 3;
+	}
+	_command = cmd[0];
+	_commandLength = len;
+	select(pn532_wait_ack);
+}
+
+void Pn532ReaderClass::select(Pn532State next) {
+	Utils::WritePin(mu8_SselPin, LOW);
+	selectMicros = micros();
+	_selectedState = next;
+	_state = pn532_select;
+}
+
+/**
+ * @brief Writes the command in the packet buffer to the selected chip,
+ * framed as PN532::WriteCommand() does.
+ */
+void Pn532ReaderClass::writeCommand() {
+	const byte header[] = {
+		PN532_PREAMBLE, PN532_STARTCODE1, PN532_STARTCODE2,
+		(byte)(_commandLength + 1), (byte)(0xFF - _commandLength), PN532_HOSTTOPN532
+	};
+	byte checksum = 0;
+	SpiWrite(PN532_SPI_DATAWRITE);
+	for (byte b : header) {
+		SpiWrite(b);
+		checksum += b;
+	}
+	for (byte i = 0; i < _commandLength; i++) {
+		SpiWrite(mu8_PacketBuffer[i]);
+		checksum += mu8_PacketBuffer[i];
+	}
+	SpiWrite(~checksum);
+	SpiWrite(PN532_POSTAMBLE);
+	Utils::WritePin(mu8_SselPin, HIGH);
+	Utils::DelayMicro(PN532_SOFT_SPI_DELAY);
+
+	++stats.commands;
+	stateMillis = millis();
+	statusMillis = 0;
+}
+
+bool Pn532ReaderClass::ready() {
+	if (_irqPin != 255) {
+		return digitalRead(_irqPin) == LOW;
+	}
+	if (statusMillis != 0 && millis() - statusMillis < PN532_POLL_INTERVAL) {
+		return false;
+	}
+	statusMillis = millis();
+	return IsReady();
+}
+
+void Pn532ReaderClass::beginRead(Pn532State next) {
+	// the ACK is read into the front of the packet buffer too; it has no data
+	parser.begin(mu8_PacketBuffer, sizeof(mu8_PacketBuffer));
+	readBytes = 0;
+	select(next);
+}
+
+/**
+ * @return true once the frame is complete or has failed
+ */
+bool Pn532ReaderClass::readChunk(uint8_t limit) {
+	for (uint8_t i = 0; i < PN532_READ_CHUNK; i++) {
+		if (readBytes >= limit) {
+			return true;
+		}
+		++readBytes;
+		if (!parser.push(SpiRead())) {
+			return true;
+		}
+	}
+	return readBytes >= limit;
+}
+
+void Pn532ReaderClass::endRead() {
+	Utils::WritePin(mu8_SselPin, HIGH);
+	Utils::DelayMicro(PN532_SOFT_SPI_DELAY);
+}
+
+void Pn532ReaderClass::fail(bool timeout) {
+	if (timeout) {
+		++stats.timeouts;
+	} else {
+		++stats.errors;
+	}
+	DEBUG_SERIAL.printf("[ WARN ] PN532 %s on command 0x%02X, setting up again\n", timeout ? "timeout" : "error", _command);
+	_configured = false;
+	stateMillis = millis();
+	_state = pn532_retry;
+}
+
+void Pn532ReaderClass::handleTarget(const byte *uid, uint8_t length) {
+	uint64_t key = uidToKey(uid, length);
+	bool repeat = key == lastKey && millis() - lastKeyMillis < PN532_REPEAT_TIME;
+	lastKey = key;
+	lastKeyMillis = millis();
+	if (repeat) {
+		++stats.repeats;
+		return;
+	}
+	++stats.cards;
+
+	DEBUG_SERIAL.printf("[ INFO ] %lu - PN532 UID of %u bytes read\n", micros(), length);
+	CredentialEvent event = CredentialEvent();
+	event.code = key;
+	event.bits = (length < 8 ? length : 8) * 8;
+	event.micros = readyMicros;
+	submit(event);
+	readLatency.add(micros() - readyMicros);
+}
+
+void Pn532ReaderClass::handleResponse() {
+	const byte *data = mu8_PacketBuffer;
+	const uint8_t size = parser.size;
+	if (size < 3 || data[1] != _command + 1) {
+		fail(false);
+		return;
+	}
+
+	if (_command == PN532_COMMAND_SAMCONFIGURATION) {
+		_configured = true;
+	} else if (_command == PN532_COMMAND_INAUTOPOLL) {
+		// D5 61 NbTg [Type Length Tg SENS_RES(2) SEL_RES NFCIDLength NFCID ...]
+		if (data[2] > 0) {
+			if (size < 10 || data[3] != PN532_AUTOPOLL_TYPE || 10 + data[9] > size) {
+				++stats.unsupported;
+			} else {
+				handleTarget(data + 10, data[9]);
+			}
+		}
+	} else if (_command == PN532_COMMAND_INLISTPASSIVETARGET) {
+		// D5 4B NbTg [Tg ATQA(2) SAK UIDLength UID ...]
+		if (data[2] > 0) {
+			if (size < 8 || 8 + data[7] > size) {
+				++stats.unsupported;
+			} else {
+				handleTarget(data + 8, data[7]);
+			}
+		}
+	}
+	_state = pn532_send;
+}
+
+void Pn532ReaderClass::loop() {
+	if (_state == pn532_off) {
+		return;
+	}
+	unsigned long start = micros();
+
+	switch (_state) {
+		case pn532_send:
+			sendCommand();
+			break;
+		case pn532_wait_ack:
+			if (ready()) {
+				beginRead(pn532_read_ack);
+			} else if (millis() - stateMillis > PN532_TIMEOUT) {
+				fail(true);
+			}
+			break;
+		case pn532_select:
+			if (micros() - selectMicros >= PN532_SELECT_TIME) {
+				if (_selectedState == pn532_wait_ack) {
+					writeCommand();
+				} else {
+					SpiWrite(PN532_SPI_DATAREAD);
+				}
+				_state = _selectedState;
+			}
+			break;
+		case pn532_read_ack:
+			// never read more than the 6 bytes of the ACK, see PN532::ReadAck()
+			if (readChunk(6)) {
+				endRead();
+				if (parser.ack()) {
+					stateMillis = millis();
+					statusMillis = 0;
+					_state = pn532_wait_response;
+				} else {
+					fail(false);
+				}
+			}
+			break;
+		case pn532_wait_response:
+			// InAutoPoll and InListPassiveTarget only answer once a card is in the field
+			if (ready()) {
+				readyMicros = micros();
+				beginRead(pn532_read_response);
+			} else if (!_configured && millis() - stateMillis > PN532_TIMEOUT) {
+				fail(true);
+			}
+			break;
+		case pn532_read_response:
+			if (readChunk(PN532_PACKBUFFSIZE)) {
+				endRead();
+				if (parser.complete()) {
+					handleResponse();
+				} else {
+					fail(false);
+				}
+			}
+			break;
+		case pn532_retry:
+			if (millis() - stateMillis > PN532_RETRY_DELAY) {
+				_state = pn532_send;
+			}
+			break;
+		default:
+			break;
+	}
+
+	unsigned long step = micros() - start;
+	if (step > stats.maxStepMicros) {
+		stats.maxStepMicros = step;
+	}
+}
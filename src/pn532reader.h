@@ -0,0 +1,120 @@
+#ifndef pn532reader_h
+#define pn532reader_h
+
+#include <Arduino.h>
+#include <PN532.h>
+#include "magicnumbers.h"
+#include "remotelookup.h"
+#include "credentialsource.h"
+#include "pn532frame.h"
+
+#define PN532_CLK_PIN 14       // software SPI pins, the ESP8266 HSPI pins
+#define PN532_MISO_PIN 12
+#define PN532_MOSI_PIN 13
+#define PN532_POLL_INTERVAL 50 // time (ms) between status reads while the IRQ pin is not used
+#define PN532_READ_CHUNK 4     // bytes read from the PN532 per loop() step
+#define PN532_RETRY_DELAY 2000 // time (ms) before the PN532 is set up again after an error
+#define PN532_REPEAT_TIME 1000 // time (ms) a card must be away before it is read again
+#define PN532_SELECT_TIME 2000 // time (us) the chip is selected before a read, see PN532::ReadPacket()
+#define PN532_AUTOPOLL_PERIOD 1 // InAutoPoll period, in units of 150 ms
+#define PN532_AUTOPOLL_TYPE 0x10 // InAutoPoll target type: Mifare / ISO14443A 106 kbps
+
+enum Pn532State {
+    pn532_off,
+    pn532_send,
+    pn532_wait_ack,
+    pn532_read_ack,
+    pn532_wait_response,
+    pn532_read_response,
+    pn532_retry,
+    pn532_select        // chip select low, waiting PN532_SELECT_TIME before a write or read
+};
+
+/**
+ * @brief Reads card UIDs from a PN532 without blocking loop().
+ *
+ * The library's command functions wait for the chip's ready bit, which for
+ * InListPassiveTarget or InAutoPoll is as long as no card is in the field.
+ * Here a command is written and loop() then only checks whether the chip
+ * is ready: on the IRQ pin when one is configured, otherwise with a status
+ * read every PN532_POLL_INTERVAL. The chip is selected PN532_SELECT_TIME
+ * before a command is written or a frame read, which the library waits out
+ * with a delay and this reader in a state of its own. ACK and response are read
+ * PN532_READ_CHUNK bytes per step with the chip select held low between
+ * steps, so the slow software SPI never holds loop() for a whole frame.
+ *
+ * After set up (SAMConfiguration) the chip polls for cards with InAutoPoll,
+ * or InListPassiveTarget when config.pn532AutoPoll is off. A card UID is
+ * turned into a credential key and submitted as reader PN532_READER. Any
+ * error sets the chip up again after PN532_RETRY_DELAY.
+ */
+class Pn532ReaderClass : public PN532, public CredentialSource {
+    public:
+    /**
+     * @brief Resets the chip and starts the state machine. irqPin is 255
+     * to poll the status instead. Blocks for the reset, so only call it
+     * from setup().
+     */
+    void begin(uint8_t ssPin, uint8_t irqPin, uint8_t resetPin, bool autoPoll);
+
+    void loop() override;
+
+    bool active() const override { return _state != pn532_off; }
+    uint8_t reader() const override { return PN532_READER; }
+    CredentialSourceType type() const override { return source_pn532; }
+    Pn532State state() const { return _state; }
+
+    /**
+     * @brief Credential key of a UID: its bytes, first byte highest. UIDs
+     * longer than 8 bytes keep their first 8.
+     */
+    static uint64_t uidToKey(const byte *uid, uint8_t length);
+
+    struct Stats {
+        unsigned long commands = 0;
+        unsigned long timeouts = 0;    // no ACK, or no set up response, within PN532_TIMEOUT
+        unsigned long errors = 0;      // bad frames and unexpected responses
+        unsigned long cards = 0;
+        unsigned long repeats = 0;     // the same card read again while in the field
+        unsigned long unsupported = 0; // targets without a usable UID
+        unsigned long maxStepMicros = 0;
+    } stats;
+
+    /**
+     * @brief Time from the chip signalling a response to the read being
+     * passed on.
+     */
+    LatencyHistogram readLatency;
+
+    private:
+    void sendCommand();
+    void select(Pn532State next);
+    void writeCommand();
+    bool ready();
+    void beginRead(Pn532State next);
+    bool readChunk(uint8_t limit);
+    void endRead();
+    void handleResponse();
+    void handleTarget(const byte *uid, uint8_t length);
+    void fail(bool timeout);
+
+    Pn532State _state = pn532_off;
+    Pn532State _selectedState = pn532_off; // entered once the chip has been selected
+    uint8_t _irqPin = 255;
+    bool _autoPoll = true;
+    byte _command = 0;
+    byte _commandLength = 0;
+    bool _configured = false;
+    Pn532FrameParser parser;
+    uint8_t readBytes = 0;
+    unsigned long stateMillis = 0;
+    unsigned long statusMillis = 0;
+    unsigned long readyMicros = 0;
+    unsigned long selectMicros = 0;
+    uint64_t lastKey = 0;
+    unsigned long lastKeyMillis = 0;
+};
+
+extern Pn532ReaderClass Pn532Reader;
+
+#endif
@@ -0,0 +1,37 @@
+#include "rdm6300reader.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+Rdm6300ReaderClass Rdm6300Reader;
+
+void Rdm6300ReaderClass::begin() {
+#ifdef DEBUG
+	// at RDM6300_BAUD the debug output would be garbled and the reader
+	// would share the port with the serial console
+	Serial.println(F("[ WARN ] RDM6300 needs Serial, not started in a debug build"));
+#else
+	Serial.begin(RDM6300_BAUD);
+	rfid.SetRepeatTime(RDM6300_REPEAT_TIME);
+	_active = true;
+#endif
+}
+
+void Rdm6300ReaderClass::loop() {
+	if (!_active) {
+		return;
+	}
+	for (uint8_t n = 0; n < RDM6300_MAX_BYTES && Serial.available() > 0; n++) {
+		rfid.rfidSerial((char)Serial.read());
+
+		unsigned long long key;
+		if (!rfid.GetID(key)) {
+			continue;
+		}
+		DEBUG_SERIAL.printf("[ INFO ] %lu - 125 kHz tag read\n", micros());
+		CredentialEvent event = CredentialEvent();
+		event.code = key;
+		event.bits = 40;
+		event.micros = micros();
+		submit(event);
+	}
+}
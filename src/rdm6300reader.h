@@ -0,0 +1,48 @@
+#ifndef rdm6300reader_h
+#define rdm6300reader_h
+
+#include <Arduino.h>
+#include <rfid125kHz.h>
+#include "magicnumbers.h"
+#include "credentialsource.h"
+
+#define RDM6300_BAUD 9600          // baud rate of the RDM6300 / RF125-PS / 7941E
+#define RDM6300_REPEAT_TIME 1000   // time (ms) a tag must be away before it is read again
+#define RDM6300_MAX_BYTES 64       // bytes taken from the UART per loop()
+
+/**
+ * @brief Feeds the 125 kHz reader on the UART receive line into
+ * RFID_Reader one byte at a time, straight from the serial buffer. A frame
+ * with a valid checksum becomes a credential key and is submitted as
+ * reader RDM6300_READER. Nothing is allocated per frame.
+ *
+ * The reader repeats its frame while a tag is in the field; those repeats
+ * are dropped until the tag has been away for RDM6300_REPEAT_TIME.
+ */
+class Rdm6300ReaderClass : public CredentialSource {
+    public:
+    /**
+     * @brief Switches Serial to RDM6300_BAUD. Debug builds need Serial for
+     * their output at 115200, so there the reader is not started and stays
+     * inactive.
+     */
+    void begin();
+
+    void loop() override;
+
+    bool active() const override { return _active; }
+    uint8_t reader() const override { return RDM6300_READER; }
+    CredentialSourceType type() const override { return source_rdm6300; }
+
+    unsigned long frames() const { return rfid.frames; }
+    unsigned long errors() const { return rfid.errors; }
+    unsigned long repeats() const { return rfid.repeats; }
+
+    private:
+    RFID_Reader rfid;
+    bool _active = false;
+};
+
+extern Rdm6300ReaderClass Rdm6300Reader;
+
+#endif
@@ -10,6 +10,7 @@
  */
 
 #include "relay.h"
+#include "eventbus.h"
 
 #define DEBUG_SERIAL if(DEBUG)Serial
 
@@ -36,7 +37,6 @@ Relay::Relay(uint8_t pin, ControlType type , unsigned long actuation_ms, unsigne
   , lastMillis(0)
   , state(inactive)
   , override(normal)
-  , onStateChangeCB(nullptr)
   {}
 
 /**
@@ -63,8 +63,8 @@ void Relay::activate(bool report)
     state = active;
   }
 
-  if (report && onStateChangeCB) {
-    onStateChangeCB(state, override);
+  if (report) {
+    this->report(override);
   }
 }
 
@@ -86,34 +86,39 @@ void Relay::deactivate(bool report)
     state = inactive;
   }
 
-  if (report && onStateChangeCB) {
-    onStateChangeCB(state, override);
+  if (report) {
+    this->report(override);
   }
 }
 
 void Relay::hold() {
   activate(false);
   override = holding;
-  if (onStateChangeCB) {
-    onStateChangeCB(state, override);
-  }
+  report(override);
 }
 
 void Relay::lockout() {
   deactivate(false);
   override = lockedout;
-  if (onStateChangeCB) {
-    onStateChangeCB(state, override);
-  }
+  report(override);
 }
 
 void Relay::release() {
-  if (override != normal && onStateChangeCB) {
-    onStateChangeCB(state, normal);
+  if (override != normal) {
+    report(normal);
   }
   override = normal;
 }
 
+void Relay::report(OverrideState reported) {
+  BusEvent event = BusEvent();
+  event.type = event_relay;
+  event.relay.relay = this;
+  event.relay.operation = state;
+  event.relay.override = reported;
+  EventBus.publish(event);
+}
+
 /**
  * @brief Stop any delayed changes, reset relay state to default.
  * 
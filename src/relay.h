@@ -75,8 +75,6 @@ public:
 
     void begin();
 
-    void (*onStateChangeCB)(OperationState operation, OverrideState override) = nullptr;
-
     // OperationState status();
 
     void activate(bool report = true);
@@ -89,6 +87,10 @@ public:
     bool update();
 
     bool isConfigured();
+
+protected:
+    // publishes event_relay
+    void report(OverrideState reported);
 };
 
 #endif
\ No newline at end of file
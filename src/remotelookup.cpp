@@ -0,0 +1,182 @@
+#include "remotelookup.h"
+#include "mqtt_handler.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+RemoteLookupClass RemoteLookup;
+
+LatencyHistogram::LatencyHistogram() {
+	clear();
+}
+
+void LatencyHistogram::clear() {
+	memset(_counts, 0, sizeof(_counts));
+	_total = 0;
+}
+
+uint8_t LatencyHistogram::bucket(unsigned long micros) {
+	if (micros < 2) {
+		return 0;
+	}
+	uint8_t msb = 31 - __builtin_clz(micros);
+	uint8_t b = msb * 2 + ((micros >> (msb - 1)) & 1);
+	return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+unsigned long LatencyHistogram::upperBound(uint8_t bucket) {
+	if (bucket < 2) {
+		return 2;
+	}
+	uint8_t msb = bucket / 2;
+	return (1UL << msb) + ((bucket & 1) + 1) * (1UL << (msb - 1));
+}
+
+void LatencyHistogram::add(unsigned long micros) {
+	++_counts[bucket(micros)];
+	if (++_total < LATENCY_WINDOW) {
+		return;
+	}
+	_total = 0;
+	for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+		_counts[i] /= 2;
+		_total += _counts[i];
+	}
+}
+
+unsigned long LatencyHistogram::percentile(uint8_t pct) const {
+	if (_total == 0) {
+		return 0;
+	}
+	uint32_t target = ((uint32_t) _total * pct + 99) / 100;
+	uint32_t seen = 0;
+	for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += _counts[i];
+		if (seen >= target) {
+			return upperBound(i);
+		}
+	}
+	return upperBound(LATENCY_BUCKETS - 1);
+}
+
+RemoteLookupClass::RemoteLookupClass()
+: _next(0)
+, _timeout(LOOKUP_DELAY)
+{
+	memset(_pending, 0, sizeof(_pending));
+}
+
+uint32_t RemoteLookupClass::request(CredentialKey key) {
+	// 0 means no request pending
+	if (++_next == 0) {
+		_next = 1;
+	}
+
+	// take a free slot, then the released one sent longest ago, whose reply
+	// is the least likely to still come; only with every slot in use is
+	// the oldest request dropped
+	unsigned long now = micros();
+	Pending* slot = &_pending[0];
+	for (uint8_t i = 0; i < LOOKUP_PENDING && slot->request != 0; i++) {
+		Pending& p = _pending[i];
+		if (p.request == 0 || p.released > slot->released
+		    || (p.released == slot->released && now - p.sent > now - slot->sent)) {
+			slot = &p;
+		}
+	}
+
+	slot->request = _next;
+	slot->key = key;
+	slot->sent = now;
+	slot->released = false;
+	++stats.requests;
+
+	char credential[CREDENTIAL_TEXT_LEN];
+	credentialToText(key, credential);
+	slot->packetId = mqttPublishLookup(credential, slot->request);
+	if (slot->packetId == 0) {
+		++stats.unsent;
+	}
+	return slot->request;
+}
+
+void RemoteLookupClass::release(uint32_t request) {
+	for (uint8_t i = 0; i < LOOKUP_PENDING && request != 0; i++) {
+		if (_pending[i].request == request) {
+			_pending[i].released = true;
+		}
+	}
+}
+
+uint8_t RemoteLookupClass::pending() const {
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < LOOKUP_PENDING; i++) {
+		if (_pending[i].request != 0 && !_pending[i].released) {
+			++count;
+		}
+	}
+	return count;
+}
+
+bool RemoteLookupClass::complete(uint32_t request, const char* credential) {
+	CredentialKey key;
+	Pending* slot = nullptr;
+	for (uint8_t i = 0; i < LOOKUP_PENDING && request != 0; i++) {
+		if (_pending[i].request == request) {
+			slot = &_pending[i];
+		}
+	}
+	if (!slot || !credentialFromText(credential, key) || key != slot->key) {
+		++stats.unmatched;
+		return false;
+	}
+	slot->request = 0;
+
+	unsigned long elapsed = micros() - slot->sent;
+	++stats.replies;
+	stats.lastMicros = elapsed;
+	stats.totalMicros += elapsed;
+	if (stats.minMicros == 0 || elapsed < stats.minMicros) {
+		stats.minMicros = elapsed;
+	}
+	if (elapsed > stats.maxMicros) {
+		stats.maxMicros = elapsed;
+	}
+	// late replies count too, so a slow link raises the wait for the next scan
+	roundTrips.add(elapsed);
+	updateTimeout();
+	if (slot->released) {
+		// the scan was decided without it; the reply is dropped
+		++stats.late;
+		DEBUG_SERIAL.printf("[ INFO ] Remote lookup %u answered late in %lu us\n", request, elapsed);
+		return false;
+	}
+	DEBUG_SERIAL.printf("[ INFO ] Remote lookup %u answered in %lu us\n", request, elapsed);
+	return true;
+}
+
+void RemoteLookupClass::onMqttPublish(uint16_t packetId) {
+	if (packetId == 0) {
+		return;
+	}
+	for (uint8_t i = 0; i < LOOKUP_PENDING; i++) {
+		Pending& slot = RemoteLookup._pending[i];
+		if (slot.packetId == packetId) {
+			slot.packetId = 0;
+			RemoteLookup.stats.lastPubackMicros = micros() - slot.sent;
+			RemoteLookup.pubacks.add(RemoteLookup.stats.lastPubackMicros);
+			RemoteLookup.updateTimeout();
+			return;
+		}
+	}
+}
+
+void RemoteLookupClass::updateTimeout() {
+	unsigned long wait = roundTrips.percentile(config.lookupPercentile);
+	// the reply crosses the broker twice
+	unsigned long hops = pubacks.percentile(config.lookupPercentile) * 2;
+	if (hops > wait) {
+		wait = hops;
+	}
+	wait = (wait + 999) / 1000;
+	_timeout = constrain(wait, config.lookupMinTime, config.lookupMaxTime);
+}
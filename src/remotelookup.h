@@ -0,0 +1,145 @@
+#ifndef remotelookup_h
+#define remotelookup_h
+
+#include <Arduino.h>
+#include "config.h"
+#include "credentialkey.h"
+
+#define LATENCY_BUCKETS 48      // two buckets per power of two, up to about 16 s
+#define LATENCY_WINDOW 128      // counts are halved when this many samples are held
+#define LOOKUP_PENDING 4        // requests tracked at once, at least one per access session
+
+/**
+ * @brief Histogram of latencies in microseconds with two buckets per power
+ * of two, so a percentile is accurate to within about 50%.
+ *
+ * Once LATENCY_WINDOW samples are held every count is halved, so old
+ * samples fade out and the histogram follows the current link.
+ */
+class LatencyHistogram {
+    public:
+    LatencyHistogram();
+
+    void add(unsigned long micros);
+    void clear();
+
+    /**
+     * @brief Upper bound of the bucket holding the given percentile, or 0
+     * without samples.
+     */
+    unsigned long percentile(uint8_t pct) const;
+
+    uint16_t samples() const { return _total; }
+
+    static uint8_t bucket(unsigned long micros);
+    static unsigned long upperBound(uint8_t bucket);
+
+    private:
+    uint16_t _counts[LATENCY_BUCKETS];
+    uint16_t _total;
+};
+
+/**
+ * @brief Tracks the remote lookup of a credential that is not in the local
+ * database.
+ *
+ * request() publishes notify/db/lookup with a request ID; the server
+ * answers on db/lookup echoing that ID. Up to LOOKUP_PENDING requests are
+ * pending, one for each scan AccessControl is deciding; a new request
+ * takes a free slot or the oldest request. A reply is matched on both ID
+ * and credential so a reply from before a reboot cannot be mistaken for a
+ * new one.
+ *
+ * When AccessControl gives up waiting it releases the request, which frees
+ * its slot for the next scan. A reply that still arrives for it is timed
+ * and counted as late, but not handed on.
+ *
+ * Requests are published with QoS 1, so the broker's PUBACK gives the
+ * latency of the first hop as well. The time AccessControl waits for a
+ * reply follows both histograms, see timeout().
+ */
+class RemoteLookupClass {
+    public:
+    RemoteLookupClass();
+
+    /**
+     * @brief Publishes a lookup for key and adds it to the pending
+     * requests. A request that could not be published stays pending, so it
+     * times out like a lost one.
+     * @return the request ID, never 0
+     */
+    uint32_t request(CredentialKey key);
+
+    /**
+     * @brief Matches a reply against the pending requests and records its
+     * round-trip time.
+     *
+     * @return true if the reply belongs to a pending request that was
+     * not released
+     */
+    bool complete(uint32_t request, const char* credential);
+
+    /**
+     * @brief Frees the slot of a request AccessControl stopped waiting
+     * for. Until the slot is taken again a reply to it is still timed.
+     */
+    void release(uint32_t request);
+
+    /**
+     * @brief Counts a matched reply that arrived after AccessControl gave
+     * up waiting.
+     */
+    void late() { ++stats.late; }
+
+    /**
+     * @brief Registered with the MQTT onPublish() callback to time the
+     * PUBACK of a pending request.
+     */
+    static void onMqttPublish(uint16_t packetId);
+
+    /**
+     * @brief Time (ms) to wait for a reply: config.lookupPercentile of the
+     * recent round trips, but at least two broker hops at the same
+     * percentile of PUBACK latency, clamped to config.lookupMinTime and
+     * config.lookupMaxTime. Until LOOKUP_MIN_SAMPLES round trips have been
+     * measured the upper bound is used.
+     */
+    unsigned long timeout() const { return roundTrips.samples() < LOOKUP_MIN_SAMPLES ? config.lookupMaxTime : _timeout; }
+
+    uint8_t pending() const;
+
+    LatencyHistogram roundTrips;
+    LatencyHistogram pubacks;
+
+    struct Stats {
+        unsigned long requests = 0;
+        unsigned long unsent = 0;
+        unsigned long replies = 0;
+        unsigned long late = 0;
+        unsigned long unmatched = 0;
+        unsigned long lastMicros = 0;
+        unsigned long minMicros = 0;
+        unsigned long maxMicros = 0;
+        unsigned long totalMicros = 0;
+        unsigned long lastPubackMicros = 0;
+    } stats;
+
+    private:
+    struct Pending {
+        uint32_t request;       // 0 when the slot is free
+        CredentialKey key;
+        unsigned long sent;
+        uint16_t packetId;      // 0 once the PUBACK arrived
+        bool released;          // AccessControl stopped waiting, the slot is free
+    };
+
+    uint32_t _next;
+    Pending _pending[LOOKUP_PENDING];
+    unsigned long _timeout;
+
+    void updateTimeout();
+};
+
+extern RemoteLookupClass RemoteLookup;
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef spscring_h
+#define spscring_h
+
+#include <Arduino.h>
+
+/**
+ * @brief Fixed-size single-producer/single-consumer ring without locks.
+ *
+ * Meant for handing data from an interrupt handler (the only caller of
+ * push()) to the main loop (the only caller of pop()). Each side writes
+ * only its own index, so neither has to disable interrupts. push() is
+ * forced inline so that it ends up in the IRAM of the calling ISR.
+ *
+ * @tparam T item type, copied by value
+ * @tparam N number of slots, a power of two; one slot is kept free
+ */
+template <typename T, uint16_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    public:
+    SpscRing() : _head(0), _tail(0), _dropped(0) {}
+
+    /**
+     * @brief Adds an item, or counts it as dropped when the ring is full.
+     */
+    inline __attribute__((always_inline)) bool push(const T& item) {
+        uint16_t head = _head;
+        uint16_t next = (head + 1) & (N - 1);
+        if (next == _tail) {
+            ++_dropped;
+            return false;
+        }
+        _items[head] = item;
+        // the item must be stored before the consumer can see the new head
+        __asm__ __volatile__("" ::: "memory");
+        _head = next;
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint16_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        item = _items[tail];
+        __asm__ __volatile__("" ::: "memory");
+        _tail = (tail + 1) & (N - 1);
+        return true;
+    }
+
+    uint16_t size() const { return (_head - _tail) & (N - 1); }
+    uint16_t capacity() const { return N - 1; }
+    bool empty() const { return _head == _tail; }
+    unsigned long dropped() const { return _dropped; }
+
+    private:
+    T _items[N];
+    volatile uint16_t _head;
+    volatile uint16_t _tail;
+    volatile unsigned long _dropped;
+};
+
+#endif
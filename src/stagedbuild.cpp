@@ -0,0 +1,182 @@
+#include "stagedbuild.h"
+#include "credentialblob.h"
+#include "accesscontrol.h"
+#include "mqtt_handler.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+StagedBuildClass StagedBuild;
+
+StagedBuildClass::StagedBuildClass()
+: _state(staged_idle)
+, _builder(FILESYSTEM, STAGED_BUILD_RUNS, STAGED_BUILD_INDEX)
+, _imageSlot(0)
+, _commitStart(0)
+, _lastCommitMillis(0)
+{
+}
+
+bool StagedBuildClass::begin() {
+	abort();
+	_filter.reset(new (std::nothrow) BloomFilter());
+	if (!_filter) {
+		DEBUG_SERIAL.println(F("[ ERROR ] No memory for the staged enrolled filter"));
+		return false;
+	}
+	_filter->clear();
+	if (!_builder.begin()) {
+		DEBUG_SERIAL.println(F("[ ERROR ] Could not start the staged credential index"));
+		_filter.reset();
+		return false;
+	}
+	_imageSlot = 0;
+	_state = staged_collecting;
+	return true;
+}
+
+void StagedBuildClass::add(const char* credential, const JsonDocument& json) {
+	if (_state != staged_collecting) {
+		return;
+	}
+	_filter->add(credential);
+
+	CredentialKey key;
+	if (credentialFromText(credential, key)) {
+		CredentialIndexEntry entry;
+		CredentialIndexClass::entryFromJson(key, json, entry);
+		_builder.add(entry);
+		// the staging slot now holds this record, whatever changed before
+		_changes.erase(std::remove_if(_changes.begin(), _changes.end(),
+			[key](const Change& change) { return change.entry.key == key; }), _changes.end());
+	}
+}
+
+void StagedBuildClass::put(const char* credential, const JsonDocument& json) {
+	CredentialKey key;
+	if (_state == staged_idle || !credentialFromText(credential, key)) {
+		return;
+	}
+	Change change;
+	CredentialIndexClass::entryFromJson(key, json, change.entry);
+	change.removed = false;
+	record(change);
+}
+
+void StagedBuildClass::remove(const char* credential) {
+	CredentialKey key;
+	if (_state == staged_idle || !credentialFromText(credential, key)) {
+		return;
+	}
+	Change change;
+	change.entry.key = key;
+	change.removed = true;
+	record(change);
+}
+
+void StagedBuildClass::record(const Change& change) {
+	if (_changes.size() >= STAGED_BUILD_CHANGES) {
+		DEBUG_SERIAL.println(F("[ WARN ] Too many changes during the staged build, dropping it"));
+		Credentials.abortStage();
+		abort();
+		mqttPublishStage("abort", true, "too many changes");
+		return;
+	}
+	_changes.push_back(change);
+}
+
+bool StagedBuildClass::commit() {
+	if (_state != staged_collecting) {
+		return false;
+	}
+	_commitStart = millis();
+	_state = staged_merging;
+	return true;
+}
+
+void StagedBuildClass::abort() {
+	_builder.abort();
+	_filter.reset();
+	std::vector<Change>().swap(_changes);
+	_state = staged_idle;
+}
+
+/**
+ * @brief Adds image credentials to the staged filter until the time budget
+ * is used up.
+ *
+ * @return true once every slot has been added
+ */
+bool StagedBuildClass::walkImage(unsigned long start) {
+	char credential[CREDENTIAL_TEXT_LEN];
+	CredentialIndexEntry entry;
+	while (_imageSlot < CredentialBlob.slots()) {
+		if (micros() - start >= STAGED_BUILD_MICROS) {
+			return false;
+		}
+		if (CredentialBlob.entryAt(_imageSlot, entry) && entry.key != CREDENTIAL_BLOB_EMPTY_KEY) {
+			credentialToText(entry.key, credential);
+			_filter->add(credential);
+		}
+		++_imageSlot;
+	}
+	return true;
+}
+
+void StagedBuildClass::loop() {
+	if (_state == staged_idle) {
+		return;
+	}
+
+	unsigned long start = micros();
+	bool walked = walkImage(start);
+	if (_state != staged_merging || !walked) {
+		return;
+	}
+
+	unsigned long used = micros() - start;
+	if (used >= STAGED_BUILD_MICROS || !_builder.merge(STAGED_BUILD_MICROS - used)) {
+		return;
+	}
+	finish();
+}
+
+/**
+ * @brief Replays the changes made during the build on the adopted index
+ * and filter, so a credential deleted after it was staged is not granted.
+ */
+void StagedBuildClass::applyChanges() {
+	char credential[CREDENTIAL_TEXT_LEN];
+	for (const Change& change : _changes) {
+		if (change.removed) {
+			CredentialIndex.remove(change.entry.key);
+			EnrolledFilter.invalidate();
+		} else {
+			CredentialIndex.put(change.entry);
+			credentialToText(change.entry.key, credential);
+			EnrolledFilter.add(credential);
+		}
+	}
+}
+
+/**
+ * @brief Swaps in the staged slot, index and filter, which only renames
+ * a file and copies the filter bits, then applies the changes made
+ * meanwhile.
+ */
+void StagedBuildClass::finish() {
+	bool ok = _builder.done() && Credentials.commitStage();
+	if (ok) {
+		CredentialIndex.adopt(_builder.path());
+		EnrolledFilter = *_filter;
+		applyChanges();
+		AccessControl.cache.clear();
+	} else {
+		Credentials.abortStage();
+		FILESYSTEM.remove(_builder.path());
+	}
+
+	_lastCommitMillis = millis() - _commitStart;
+	DEBUG_SERIAL.printf("[ INFO ] Staged credentials %s after %lu ms\n", ok ? "live" : "dropped", _lastCommitMillis);
+	abort();
+	mqttPublishStage("commit", ok);
+}
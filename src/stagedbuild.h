@@ -0,0 +1,102 @@
+#ifndef stagedbuild_h
+#define stagedbuild_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "bloomfilter.h"
+#include "credentialindex.h"
+
+#define STAGED_BUILD_RUNS "/idx.stg"
+#define STAGED_BUILD_INDEX "/idx.new"
+#define STAGED_BUILD_MICROS 2000   // time budget of one build slice in loop()
+#define STAGED_BUILD_CHANGES 64    // live adds and deletes kept while a build runs
+
+enum StagedBuildState {
+    staged_idle,
+    staged_collecting,  // between db/stage begin and commit
+    staged_merging,     // commit requested, finishing the index and filter
+};
+
+/**
+ * @brief Builds the credential index and the enrolled filter of a full
+ * resync while it is being staged, so that committing it only swaps them
+ * in and lookups never wait for a rebuild.
+ *
+ * Every staged record goes into a CredentialIndexBuilder and into a
+ * second filter on the heap; the credentials of the image are added to
+ * that filter a slice at a time from loop(). commit() only marks the
+ * build as complete: loop() then merges the index in slices, and once it
+ * is written makes the staged slot, index and filter live together and
+ * answers notify/db/stage. Until then the live slot, index and filter
+ * keep serving.
+ *
+ * A plain db/add or db/delete while the build runs reaches the staging
+ * slot through SlottedCredentialStore, but not the staged index. Such
+ * changes are kept, up to STAGED_BUILD_CHANGES, and applied in order to
+ * the index and filter right after they are swapped in; beyond that the
+ * build is aborted.
+ */
+class StagedBuildClass {
+    public:
+    StagedBuildClass();
+
+    /**
+     * @brief Starts collecting; the credential store must be staging.
+     */
+    bool begin();
+
+    /**
+     * @brief Adds a record that was put in the staging slot.
+     */
+    void add(const char* credential, const JsonDocument& json);
+
+    /**
+     * @brief A record put or removed outside the resync, after it was
+     * written to the credential store.
+     */
+    void put(const char* credential, const JsonDocument& json);
+    void remove(const char* credential);
+
+    /**
+     * @brief Finishes the build from loop() and then commits the staging
+     * slot.
+     */
+    bool commit();
+
+    void abort();
+
+    /**
+     * @brief The credential image was replaced, so its credentials are
+     * added to the staged filter again.
+     */
+    void imageChanged() { _imageSlot = 0; }
+
+    void loop();
+
+    StagedBuildState state() const { return _state; }
+    bool collecting() const { return _state == staged_collecting; }
+    unsigned long lastCommitMillis() const { return _lastCommitMillis; }
+
+    private:
+    struct Change {
+        CredentialIndexEntry entry;
+        bool removed;
+    };
+
+    StagedBuildState _state;
+    CredentialIndexBuilder _builder;
+    std::unique_ptr<BloomFilter> _filter;
+    std::vector<Change> _changes;
+    uint32_t _imageSlot;
+    unsigned long _commitStart;
+    unsigned long _lastCommitMillis;
+
+    bool walkImage(unsigned long start);
+    void record(const Change& change);
+    void applyChanges();
+    void finish();
+};
+
+extern StagedBuildClass StagedBuild;
+
+#endif
@@ -0,0 +1,248 @@
+#include "userrecord.h"
+
+#define DEBUG_SERIAL if(DEBUG)Serial
+
+/**
+ * @brief Keys that are fully represented by the binary record. Any other key
+ * causes the JSON side blob to be kept.
+ */
+static const char* const decodedKeys[] = {
+	"id",
+	"credential",
+	"username",
+	"validsince",
+	"validuntil",
+	"is_banned",
+	"record_time"
+};
+
+static bool isDecodedKey(const char* key) {
+	for (size_t i = 0; i < sizeof(decodedKeys) / sizeof(decodedKeys[0]); i++) {
+		if (strcmp(key, decodedKeys[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void decodeUserRecord(const String& credential, const JsonDocument& json, UserRecord& user) {
+	user.credential = credential;
+	// records written from the web UI use "user" rather than "username"
+	if (json.containsKey("username")) {
+		user.person = json["username"] | "";
+	} else {
+		user.person = json["user"] | "";
+	}
+	user.is_banned = json["is_banned"].as<int>() > 0;
+	user.has_validsince = json.containsKey("validsince");
+	user.validsince = json["validsince"].as<unsigned long>();
+	user.has_validuntil = json.containsKey("validuntil");
+	user.validuntil = json["validuntil"].as<unsigned long>();
+	user.last_updated = json["record_time"].as<unsigned long>();
+}
+
+size_t writeUserRecord(Print& f, const JsonDocument& json) {
+	UserRecord user;
+	decodeUserRecord(String(), json, user);
+
+	UserRecordHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = USER_RECORD_MAGIC;
+	header.version = USER_RECORD_VERSION;
+	header.validsince = user.validsince;
+	header.validuntil = user.validuntil;
+	header.record_time = user.last_updated;
+	header.name_offset = sizeof(header);
+	header.name_length = user.person.length() > 255 ? 255 : user.person.length();
+
+	if (user.is_banned) {
+		header.flags |= USER_RECORD_FLAG_BANNED;
+	}
+	if (user.has_validsince) {
+		header.flags |= USER_RECORD_FLAG_HAS_VALIDSINCE;
+	}
+	if (user.has_validuntil) {
+		header.flags |= USER_RECORD_FLAG_HAS_VALIDUNTIL;
+	}
+
+	bool keepJson = false;
+	for (JsonPairConst kv : json.as<JsonObjectConst>()) {
+		const char* key = kv.key().c_str();
+		if (strcmp(key, "source") == 0 && kv.value() == "MQTT") {
+			header.flags |= USER_RECORD_FLAG_SOURCE_MQTT;
+		} else if (!isDecodedKey(key)) {
+			keepJson = true;
+		}
+	}
+
+	if (keepJson) {
+		size_t len = measureJson(json);
+		header.json_length = len > 0xFFFF ? 0 : len;
+	}
+
+	size_t written = f.write((const uint8_t*) &header, sizeof(header));
+	written += f.write((const uint8_t*) user.person.c_str(), header.name_length);
+	if (header.json_length) {
+		written += serializeJson(json, f);
+	}
+
+	if (written != sizeof(header) + header.name_length + header.json_length) {
+		DEBUG_SERIAL.println(F("[ WARN ] Short write of user record"));
+		return 0;
+	}
+	return written;
+}
+
+/**
+ * @brief Reads and parses a legacy JSON record. The whole file is read so
+ * that records longer than the old 384 byte buffer are not truncated.
+ */
+static bool readLegacyJson(File& f, JsonDocument& json) {
+	size_t size = f.size();
+	std::unique_ptr<char[]> buf(new char[size + 1]);
+	f.seek(0, SeekSet);
+	f.readBytes(buf.get(), size);
+	buf[size] = '\0';
+	return !deserializeJson(json, buf.get());
+}
+
+static bool readHeader(File& f, UserRecordHeader& header) {
+	f.seek(0, SeekSet);
+	if (f.read((uint8_t*) &header, sizeof(header)) != sizeof(header)) {
+		return false;
+	}
+	return header.magic == USER_RECORD_MAGIC && header.version == USER_RECORD_VERSION;
+}
+
+static void userFromHeader(const UserRecordHeader& header, const char* name, const String& credential, UserRecord& user) {
+	user.credential = credential;
+	user.person = name;
+	user.is_banned = header.flags & USER_RECORD_FLAG_BANNED;
+	user.has_validsince = header.flags & USER_RECORD_FLAG_HAS_VALIDSINCE;
+	user.validsince = header.validsince;
+	user.has_validuntil = header.flags & USER_RECORD_FLAG_HAS_VALIDUNTIL;
+	user.validuntil = header.validuntil;
+	user.last_updated = header.record_time;
+}
+
+/**
+ * @brief Rebuilds the JSON form of a record that has no side blob.
+ */
+static void jsonFromUser(const UserRecord& user, uint8_t flags, JsonDocument& json) {
+	json["credential"] = user.credential;
+	json["username"] = user.person;
+	if (user.has_validsince) {
+		json["validsince"] = user.validsince;
+	}
+	if (user.has_validuntil) {
+		json["validuntil"] = user.validuntil;
+	}
+	if (user.is_banned) {
+		json["is_banned"] = 1;
+	}
+	json["record_time"] = user.last_updated;
+	if (flags & USER_RECORD_FLAG_SOURCE_MQTT) {
+		json["source"] = "MQTT";
+	}
+}
+
+int readUserRecord(File& f, const String& credential, UserRecord& user) {
+	if (f.peek() == '{') {
+		StaticJsonDocument<512> json;
+		if (!readLegacyJson(f, json)) {
+			return 2;
+		}
+		decodeUserRecord(credential, json, user);
+		return 0;
+	}
+
+	UserRecordHeader header;
+	if (!readHeader(f, header)) {
+		return 2;
+	}
+
+	char name[256];
+	f.seek(header.name_offset, SeekSet);
+	size_t len = f.read((uint8_t*) name, header.name_length);
+	name[len] = '\0';
+
+	userFromHeader(header, name, credential, user);
+	return 0;
+}
+
+int readUserRecord(const uint8_t* data, size_t len, const String& credential, UserRecord& user) {
+	if (len > 0 && data[0] == '{') {
+		StaticJsonDocument<512> json;
+		if (deserializeJson(json, (const char*) data, len)) {
+			return 2;
+		}
+		decodeUserRecord(credential, json, user);
+		return 0;
+	}
+
+	UserRecordHeader header;
+	if (len < sizeof(header)) {
+		return 2;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != USER_RECORD_MAGIC || header.version != USER_RECORD_VERSION ||
+	    header.name_offset + header.name_length > len) {
+		return 2;
+	}
+
+	char name[256];
+	memcpy(name, data + header.name_offset, header.name_length);
+	name[header.name_length] = '\0';
+
+	userFromHeader(header, name, credential, user);
+	return 0;
+}
+
+bool readUserRecordJson(File& f, const String& credential, JsonDocument& json) {
+	if (f.peek() == '{') {
+		return readLegacyJson(f, json);
+	}
+
+	UserRecordHeader header;
+	if (!readHeader(f, header)) {
+		return false;
+	}
+
+	if (header.json_length) {
+		std::unique_ptr<char[]> buf(new char[header.json_length + 1]);
+		f.seek(header.name_offset + header.name_length, SeekSet);
+		size_t len = f.readBytes(buf.get(), header.json_length);
+		buf[len] = '\0';
+		return !deserializeJson(json, buf.get());
+	}
+
+	UserRecord user;
+	f.seek(0, SeekSet);
+	readUserRecord(f, credential, user);
+	jsonFromUser(user, header.flags, json);
+	return true;
+}
+
+bool readUserRecordJson(const uint8_t* data, size_t len, const String& credential, JsonDocument& json) {
+	if (len > 0 && data[0] == '{') {
+		return !deserializeJson(json, (const char*) data, len);
+	}
+
+	UserRecord user;
+	if (readUserRecord(data, len, credential, user)) {
+		return false;
+	}
+
+	UserRecordHeader header;
+	memcpy(&header, data, sizeof(header));
+	size_t blob = header.name_offset + header.name_length;
+	if (header.json_length) {
+		if (blob + header.json_length > len) {
+			return false;
+		}
+		return !deserializeJson(json, (const char*) data + blob, header.json_length);
+	}
+
+	jsonFromUser(user, header.flags, json);
+	return true;
+}
@@ -0,0 +1,85 @@
+#ifndef userrecord_h
+#define userrecord_h
+
+#include <memory>
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+
+#define USER_RECORD_MAGIC 0xB5
+#define USER_RECORD_VERSION 1
+
+#define USER_RECORD_FLAG_BANNED 0x01
+#define USER_RECORD_FLAG_HAS_VALIDSINCE 0x02
+#define USER_RECORD_FLAG_HAS_VALIDUNTIL 0x04
+#define USER_RECORD_FLAG_SOURCE_MQTT 0x08
+
+/**
+ * @brief The decoded fields needed to make and report an access decision.
+ */
+struct UserRecord {
+    String credential;
+    String person;
+    unsigned long validsince = 0;
+    unsigned long last_updated = 0;
+    bool is_banned = false;
+    unsigned long validuntil = 0;
+    bool has_validsince = false;
+    bool has_validuntil = false;
+};
+
+/**
+ * @brief Header of a /P/<uid> file. It is followed by the username at
+ * name_offset, then by json_length bytes of the original JSON record when
+ * that record held fields other than the decoded ones.
+ *
+ * Files starting with '{' are legacy JSON records and are still readable.
+ */
+struct __attribute__((packed)) UserRecordHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint8_t name_length;
+    uint32_t validsince;
+    uint32_t validuntil;
+    uint32_t record_time;
+    uint16_t name_offset;
+    uint16_t json_length;
+};
+
+/**
+ * @brief Decodes the fields used by checkUserRecord() and handleResult()
+ * from a JSON user record.
+ */
+void decodeUserRecord(const String& credential, const JsonDocument& json, UserRecord& user);
+
+/**
+ * @brief Writes json as a binary user record. The JSON side blob is only
+ * stored if json has keys that are not part of the binary record.
+ *
+ * @return number of bytes written, 0 on failure
+ */
+size_t writeUserRecord(Print& f, const JsonDocument& json);
+
+/**
+ * @brief Reads the decision fields of a user record without parsing JSON
+ * (unless the file is a legacy JSON record).
+ *
+ * @return 0 on success, 2 if the record could not be decoded
+ */
+int readUserRecord(File& f, const String& credential, UserRecord& user);
+
+/**
+ * @brief Same as above for a record already in RAM. Only the header and
+ * the username need to be present in data.
+ */
+int readUserRecord(const uint8_t* data, size_t len, const String& credential, UserRecord& user);
+
+/**
+ * @brief Loads the full JSON form of a user record, from the side blob when
+ * present or rebuilt from the binary fields otherwise.
+ */
+bool readUserRecordJson(File& f, const String& credential, JsonDocument& json);
+bool readUserRecordJson(const uint8_t* data, size_t len, const String& credential, JsonDocument& json);
+
+#endif
@@ -46,7 +46,7 @@ var config = {
         "openlockpin": 255,
         "doorbellpin": 255,
         "accessdeniedpin": 255,
-        "useridstoragemode": "hexadecimal",
+        "credentialbase": "decimal",
         "requirepincodeafterrfid": 1,
         "allowpincodeonly": 0,
         "doorstatpin": 255,
@@ -164,7 +164,7 @@ function listhardware() {
   document.getElementById("doorbellpin").value = config.hardware.doorbellpin;
   document.getElementById("openlockpin").value = config.hardware.openlockpin;
   document.getElementById("accessdeniedpin").value = config.hardware.accessdeniedpin;
-  document.getElementById("useridstoragemode").value = config.hardware.useridstoragemode;
+  document.getElementById("credentialbase").value = config.hardware.credentialbase || "decimal";
   document.getElementById("requirepincodeafterrfid").checked = config.hardware.requirepincodeafterrfid;
   document.getElementById("allowpincodeonly").checked = config.hardware.allowpincodeonly;
   document.getElementById("ledwaitingpin").value = config.hardware.ledwaitingpin;
@@ -189,6 +189,50 @@ function listhardware() {
   handleLock();
 }
 
+function getwiegand() {
+  var reader = document.getElementById("wgdreader").value;
+  websock.send("{\"command\":\"wiegand\", \"reader\":" + reader + "}");
+}
+
+function setwiegand(clear) {
+  var datatosend = {};
+  datatosend.command = "wiegand";
+  datatosend.reader = parseInt(document.getElementById("wgdreader").value);
+  datatosend.mintime = parseInt(document.getElementById("wgdmintime").value);
+  datatosend.diagnostics = document.getElementById("wgddiagnostics").checked;
+  datatosend.clear = clear;
+  websock.send(JSON.stringify(datatosend));
+}
+
+function savewiegand() {
+  config.hardware.wgdmintime = parseInt(document.getElementById("wgdmintime").value);
+  setwiegand(false);
+  uncommited();
+}
+
+function listwiegand(obj) {
+  var select = document.getElementById("wgdreader");
+  for (var r = select.options.length; r < obj.readers; r++) {
+    select.add(new Option(r + 1, r));
+  }
+  select.value = obj.reader;
+  document.getElementById("wgdmintime").value = obj.mintime;
+  document.getElementById("wgddiagnostics").checked = obj.diagnostics;
+  document.getElementById("wgdseconds").innerHTML = obj.seconds;
+  document.getElementById("wgdedges0").innerHTML = obj.line_edges[0];
+  document.getElementById("wgdedges1").innerHTML = obj.line_edges[1];
+  document.getElementById("wgdglitches0").innerHTML = obj.line_glitches[0];
+  document.getElementById("wgdglitches1").innerHTML = obj.line_glitches[1];
+  document.getElementById("wgdmininterval").innerHTML = obj.min_interval_us;
+  document.getElementById("wgdmaxglitch").innerHTML = obj.max_glitch_us;
+  var rows = "";
+  for (var i = 0; i < obj.intervals.length; i++) {
+    rows += "<tr><td>" + (i * obj.bucket_us) + (i === obj.intervals.length - 1 ? "+" : "") +
+      "</td><td>" + obj.intervals[i] + "</td><td>" + obj.glitch_intervals[i] + "</td></tr>";
+  }
+  document.getElementById("wgdhistogram").innerHTML = rows;
+}
+
 function listlog() {
   websock.send("{\"command\":\"getlatestlog\", \"page\":" + page + ", \"filename\":\"" + theCurrentLogFile +"\"}");
 }
@@ -223,7 +267,8 @@ function savehardware() {
   config.hardware.readertype = parseInt(document.getElementById("readertype").value);
   config.hardware.wgd0pin = parseInt(document.getElementById("wg0pin").value);
   config.hardware.wgd1pin = parseInt(document.getElementById("wg1pin").value);
-  config.hardware.useridstoragemode = document.getElementById("useridstoragemode").value;
+  config.hardware.credentialbase = document.getElementById("credentialbase").value;
+  delete config.hardware.useridstoragemode;
   config.hardware.requirepincodeafterrfid = document.getElementById("requirepincodeafterrfid").checked;
   config.hardware.allowpincodeonly = document.getElementById("allowpincodeonly").checked;
   config.hardware.sspin = parseInt(document.getElementById("gpioss").value);
@@ -741,6 +786,9 @@ function getContent(contentname) {
         case "#hardwarecontent":
           listhardware();
           break;
+        case "#wiegandcontent":
+          getwiegand();
+          break;
         case "#logmaintenancecontent":
           page = 1;
           data = [];
@@ -1473,6 +1521,9 @@ function socketMessageListener(evt) {
           }
           builddata(obj);
           break;
+        case "wiegand":
+        listwiegand(obj);
+        break;
         case "gettime":
         utcSeconds = obj.epoch;
         timezone = obj.timezone;
@@ -1765,6 +1816,10 @@ $("#hardware").click(function() {
   getContent("#hardwarecontent");
   return false;
 });
+$("#wiegand").click(function() {
+  getContent("#wiegandcontent");
+  return false;
+});
 $("#general").click(function() {
   getContent("#generalcontent");
   return false;
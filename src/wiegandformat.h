@@ -0,0 +1,158 @@
+#ifndef wiegandformat_h
+#define wiegandformat_h
+
+#include <Arduino.h>
+#include "magicnumbers.h"
+#include "wiegandframe.h"
+
+enum WiegandResult {
+    frame_decoded,
+    frame_unknown,
+    frame_parity_error
+};
+
+/**
+ * @brief A decoded Wiegand frame.
+ *
+ * code is the credential as it is stored: the facility code shifted above
+ * the card code. For keypad frames cardCode and code hold the key.
+ */
+struct WiegandRead {
+    uint8_t bits;
+    bool keypress;
+    uint32_t facilityCode;
+    uint32_t cardCode;
+    uint64_t code;
+};
+
+/**
+ * @brief Parity mask selecting count bits starting at first of a frame that
+ * is bits long. Bit positions count from the first bit received, as in the
+ * format descriptions, while the mask is in WiegandFrame::ones() order.
+ */
+constexpr uint64_t wiegandRange(uint8_t bits, uint8_t first, uint8_t count) {
+    return ((count >= 64 ? ~0ULL : (1ULL << count) - 1)) << (bits - first - count);
+}
+
+/**
+ * @brief Parity mask of the HID Corporate 1000 formats: every bit from first
+ * to last except those whose position modulo 3 is skip.
+ */
+constexpr uint64_t wiegandInterleaved(uint8_t bits, uint8_t first, uint8_t last, uint8_t skip) {
+    return first > last ? 0 :
+        ((first % 3 == skip ? 0 : 1ULL << (bits - 1 - first)) | wiegandInterleaved(bits, first + 1, last, skip));
+}
+
+/**
+ * @brief Describes a card format of at most 64 bits.
+ *
+ * The frame is valid when the bits under EvenMask have even parity and
+ * those under OddMask (and OddMask2, if not 0) have odd parity, parity
+ * bits included. CodeShift is how far the facility code is shifted when
+ * building the stored credential.
+ */
+template <uint8_t Bits, uint8_t FacilityFirst, uint8_t FacilityBits, uint8_t CardFirst, uint8_t CardBits,
+          uint8_t CodeShift, uint64_t EvenMask, uint64_t OddMask, uint64_t OddMask2 = 0>
+struct WiegandFormat {
+    static_assert(Bits <= 64, "formats are decoded from the low word of the frame");
+    static constexpr uint8_t bits = Bits;
+    static constexpr uint8_t facilityFirst = FacilityFirst;
+    static constexpr uint8_t facilityBits = FacilityBits;
+    static constexpr uint8_t cardFirst = CardFirst;
+    static constexpr uint8_t cardBits = CardBits;
+    static constexpr uint8_t codeShift = CodeShift;
+    static constexpr uint64_t evenMask = EvenMask;
+    static constexpr uint64_t oddMask = OddMask;
+    static constexpr uint64_t oddMask2 = OddMask2;
+};
+
+// H10301, the standard 26-bit format
+typedef WiegandFormat<26, 1, 8, 9, 16, 16,
+    wiegandRange(26, 0, 13),
+    wiegandRange(26, 13, 13)> WiegandH10301;
+
+// H10306, 34-bit with a 16-bit facility code
+typedef WiegandFormat<34, 1, 16, 17, 16, 16,
+    wiegandRange(34, 0, 17),
+    wiegandRange(34, 17, 17)> WiegandH10306;
+
+// HID Corporate 1000 35-bit. The facility code is shifted by 16 over a
+// 20-bit card code, as the HidProxWiegand based reader did, so that
+// existing credentials keep matching.
+typedef WiegandFormat<35, 2, 12, 14, 20, 16,
+    wiegandRange(35, 1, 1) | wiegandInterleaved(35, 2, 33, 1),
+    wiegandRange(35, 34, 1) | wiegandInterleaved(35, 1, 33, 0),
+    wiegandRange(35, 0, 35)> WiegandCorporate35;
+
+// H10304, 37-bit with a 16-bit facility code
+typedef WiegandFormat<37, 1, 16, 17, 19, 19,
+    wiegandRange(37, 0, 19),
+    wiegandRange(37, 18, 19)> WiegandH10304;
+
+// HID Corporate 1000 48-bit
+typedef WiegandFormat<48, 2, 22, 24, 23, 23,
+    wiegandRange(48, 1, 1) | wiegandInterleaved(48, 2, 46, 1),
+    wiegandRange(48, 47, 1) | wiegandInterleaved(48, 1, 46, 0),
+    wiegandRange(48, 0, 48)> WiegandCorporate48;
+
+// A key pressed on a reader keypad, sent as its 4-bit value
+struct WiegandKeypad4 {
+    static constexpr uint8_t bits = WIEGANDTYPE_KEYPRESS4;
+};
+
+// A key pressed on a reader keypad, sent as the inverted value followed by
+// the value
+struct WiegandKeypad8 {
+    static constexpr uint8_t bits = WIEGANDTYPE_KEYPRESS8;
+};
+
+/**
+ * @brief Decodes a frame already known to be Format::bits long. Every
+ * position and mask is a constant, so each instance is a handful of shifts,
+ * masks and popcounts.
+ */
+template <class Format>
+struct WiegandDecoder {
+    static WiegandResult decode(const WiegandFrame& frame, WiegandRead& read) {
+        const uint64_t lo = frame.low();
+        bool valid = (__builtin_popcountll(lo & Format::evenMask) & 1) == 0
+            && (__builtin_popcountll(lo & Format::oddMask) & 1) == 1
+            && (__builtin_popcountll(lo & Format::oddMask2) & 1) == (Format::oddMask2 ? 1 : 0);
+
+        read.bits = Format::bits;
+        read.keypress = false;
+        read.facilityCode = (lo >> (Format::bits - Format::facilityFirst - Format::facilityBits))
+            & ((1ULL << Format::facilityBits) - 1);
+        read.cardCode = (lo >> (Format::bits - Format::cardFirst - Format::cardBits))
+            & ((1ULL << Format::cardBits) - 1);
+        read.code = ((uint64_t)read.facilityCode << Format::codeShift) | read.cardCode;
+        return valid ? frame_decoded : frame_parity_error;
+    }
+};
+
+template <>
+struct WiegandDecoder<WiegandKeypad4> {
+    static WiegandResult decode(const WiegandFrame& frame, WiegandRead& read) {
+        read.bits = WiegandKeypad4::bits;
+        read.keypress = true;
+        read.facilityCode = 0;
+        read.cardCode = frame.low() & 0x0F;
+        read.code = read.cardCode;
+        return frame_decoded;
+    }
+};
+
+template <>
+struct WiegandDecoder<WiegandKeypad8> {
+    static WiegandResult decode(const WiegandFrame& frame, WiegandRead& read) {
+        const uint64_t lo = frame.low();
+        read.bits = WiegandKeypad8::bits;
+        read.keypress = true;
+        read.facilityCode = 0;
+        read.cardCode = lo & 0x0F;
+        read.code = read.cardCode;
+        return ((lo >> 4) & 0x0F) == (~lo & 0x0F) ? frame_decoded : frame_parity_error;
+    }
+};
+
+#endif
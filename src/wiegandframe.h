@@ -0,0 +1,91 @@
+#ifndef wiegandframe_h
+#define wiegandframe_h
+
+#include <Arduino.h>
+
+#define WIEGAND_MAX_BITS 128
+
+/**
+ * @brief Bits of one Wiegand frame packed into a 128-bit shift register.
+ *
+ * Bits are numbered in the order they were received, starting at 0, as in
+ * the usual format descriptions. Fields of up to 64 bits are read with a
+ * shift and a mask, and parity is a popcount, so decoding costs the same
+ * whatever the frame length.
+ */
+class WiegandFrame {
+    public:
+    WiegandFrame() { clear(); }
+
+    void clear() {
+        _hi = 0;
+        _lo = 0;
+        _bits = 0;
+    }
+
+    /**
+     * @brief Appends a bit.
+     * @return false if the frame is already WIEGAND_MAX_BITS long
+     */
+    bool push(bool bit) {
+        if (_bits >= WIEGAND_MAX_BITS) {
+            return false;
+        }
+        _hi = (_hi << 1) | (_lo >> 63);
+        _lo = (_lo << 1) | (bit ? 1 : 0);
+        ++_bits;
+        return true;
+    }
+
+    uint8_t size() const { return _bits; }
+
+    /**
+     * @brief Reads count bits (at most 64) starting at bit first, the first
+     * of them in the most significant position.
+     */
+    uint64_t field(uint8_t first, uint8_t count) const {
+        if (count == 0 || first + count > _bits) {
+            return 0;
+        }
+        uint8_t shift = _bits - first - count;
+        uint64_t value;
+        if (shift == 0) {
+            value = _lo;
+        } else if (shift >= 64) {
+            value = _hi >> (shift - 64);
+        } else {
+            value = (_lo >> shift) | (_hi << (64 - shift));
+        }
+        return count >= 64 ? value : value & ((1ULL << count) - 1);
+    }
+
+    bool bit(uint8_t i) const { return field(i, 1) != 0; }
+
+    /**
+     * @brief Number of set bits among count bits starting at first.
+     */
+    uint8_t ones(uint8_t first, uint8_t count) const {
+        return __builtin_popcountll(field(first, count));
+    }
+
+    /**
+     * @brief Number of set bits selected by mask, where bit 0 of the mask
+     * is the last bit received. Only frames of up to 64 bits.
+     */
+    uint8_t ones(uint64_t mask) const { return __builtin_popcountll(_lo & mask); }
+
+    /**
+     * @brief The last 64 bits received, the last of them in bit 0.
+     */
+    uint64_t low() const { return _lo; }
+
+    bool evenParity(uint8_t first, uint8_t count) const { return (ones(first, count) & 1) == 0; }
+    bool oddParity(uint8_t first, uint8_t count) const { return (ones(first, count) & 1) == 1; }
+
+    private:
+    uint64_t _hi;
+    uint64_t _lo;
+    uint8_t _bits;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// The little of the Arduino core the host tests need (see [env:native]).
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+
+typedef uint8_t byte;
+
+class String {
+    public:
+    String(const char* text = "") : _s(text ? text : "") {}
+
+    String& operator=(const char* text) {
+        _s = text ? text : "";
+        return *this;
+    }
+
+    void toUpperCase() {
+        for (size_t i = 0; i < _s.size(); i++) {
+            _s[i] = toupper((unsigned char)_s[i]);
+        }
+    }
+
+    void toLowerCase() {
+        for (size_t i = 0; i < _s.size(); i++) {
+            _s[i] = tolower((unsigned char)_s[i]);
+        }
+    }
+
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.size(); }
+    bool operator==(const char* text) const { return _s == text; }
+    bool operator!=(const char* text) const { return _s != text; }
+
+    private:
+    std::string _s;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include <unity.h>
+#include "cooldowntable.h"
+
+static const unsigned long HOLD = 3000;
+
+static void test_same_credential_is_held() {
+    CoolDownTable<32> table;
+    table.add(1234, 1000, HOLD);
+    TEST_ASSERT_TRUE(table.holding(1234, 1000, HOLD));
+    TEST_ASSERT_TRUE(table.holding(1234, 1000 + HOLD - 1, HOLD));
+    TEST_ASSERT_FALSE(table.holding(1234, 1000 + HOLD, HOLD));
+}
+
+static void test_other_credentials_are_not_held() {
+    CoolDownTable<32> table;
+    table.add(1234, 1000, HOLD);
+    TEST_ASSERT_FALSE(table.holding(1235, 1000, HOLD));
+    TEST_ASSERT_FALSE(table.holding(0, 1000, HOLD));
+}
+
+static void test_add_restarts_the_hold() {
+    CoolDownTable<32> table;
+    table.add(1234, 1000, HOLD);
+    table.add(1234, 2500, HOLD);
+    TEST_ASSERT_TRUE(table.holding(1234, 1000 + HOLD, HOLD));
+    TEST_ASSERT_FALSE(table.holding(1234, 2500 + HOLD, HOLD));
+}
+
+static void test_hold_across_millis_overflow() {
+    CoolDownTable<32> table;
+    const unsigned long before = (unsigned long)-1000;
+    table.add(1234, before, HOLD);
+    TEST_ASSERT_TRUE(table.holding(1234, before + HOLD - 1, HOLD));
+    TEST_ASSERT_FALSE(table.holding(1234, before + HOLD, HOLD));
+}
+
+/**
+ * @brief A queue of people badging one after the other, each 500 ms apart:
+ * nobody waits for the one before, while each repeated badge within the
+ * hold is still ignored.
+ */
+static void test_queue_of_people() {
+    CoolDownTable<32> table;
+    unsigned long t = 0;
+    for (uint64_t fob = 1000; fob < 1020; fob++, t += 500) {
+        TEST_ASSERT_FALSE(table.holding(fob, t, HOLD));
+        table.add(fob, t, HOLD);
+        TEST_ASSERT_TRUE(table.holding(fob, t + 200, HOLD));
+    }
+    TEST_ASSERT_EQUAL(0, table.evictions);
+}
+
+/**
+ * @brief With more held credentials than probed slots, the one that
+ * expires first is evicted and the newest are still held.
+ */
+static void test_eviction_when_full() {
+    CoolDownTable<4> table;
+    for (uint64_t fob = 1; fob <= 5; fob++) {
+        table.add(fob, fob * 10, HOLD);
+    }
+    TEST_ASSERT_EQUAL(1, table.evictions);
+    TEST_ASSERT_FALSE(table.holding(1, 50, HOLD));
+    for (uint64_t fob = 2; fob <= 5; fob++) {
+        TEST_ASSERT_TRUE(table.holding(fob, 50, HOLD));
+    }
+}
+
+void runCoolDownTableTests() {
+    RUN_TEST(test_same_credential_is_held);
+    RUN_TEST(test_other_credentials_are_not_held);
+    RUN_TEST(test_add_restarts_the_hold);
+    RUN_TEST(test_hold_across_millis_overflow);
+    RUN_TEST(test_queue_of_people);
+    RUN_TEST(test_eviction_when_full);
+}
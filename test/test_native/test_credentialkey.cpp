@@ -0,0 +1,62 @@
+#include <unity.h>
+#include "credentialkey.h"
+
+static bool hexKeys;
+
+bool credentialHexKeys() { return hexKeys; }
+
+// hardware["credentialbase"] of a config saved before the setting existed,
+// such as the web UI default with "useridstoragemode": "hexadecimal"
+static const char* const UPGRADED_BASE = nullptr;
+
+static void test_upgraded_config_is_decimal() {
+    TEST_ASSERT_FALSE(credentialBaseHex(UPGRADED_BASE));
+    TEST_ASSERT_FALSE(credentialBaseHex("decimal"));
+    TEST_ASSERT_TRUE(credentialBaseHex("hexadecimal"));
+}
+
+static void test_upgraded_config_matches_decimal_record() {
+    hexKeys = credentialBaseHex(UPGRADED_BASE);
+    // /P/12345678, as String(code, DEC) named it before credential keys
+    const char* record = "12345678";
+    char text[CREDENTIAL_TEXT_LEN];
+    credentialToText(12345678, text);
+    TEST_ASSERT_EQUAL_STRING(record, text);
+
+    CredentialKey key;
+    TEST_ASSERT_TRUE(credentialFromText(record, key));
+    TEST_ASSERT_TRUE(key == 12345678);
+
+    String legacy;
+    TEST_ASSERT_FALSE(credentialLegacyName(record, legacy));
+}
+
+static void test_hexadecimal_base() {
+    hexKeys = credentialBaseHex("hexadecimal");
+    char text[CREDENTIAL_TEXT_LEN];
+    credentialToText(0xbc614e, text);
+    TEST_ASSERT_EQUAL_STRING("bc614e", text);
+
+    CredentialKey key;
+    TEST_ASSERT_TRUE(credentialFromText("BC614E", key));
+    TEST_ASSERT_TRUE(key == 0xbc614e);
+
+    char enrolled[] = "BC614E";
+    credentialNormalize(enrolled);
+    TEST_ASSERT_EQUAL_STRING("bc614e", enrolled);
+}
+
+static void test_rejects_leading_zeros() {
+    hexKeys = false;
+    CredentialKey key;
+    TEST_ASSERT_FALSE(credentialFromText("012345678", key));
+    TEST_ASSERT_FALSE(credentialFromText("12a", key));
+    TEST_ASSERT_TRUE(credentialFromText("0", key));
+}
+
+void runCredentialKeyTests() {
+    RUN_TEST(test_upgraded_config_is_decimal);
+    RUN_TEST(test_upgraded_config_matches_decimal_record);
+    RUN_TEST(test_hexadecimal_base);
+    RUN_TEST(test_rejects_leading_zeros);
+}
@@ -0,0 +1,19 @@
+#include <unity.h>
+
+void runCredentialKeyTests();
+void runPn532FrameTests();
+void runWiegandFormatTests();
+void runCoolDownTableTests();
+
+void setUp() {}
+
+void tearDown() {}
+
+int main() {
+    UNITY_BEGIN();
+    runCredentialKeyTests();
+    runPn532FrameTests();
+    runWiegandFormatTests();
+    runCoolDownTableTests();
+    return UNITY_END();
+}
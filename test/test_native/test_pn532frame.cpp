@@ -0,0 +1,115 @@
+#include <unity.h>
+#include "pn532frame.h"
+
+static byte buffer[64];
+static Pn532FrameParser parser;
+
+/**
+ * @brief Feeds bytes one at a time, as the reader does over several loop()
+ * steps. @return the bytes taken before the parser stopped asking
+ */
+static size_t feed(const byte *bytes, size_t n) {
+    parser.begin(buffer, sizeof(buffer));
+    for (size_t i = 0; i < n; i++) {
+        if (!parser.push(bytes[i])) {
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Wraps data in a normal information frame, with correct checksums.
+ */
+static size_t frame(const byte *data, uint8_t size, byte *out) {
+    size_t n = 0;
+    out[n++] = 0x00; // preamble
+    out[n++] = 0x00;
+    out[n++] = 0xFF;
+    out[n++] = size;
+    out[n++] = (byte)(0x100 - size);
+    byte sum = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        out[n++] = data[i];
+        sum += data[i];
+    }
+    out[n++] = (byte)(0x100 - sum);
+    out[n++] = 0x00; // postamble
+    return n;
+}
+
+static void test_ack() {
+    const byte ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    TEST_ASSERT_EQUAL(5, feed(ack, sizeof(ack)));
+    TEST_ASSERT_TRUE(parser.complete());
+    TEST_ASSERT_TRUE(parser.ack());
+}
+
+static void test_inautopoll_response() {
+    // one Mifare target: type 0x10, Tg, SENS_RES, SEL_RES, 4 byte UID
+    const byte data[] = {0xD5, 0x61, 0x01, 0x10, 0x09, 0x01, 0x00, 0x04, 0x08, 0x04, 0xDE, 0xAD, 0xBE, 0xEF};
+    byte bytes[32];
+    size_t n = frame(data, sizeof(data), bytes);
+    TEST_ASSERT_EQUAL(n - 1, feed(bytes, n));
+    TEST_ASSERT_TRUE(parser.complete());
+    TEST_ASSERT_FALSE(parser.ack());
+    TEST_ASSERT_EQUAL(sizeof(data), parser.size);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, buffer, sizeof(data));
+}
+
+static void test_inlistpassivetarget_response() {
+    const byte data[] = {0xD5, 0x4B, 0x01, 0x01, 0x00, 0x04, 0x08, 0x04, 0x12, 0x34, 0x56, 0x78};
+    byte bytes[32];
+    size_t n = frame(data, sizeof(data), bytes);
+    // noise before the start code is skipped
+    byte noisy[40] = {0xFF, 0x12, 0x00};
+    memcpy(noisy + 3, bytes, n);
+    TEST_ASSERT_EQUAL(n + 2, feed(noisy, n + 3));
+    TEST_ASSERT_TRUE(parser.complete());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, buffer, sizeof(data));
+}
+
+static void test_bad_length_checksum() {
+    const byte data[] = {0xD5, 0x4B, 0x00};
+    byte bytes[16];
+    size_t n = frame(data, sizeof(data), bytes);
+    bytes[4] ^= 0x01;
+    TEST_ASSERT_EQUAL(5, feed(bytes, n));
+    TEST_ASSERT_EQUAL(Pn532FrameParser::failed, parser.state);
+}
+
+static void test_bad_data_checksum() {
+    const byte data[] = {0xD5, 0x4B, 0x01, 0x01, 0x00, 0x04, 0x08, 0x04, 0x12, 0x34, 0x56, 0x78};
+    byte bytes[32];
+    size_t n = frame(data, sizeof(data), bytes);
+    bytes[5 + sizeof(data)] ^= 0x01;
+    TEST_ASSERT_EQUAL(n - 1, feed(bytes, n));
+    TEST_ASSERT_EQUAL(Pn532FrameParser::failed, parser.state);
+}
+
+static void test_empty_frame_is_not_an_ack() {
+    // size 0 with LCS 0x00 passes the length checksum but is no ACK
+    const byte empty[] = {0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00};
+    TEST_ASSERT_EQUAL(5, feed(empty, sizeof(empty)));
+    TEST_ASSERT_EQUAL(Pn532FrameParser::failed, parser.state);
+    TEST_ASSERT_FALSE(parser.ack());
+}
+
+static void test_frame_larger_than_buffer() {
+    const byte bytes[] = {0x00, 0x00, 0xFF, 0x41, 0xBF};
+    parser.begin(buffer, 0x40);
+    for (byte b : bytes) {
+        parser.push(b);
+    }
+    TEST_ASSERT_EQUAL(Pn532FrameParser::failed, parser.state);
+}
+
+void runPn532FrameTests() {
+    RUN_TEST(test_ack);
+    RUN_TEST(test_inautopoll_response);
+    RUN_TEST(test_inlistpassivetarget_response);
+    RUN_TEST(test_bad_length_checksum);
+    RUN_TEST(test_bad_data_checksum);
+    RUN_TEST(test_empty_frame_is_not_an_ack);
+    RUN_TEST(test_frame_larger_than_buffer);
+}
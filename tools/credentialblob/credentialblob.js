@@ -0,0 +1,234 @@
+#!/usr/bin/env node
+// Builds the credential image read by src/credentialblob.cpp.
+//
+//   node credentialblob.js users.json image.bin [--messages out.jsonl]
+//        [--id hostname] [--chunk 1024] [--lambda 4] [--load 0.98]
+//
+// users.json is an array of db/add style records (credential, username,
+// validsince, validuntil, is_banned), or an object with such an array in
+// "userlist" (the notify/db/list format). With --messages, the db/blob
+// begin/chunk/commit payloads are written one per line, ready to publish
+// in order to <topic>/db/blob, waiting for each notify/db/blob ack.
+
+const fs = require("fs");
+
+const MAGIC = 0x48504d43; // "CMPH"
+const VERSION = 1;
+const HEADER_SIZE = 32;
+const ENTRY_SIZE = 32;
+const NAME_LEN = 15;
+const ALIGN = 32;
+const MAX_DISPLACEMENT = 0xffff;
+const EMPTY_KEY = 0xffffffffffffffffn;
+
+const FLAG_BANNED = 0x01;
+const FLAG_HAS_VALIDSINCE = 0x02;
+const FLAG_HAS_VALIDUNTIL = 0x04;
+
+function fmix32(h) {
+    h ^= h >>> 16;
+    h = Math.imul(h, 0x85ebca6b);
+    h ^= h >>> 13;
+    h = Math.imul(h, 0xc2b2ae35);
+    h ^= h >>> 16;
+    return h >>> 0;
+}
+
+// must match CredentialBlobClass::hash() and ::slot()
+function hash(key, seed) {
+    const lo = Number(key & 0xffffffffn);
+    const hi = Number(key >> 32n);
+    return fmix32((fmix32((lo ^ seed) >>> 0) ^ hi) >>> 0);
+}
+
+function slot(g, displacement, slots) {
+    return fmix32((g + Math.imul(displacement, 0x9e3779b9)) >>> 0) % slots;
+}
+
+const CRC_TABLE = (() => {
+    const table = new Uint32Array(256);
+    for (let n = 0; n < 256; n++) {
+        let c = n;
+        for (let k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320 ^ (c >>> 1) : c >>> 1;
+        }
+        table[n] = c >>> 0;
+    }
+    return table;
+})();
+
+function crc32(buf) {
+    let crc = 0xffffffff;
+    for (let i = 0; i < buf.length; i++) {
+        crc = CRC_TABLE[(crc ^ buf[i]) & 0xff] ^ (crc >>> 8);
+    }
+    return (crc ^ 0xffffffff) >>> 0;
+}
+
+// same rules as CredentialIndexClass::keyFromString()
+function parseKey(credential) {
+    const s = String(credential);
+    if (!/^(0|[1-9][0-9]{0,18})$/.test(s)) {
+        return null;
+    }
+    return BigInt(s);
+}
+
+function loadRecords(file) {
+    const json = JSON.parse(fs.readFileSync(file, "utf8"));
+    const list = Array.isArray(json) ? json : json.userlist || [];
+    const records = new Map();
+    for (const item of list) {
+        const record = item.record || item;
+        const credential = record.credential !== undefined ? record.credential : item.uid;
+        const key = parseKey(credential);
+        if (key === null) {
+            console.warn("[ WARN ] Skipping credential that is not plain decimal: " + credential);
+            continue;
+        }
+        records.set(key, record);
+    }
+    return records;
+}
+
+function writeEntry(buf, offset, key, record) {
+    let flags = 0;
+    if (record.is_banned > 0) {
+        flags |= FLAG_BANNED;
+    }
+    if (record.validsince !== undefined) {
+        flags |= FLAG_HAS_VALIDSINCE;
+    }
+    if (record.validuntil !== undefined) {
+        flags |= FLAG_HAS_VALIDUNTIL;
+    }
+    buf.writeBigUInt64LE(key, offset);
+    buf.writeUInt32LE((record.validsince || 0) >>> 0, offset + 8);
+    buf.writeUInt32LE((record.validuntil || 0) >>> 0, offset + 12);
+    buf.writeUInt8(flags, offset + 16);
+    const name = Buffer.from(String(record.username !== undefined ? record.username : record.user || ""), "utf8");
+    name.copy(buf, offset + 17, 0, Math.min(name.length, NAME_LEN));
+}
+
+// hash and displace: place the largest buckets first, trying displacements
+// until every key of the bucket lands on a free slot
+function place(keys, buckets, count, seed) {
+    const members = Array.from({ length: buckets }, () => []);
+    for (const key of keys) {
+        const g = hash(key, seed);
+        members[g % buckets].push({ key, g });
+    }
+
+    const order = members.map((m, i) => i).sort((a, b) => members[b].length - members[a].length);
+    const displacements = new Uint16Array(buckets);
+    const slots = new Array(count).fill(null);
+
+    for (const b of order) {
+        const bucket = members[b];
+        if (bucket.length === 0) {
+            break;
+        }
+        let placed = false;
+        for (let d = 0; d <= MAX_DISPLACEMENT && !placed; d++) {
+            const taken = [];
+            for (const m of bucket) {
+                const s = slot(m.g, d, count);
+                if (slots[s] !== null || taken.includes(s)) {
+                    break;
+                }
+                taken.push(s);
+            }
+            if (taken.length === bucket.length) {
+                bucket.forEach((m, i) => (slots[taken[i]] = m.key));
+                displacements[b] = d;
+                placed = true;
+            }
+        }
+        if (!placed) {
+            return null;
+        }
+    }
+    return { displacements, slots };
+}
+
+// a few spare slots keep the last buckets from searching for the one
+// remaining free slot
+function build(records, lambda, load) {
+    const keys = Array.from(records.keys());
+    const count = Math.max(1, Math.ceil(keys.length / load));
+    const buckets = Math.max(1, Math.ceil(keys.length / lambda));
+
+    for (let attempt = 0; attempt < 32; attempt++) {
+        const seed = (Math.random() * 0x100000000) >>> 0;
+        const result = place(keys, buckets, count, seed);
+        if (result === null) {
+            continue;
+        }
+
+        const entriesOffset = Math.ceil((HEADER_SIZE + buckets * 2) / ALIGN) * ALIGN;
+        const buf = Buffer.alloc(entriesOffset + count * ENTRY_SIZE);
+        for (let b = 0; b < buckets; b++) {
+            buf.writeUInt16LE(result.displacements[b], HEADER_SIZE + b * 2);
+        }
+        result.slots.forEach((key, s) => {
+            if (key === null) {
+                buf.writeBigUInt64LE(EMPTY_KEY, entriesOffset + s * ENTRY_SIZE);
+            } else {
+                writeEntry(buf, entriesOffset + s * ENTRY_SIZE, key, records.get(key));
+            }
+        });
+
+        buf.writeUInt32LE(MAGIC, 0);
+        buf.writeUInt16LE(VERSION, 4);
+        buf.writeUInt16LE(ENTRY_SIZE, 6);
+        buf.writeUInt32LE(count, 8);
+        buf.writeUInt32LE(buckets, 12);
+        buf.writeUInt32LE(seed, 16);
+        buf.writeUInt32LE(entriesOffset, 20);
+        buf.writeUInt32LE(keys.length, 28);
+        buf.writeUInt32LE(crc32(buf.subarray(HEADER_SIZE)), 24);
+        return buf;
+    }
+    throw new Error("no perfect hash found, try a smaller --lambda or --load");
+}
+
+function messages(image, id, chunk) {
+    const lines = [];
+    lines.push({ id, action: "begin", size: image.length, crc: image.readUInt32LE(24) });
+    for (let offset = 0; offset < image.length; offset += chunk) {
+        lines.push({ id, action: "chunk", offset, data: image.subarray(offset, offset + chunk).toString("base64") });
+    }
+    lines.push({ id, action: "commit" });
+    return lines.map((m) => JSON.stringify(m)).join("\n") + "\n";
+}
+
+function main(argv) {
+    const args = [];
+    const options = { id: "esp-rfid", chunk: 1024, lambda: 4, load: 0.98 };
+    for (let i = 0; i < argv.length; i++) {
+        if (argv[i].startsWith("--")) {
+            options[argv[i].slice(2)] = argv[++i];
+        } else {
+            args.push(argv[i]);
+        }
+    }
+    if (args.length !== 2) {
+        console.log("Usage: credentialblob.js users.json image.bin [--messages out.jsonl] [--id hostname] [--chunk 1024] [--lambda 4] [--load 0.98]");
+        process.exit(1);
+    }
+
+    const records = loadRecords(args[0]);
+    const image = build(records, Number(options.lambda), Number(options.load));
+    fs.writeFileSync(args[1], image);
+    console.log("[ INFO ] " + records.size + " credentials, " + image.length + " bytes, crc " + image.readUInt32LE(24).toString(16));
+
+    if (options.messages) {
+        fs.writeFileSync(options.messages, messages(image, options.id, Number(options.chunk)));
+    }
+}
+
+module.exports = { hash, slot, crc32, build };
+
+if (require.main === module) {
+    main(process.argv.slice(2));
+}